@@ -75,10 +75,10 @@ public:
     isFaceUp = false;
   }
   
-  char rank_;
-  char suit_;
-  int value;
-  bool isFaceUp;
+  char rank_ = 0;
+  char suit_ = 0;
+  int value = 0;
+  bool isFaceUp = false;
 
 private:
 
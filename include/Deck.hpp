@@ -1,9 +1,12 @@
+#pragma once
 #include <iostream>
 //#include <string>
 #include <iostream>
 #include <algorithm>
 #include <vector>
-//#include <deque>
+#include <random>
+#include <cstdint>
+#include <deque>
 #include "Card.hpp"
 
 using namespace std;
@@ -149,6 +152,15 @@ public:
             std::swap( cards_[i] , cards_[ rand()%311] );
         }
     }
+    // same seed, same shoe, so a logged round can be dealt again
+    void shuffle(std::uint32_t seed)
+    {
+        seed_ = seed;
+        refilled_ = false;
+        std::mt19937 gen(seed);
+        for (std::size_t i = cards_.size(); i > 1; --i)
+            std::swap(cards_[i - 1], cards_[gen() % i]);
+    }
     int cardsLeft()
     {
       return cards_.size();
@@ -169,15 +181,30 @@ public:
     }
     
     //get card and return it
+    // a shoe dealt to the end is built and shuffled again from the same seed, never read past
     Card getCard()
     {
+        if(deck_is_empty())
+        {
+            build();
+            shuffle(seed_);
+            refilled_ = true;
+        }
         Card temp = cards_.front();
         cards_.pop_front();
         return temp;
     }
 
+    // the shoe ran out and started over since the last shuffle
+    bool refilled() const
+    {
+        return refilled_;
+    }
+
     std::deque <Card> cards_;
 private:
+    std::uint32_t seed_ = 0;
+    bool refilled_ = false;
     
 };
 
@@ -71,7 +71,7 @@ class Hand
         {
             bool result = false;
             Card C;
-            for(int i=0; i < inHand.size(); i++)
+            for(std::size_t i=0; i < inHand.size(); i++)
             {
                 C = inHand[i];
                 if(C.getValue() == 11)
@@ -104,13 +104,14 @@ class Hand
             return result;
         }
 
+        // only a pair splits
         bool canSplit()
         {
-            //if(inHand.size() != 2)
-            //    return false;
+            if(inHand.size() != 2)
+                return false;
 
-            //if(inHand[0].getRank() != inHand[1].getRank())
-            //    return false;
+            if(inHand[0].getRank() != inHand[1].getRank())
+                return false;
 
             return true;
         }
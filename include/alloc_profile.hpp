@@ -0,0 +1,245 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// heap traffic by code path, for finding the allocations worth getting rid of
+//
+// off unless enable() was called, then operator new hands every allocation to count() and it
+// is charged to the scopes open on the allocating thread, outermost first, like "hit/table text".
+// every thread counts into a fixed table of its own, only it writes there, so counting takes
+// no lock and allocates nothing. scope names have to be string literals, they are kept as pointers.
+
+namespace alloc_profile
+{
+    enum { max_depth = 4, paths_per_thread = 512 };
+
+    inline std::atomic<bool>& switched_on()
+    {
+        static std::atomic<bool> on{false};
+        return on;
+    }
+
+    inline void enable()
+    {
+        switched_on().store(true, std::memory_order_release);
+    }
+
+    inline bool enabled()
+    {
+        return switched_on().load(std::memory_order_relaxed);
+    }
+
+    class profiler
+    {
+        public:
+            static profiler& instance()
+            {
+                static profiler p;
+                return p;
+            }
+
+            void push(const char* tag)
+            {
+                state& s = mine();
+                if (s.depth < max_depth)
+                    s.path[s.depth] = tag;
+                s.depth++;
+            }
+
+            // a run of the innermost scope is over
+            void pop()
+            {
+                state& s = mine();
+                if (s.depth <= max_depth)
+                    if (entry* e = find(s))
+                        bump(e->runs, 1);
+                s.depth--;
+            }
+
+            void count(std::size_t bytes)
+            {
+                state& s = mine();
+                if (s.busy)
+                    return;
+                if (entry* e = find(s))
+                {
+                    bump(e->allocations, 1);
+                    bump(e->bytes, bytes);
+                }
+            }
+
+            // every path seen, most allocations first
+            std::string report()
+            {
+                busy_guard quiet(mine()); // the report's own allocations aren't traffic
+                struct totals { std::int64_t runs = 0, allocations = 0, bytes = 0; };
+                std::map<std::string, totals> paths;
+                std::int64_t all = 0;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    for (auto& t : threads_)
+                    {
+                        for (auto& e : t->entries)
+                        {
+                            if (!e.used.load(std::memory_order_acquire))
+                                continue;
+                            std::string name;
+                            for (int i = 0; i < max_depth && e.path[i]; ++i)
+                                name += (i ? "/" : "") + std::string(e.path[i]);
+                            totals& to = paths[name.empty() ? "(no scope)" : name];
+                            to.runs += e.runs.load(std::memory_order_relaxed);
+                            to.allocations += e.allocations.load(std::memory_order_relaxed);
+                            to.bytes += e.bytes.load(std::memory_order_relaxed);
+                            all += e.allocations.load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+                std::vector<std::pair<std::string, totals>> rows(paths.begin(), paths.end());
+                std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, totals>& a,
+                            const std::pair<std::string, totals>& b) { return a.second.allocations > b.second.allocations; });
+
+                std::ostringstream out;
+                out << all << " allocations\n" << std::left << std::setw(40) << "scope" << std::right
+                    << std::setw(12) << "runs" << std::setw(12) << "allocs" << std::setw(7) << "%"
+                    << std::setw(14) << "bytes" << std::setw(12) << "allocs/run" << std::setw(12) << "bytes/run"
+                    << std::setw(12) << "bytes/alloc" << "\n" << std::fixed;
+                for (auto& row : rows)
+                {
+                    const totals& t = row.second;
+                    out << std::left << std::setw(40) << row.first << std::right << std::setprecision(1)
+                        << std::setw(12) << t.runs << std::setw(12) << t.allocations
+                        << std::setw(7) << (all ? 100.0 * t.allocations / all : 0) << std::setw(14) << t.bytes;
+                    if (t.runs)
+                        out << std::setw(12) << double(t.allocations) / t.runs << std::setprecision(0)
+                            << std::setw(12) << double(t.bytes) / t.runs;
+                    else
+                        out << std::setw(12) << "-" << std::setw(12) << "-";
+                    out << std::setprecision(0) << std::setw(12)
+                        << (t.allocations ? double(t.bytes) / t.allocations : 0) << "\n";
+                }
+                return out.str();
+            }
+
+        private:
+            struct entry
+            {
+                std::atomic<bool> used{false};
+                const char* path[max_depth] = {};
+                std::atomic<std::int64_t> runs{0};
+                std::atomic<std::int64_t> allocations{0};
+                std::atomic<std::int64_t> bytes{0};
+            };
+
+            // a thread's table outlives it, what it counted still shows up
+            struct table
+            {
+                entry entries[paths_per_thread];
+            };
+
+            struct state
+            {
+                const char* path[max_depth] = {};
+                int depth = 0;
+                bool busy = false; // attaching or reporting, allocations aren't counted
+                table* counts = nullptr;
+            };
+
+            struct busy_guard
+            {
+                explicit busy_guard(state& s)
+                    : s_(s),
+                    was_(s.busy)
+                {
+                    s_.busy = true;
+                }
+
+                ~busy_guard()
+                {
+                    s_.busy = was_;
+                }
+
+                state& s_;
+                bool was_;
+            };
+
+            static void bump(std::atomic<std::int64_t>& c, std::int64_t n)
+            {
+                c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+
+            state& mine()
+            {
+                static thread_local state s;
+                return s;
+            }
+
+            // the current path's entry, null when this thread's table is full
+            entry* find(state& s)
+            {
+                if (!s.counts)
+                {
+                    busy_guard quiet(s);
+                    std::unique_ptr<table> t(new table);
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    threads_.push_back(std::move(t));
+                    s.counts = threads_.back().get();
+                }
+                int depth = std::min<int>(s.depth, max_depth);
+                std::size_t h = 0;
+                for (int i = 0; i < depth; ++i)
+                    h = (h ^ reinterpret_cast<std::uintptr_t>(s.path[i])) * 1099511628211ull;
+                for (int probe = 0; probe < paths_per_thread; ++probe)
+                {
+                    entry& e = s.counts->entries[(h + probe) % paths_per_thread];
+                    if (!e.used.load(std::memory_order_relaxed))
+                    {
+                        std::copy(s.path, s.path + depth, e.path);
+                        e.used.store(true, std::memory_order_release);
+                        return &e;
+                    }
+                    if (std::equal(s.path, s.path + depth, e.path) && (depth == max_depth || !e.path[depth]))
+                        return &e;
+                }
+                return nullptr;
+            }
+
+            std::mutex mutex_;
+            std::vector<std::unique_ptr<table>> threads_;
+    };
+
+    // the rest of the scope is charged to tag, inside whatever scopes are already open
+    class scope
+    {
+        public:
+            explicit scope(const char* tag)
+                : on_(enabled())
+            {
+                if (on_)
+                    profiler::instance().push(tag);
+            }
+
+            ~scope()
+            {
+                if (on_)
+                    profiler::instance().pop();
+            }
+
+        private:
+            bool on_;
+    };
+
+    // from operator new, has to stay allocation free
+    inline void count(std::size_t bytes)
+    {
+        if (enabled())
+            profiler::instance().count(bytes);
+    }
+}
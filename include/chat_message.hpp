@@ -11,9 +11,11 @@
 #ifndef CHAT_MESSAGE_HPP
 #define CHAT_MESSAGE_HPP
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <vector>
 #include "Card.hpp"
 
@@ -22,9 +24,9 @@
 class game_state
 {
     public:
-        bool valid;
-        int dealer_credits;
-        int something[3];
+        bool valid = false;
+        int dealer_credits = 0;
+        int something[3] = {};
         // note you can't use std::string 
         // or pointers
 };
@@ -32,7 +34,7 @@ class game_state
 class client_action
 {
     public:
-        bool valid;
+        bool valid = false;
         bool hit = false;   
         bool stand = false;
         bool doubledown = false;
@@ -49,6 +51,22 @@ class client_action
         int client_credits = 0;
         int bet = 0;
         int turn = 0;
+        // the server hands a token out with every seat, a client that lost its connection
+        // sends it back as its first message to get the seat back
+        bool resume = false;
+        std::uint64_t token = 0;
+        // who is playing, sent with the first message, the server keeps their profile under it
+        char name[48] = {};
+        // the server hands it out with the seat when it registers a name, only a hello that
+        // sends it back with the name plays on that name's profile
+        std::uint64_t profile_key = 0;
+        // provably fair shoes: the commitment comes before a shoe's first card, seed and salt after its last
+        unsigned char commitment[32] = {};
+        bool revealed = false;
+        // a reject or notice for this one player, no later message repeats it
+        bool notice = false;
+        std::uint32_t shoe_seed = 0;
+        unsigned char shoe_salt[32] = {};
         char C[5];
         char g[9999]; //have to make it large enough 
         //to hold data for 6 clients
@@ -114,8 +132,9 @@ class chat_message
 
         bool decode_header()
         {
-            char header[header_length + 1] = "";
-            std::strncat(header, data_, 4); // Appends the first 4 characters of data_ to header
+            char header[4 + 1];
+            std::memcpy(header, data_, 4); // the first 4 characters of data_, terminated by hand
+            header[4] = '\0';
             body_length_ = std::atoi(header); // length of header
 
             char *p = data_ + 4; // skip the integer || p now has [client_action data, Card data]
@@ -150,6 +169,8 @@ class chat_message
         client_action ca;
         game_state gs;
         Card card;
+        // server side only, never sent: what times the action this message broadcasts
+        std::shared_ptr<void> timing;
 };
 
 #endif // CHAT_MESSAGE_HPP
@@ -0,0 +1,163 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// framed messages over a unix stream socket, each frame can carry one file descriptor
+// used to hand listening sockets and live connections to the next server process
+// frame: type (1 byte), payload length (4 bytes), payload, with the fd as SCM_RIGHTS
+
+namespace fd_passing
+{
+    // blocking, returns false on any error
+    inline bool send_frame(int sock, char type, const std::string& payload, int fd = -1)
+    {
+        char header[5];
+        std::uint32_t len = payload.size();
+        header[0] = type;
+        std::memcpy(header + 1, &len, 4);
+
+        iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = const_cast<char*>(payload.data());
+        iov[1].iov_len = payload.size();
+
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = payload.empty() ? 1 : 2;
+
+        char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0)
+        {
+            std::memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        std::size_t total = sizeof(header) + payload.size();
+        ssize_t n;
+        do
+        {
+            n = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0)
+            return false;
+
+        // the fd went with the first bytes, the rest is plain data
+        if ((std::size_t)n == total)
+            return true;
+        std::string rest = std::string(header, sizeof(header)) + payload;
+        for (std::size_t sent = n; sent < total; )
+        {
+            ssize_t m = ::send(sock, rest.data() + sent, total - sent, MSG_NOSIGNAL);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m <= 0)
+                return false;
+            sent += m;
+        }
+        return true;
+    }
+
+    inline bool read_all(int sock, char* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = ::read(sock, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // fd is -1 when the frame carried none
+    inline bool recv_frame(int sock, char& type, std::string& payload, int& fd)
+    {
+        char header[5];
+        iovec iov;
+        iov.iov_base = header;
+        iov.iov_len = sizeof(header);
+
+        char control[CMSG_SPACE(sizeof(int))];
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n;
+        do
+        {
+            n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            return false;
+
+        fd = -1;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+
+        if (!read_all(sock, header + n, sizeof(header) - n))
+            return false;
+        type = header[0];
+        std::uint32_t len;
+        std::memcpy(&len, header + 1, 4);
+        payload.resize(len);
+        return len == 0 || read_all(sock, &payload[0], len);
+    }
+
+    inline int listen_unix(const std::string& path)
+    {
+        int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0)
+            return -1;
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        ::unlink(path.c_str());
+        if (::bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+                || ::listen(sock, 1) < 0)
+        {
+            ::close(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    inline int connect_unix(const std::string& path)
+    {
+        int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0)
+            return -1;
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (::connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+        {
+            ::close(sock);
+            return -1;
+        }
+        return sock;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// one level of JSON, names to numbers, what the tools report for scripts and the perf gate
+class flat_json
+{
+    public:
+        void add(const std::string& name, double value)
+        {
+            std::ostringstream v;
+            v.precision(12);
+            if (std::isfinite(value))
+                v << value;
+            else
+                v << "null";
+            fields_.push_back("\"" + name + "\": " + v.str());
+        }
+
+        std::string str() const
+        {
+            return join("{\n  ", ",\n  ", "\n}\n");
+        }
+
+        // the same on one line, for a stream of snapshots
+        std::string line() const
+        {
+            return join("{", ", ", "}\n");
+        }
+
+        // every "name": number pair in text, anything else is skipped
+        static std::map<std::string, double> parse(const std::string& text)
+        {
+            std::map<std::string, double> out;
+            std::size_t at = 0;
+            while ((at = text.find('"', at)) != std::string::npos)
+            {
+                std::size_t end = text.find('"', at + 1);
+                if (end == std::string::npos)
+                    break;
+                std::string name = text.substr(at + 1, end - at - 1);
+                std::size_t colon = text.find_first_not_of(" \t\r\n", end + 1);
+                at = end + 1;
+                if (colon == std::string::npos || text[colon] != ':')
+                    continue;
+                const char* value = text.c_str() + colon + 1;
+                char* stop = nullptr;
+                double v = std::strtod(value, &stop);
+                if (stop != value)
+                    out[name] = v;
+            }
+            return out;
+        }
+
+    private:
+        std::string join(const char* open, const char* between, const char* close) const
+        {
+            std::string out = open;
+            for (std::size_t i = 0; i < fields_.size(); ++i)
+                out += (i ? between : "") + fields_[i];
+            return out + close;
+        }
+
+        std::vector<std::string> fields_;
+};
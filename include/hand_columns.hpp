@@ -0,0 +1,402 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hand_log.hpp"
+#include "hand_log_reader.hpp"
+#include "log_writer.hpp"
+#include "snapshot.hpp"
+#include "table_game.hpp"
+
+// hand histories as column files, one "<column>.col" per field, for scans over many rounds
+//
+// a row is one hand, so a split seat gives two rows. rows are cut into chunks of
+// chunk_rows; every column cuts at the same rows, so chunk i of every file holds the same
+// hands. each chunk keeps its min and max and picks the smallest of three encodings:
+//   bits   value - min, bit packed
+//   delta  differences to the previous value, minus the smallest difference, bit packed
+//   dict   sorted distinct values, each row bit packs its index into them
+// a query opens only the columns it reads and can skip a chunk by its min and max alone.
+
+namespace column_format
+{
+    enum { magic = 0x43434c42, version = 1, chunk_rows = 65536 };
+
+    enum class encoding : std::uint8_t
+    {
+        bits,
+        delta,
+        dict
+    };
+
+    inline int width(std::uint64_t max)
+    {
+        int w = 0;
+        while (w < 64 && (max >> w) != 0)
+            w++;
+        return w;
+    }
+
+    inline std::vector<std::uint64_t> pack(const std::vector<std::uint64_t>& values, int w)
+    {
+        std::vector<std::uint64_t> words((values.size() * w + 63) / 64);
+        std::size_t bit = 0;
+        for (std::uint64_t v : values)
+        {
+            if (w == 0)
+                break;
+            words[bit / 64] |= v << (bit % 64);
+            if (bit % 64 + w > 64)
+                words[bit / 64 + 1] |= v >> (64 - bit % 64);
+            bit += w;
+        }
+        return words;
+    }
+
+    inline std::uint64_t unpack(const std::uint64_t* words, std::size_t i, int w)
+    {
+        if (w == 0)
+            return 0;
+        std::size_t bit = i * w;
+        std::uint64_t v = words[bit / 64] >> (bit % 64);
+        if (bit % 64 + w > 64)
+            v |= words[bit / 64 + 1] << (64 - bit % 64);
+        return w == 64 ? v : v & ((std::uint64_t(1) << w) - 1);
+    }
+
+    // one chunk, encoded with whatever comes out smallest
+    inline void encode_chunk(const std::int64_t* values, std::size_t n, std::string& out)
+    {
+        std::int64_t lo = *std::min_element(values, values + n);
+        std::int64_t hi = *std::max_element(values, values + n);
+
+        std::vector<std::int64_t> dict(values, values + n);
+        std::sort(dict.begin(), dict.end());
+        dict.erase(std::unique(dict.begin(), dict.end()), dict.end());
+
+        std::int64_t step = std::numeric_limits<std::int64_t>::max(), top = 0;
+        for (std::size_t i = 1; i < n; ++i)
+        {
+            std::int64_t d = values[i] - values[i - 1];
+            step = std::min(step, d);
+            top = std::max(top, d);
+        }
+        if (n < 2)
+            step = top = 0;
+
+        std::size_t bits_size = n * width(hi - lo);
+        std::size_t delta_size = (n - 1) * width(top - step) + 64;
+        std::size_t dict_size = n * width(dict.size() - 1) + dict.size() * 64;
+
+        encoding e = encoding::bits;
+        if (delta_size < bits_size && delta_size <= dict_size)
+            e = encoding::delta;
+        else if (dict_size < bits_size)
+            e = encoding::dict;
+
+        std::vector<std::uint64_t> codes(n);
+        int w;
+        snapshot_writer wr(out);
+        wr.put<std::uint32_t>(n);
+        wr.put<std::uint8_t>(static_cast<std::uint8_t>(e));
+        wr.put<std::int64_t>(lo);
+        wr.put<std::int64_t>(hi);
+        if (e == encoding::bits)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                codes[i] = values[i] - lo;
+            w = width(hi - lo);
+        }
+        else if (e == encoding::delta)
+        {
+            wr.put<std::int64_t>(values[0]);
+            wr.put<std::int64_t>(step);
+            codes.resize(n - 1);
+            for (std::size_t i = 1; i < n; ++i)
+                codes[i - 1] = values[i] - values[i - 1] - step;
+            w = width(top - step);
+        }
+        else
+        {
+            wr.put<std::uint32_t>(dict.size());
+            for (std::int64_t v : dict)
+                wr.put<std::int64_t>(v);
+            for (std::size_t i = 0; i < n; ++i)
+                codes[i] = std::lower_bound(dict.begin(), dict.end(), values[i]) - dict.begin();
+            w = width(dict.size() - 1);
+        }
+        std::vector<std::uint64_t> words = pack(codes, w);
+        wr.put<std::uint8_t>(w);
+        wr.put<std::uint32_t>(words.size());
+        for (std::uint64_t word : words)
+            wr.put<std::uint64_t>(word);
+    }
+}
+
+// builds one column file in memory
+class column_writer
+{
+    public:
+        explicit column_writer(const std::string& name)
+            : name_(name)
+        {
+        }
+
+        void add(std::int64_t value)
+        {
+            pending_.push_back(value);
+            if (pending_.size() == column_format::chunk_rows)
+                flush();
+        }
+
+        const std::string& name() const
+        {
+            return name_;
+        }
+
+        std::string finish()
+        {
+            flush();
+            std::string out;
+            snapshot_writer w(out);
+            w.put<std::uint32_t>(column_format::magic);
+            w.put<std::uint32_t>(column_format::version);
+            w.put<std::uint64_t>(rows_);
+            w.put<std::uint32_t>(chunks_);
+            w.put_bytes(name_);
+            out += body_;
+            return out;
+        }
+
+    private:
+        void flush()
+        {
+            if (pending_.empty())
+                return;
+            column_format::encode_chunk(pending_.data(), pending_.size(), body_);
+            rows_ += pending_.size();
+            chunks_++;
+            pending_.clear();
+        }
+
+        std::string name_;
+        std::string body_;
+        std::vector<std::int64_t> pending_;
+        std::uint64_t rows_ = 0;
+        std::uint32_t chunks_ = 0;
+};
+
+// a mapped column file, chunk headers are read on open, values only when asked for
+class column_reader
+{
+    public:
+        explicit column_reader(const std::string& path)
+            : file_(new mapped_file(path))
+        {
+            snapshot_reader r(file_->data(), file_->size());
+            if (r.get<std::uint32_t>() != column_format::magic || r.get<std::uint32_t>() != column_format::version)
+                throw std::runtime_error(path + " is not a column file");
+            rows_ = r.get<std::uint64_t>();
+            std::uint32_t n = r.get<std::uint32_t>();
+            name_ = r.get_bytes();
+            for (std::uint32_t i = 0; i < n && r.ok(); ++i)
+            {
+                chunk c;
+                c.offset = file_->size() - r.left();
+                c.rows = r.get<std::uint32_t>();
+                c.how = static_cast<column_format::encoding>(r.get<std::uint8_t>());
+                c.min = r.get<std::int64_t>();
+                c.max = r.get<std::int64_t>();
+                if (c.how == column_format::encoding::delta)
+                    r.skip(16);
+                else if (c.how == column_format::encoding::dict)
+                    r.skip(r.get<std::uint32_t>() * 8);
+                r.skip(1);
+                r.skip(r.get<std::uint32_t>() * 8);
+                chunks_.push_back(c);
+            }
+            if (!r.ok())
+                throw std::runtime_error(path + " is cut short");
+        }
+
+        const std::string& name() const { return name_; }
+        std::uint64_t rows() const { return rows_; }
+        std::size_t chunks() const { return chunks_.size(); }
+        std::size_t bytes() const { return file_->size(); }
+        std::int64_t min(std::size_t i) const { return chunks_[i].min; }
+        std::int64_t max(std::size_t i) const { return chunks_[i].max; }
+        std::size_t rows(std::size_t i) const { return chunks_[i].rows; }
+        column_format::encoding how(std::size_t i) const { return chunks_[i].how; }
+
+        void read(std::size_t i, std::vector<std::int64_t>& out) const
+        {
+            const chunk& c = chunks_[i];
+            snapshot_reader r(file_->data() + c.offset, file_->size() - c.offset);
+            r.get<std::uint32_t>();
+            r.get<std::uint8_t>();
+            std::int64_t lo = r.get<std::int64_t>();
+            r.get<std::int64_t>();
+            out.resize(c.rows);
+            std::int64_t first = 0, step = 0;
+            std::vector<std::int64_t> dict;
+            if (c.how == column_format::encoding::delta)
+            {
+                first = r.get<std::int64_t>();
+                step = r.get<std::int64_t>();
+            }
+            else if (c.how == column_format::encoding::dict)
+            {
+                dict.resize(r.get<std::uint32_t>());
+                for (std::int64_t& v : dict)
+                    v = r.get<std::int64_t>();
+            }
+            int w = r.get<std::uint8_t>();
+            std::uint32_t stored = r.get<std::uint32_t>();
+            // one spare word for unpack to read past
+            std::vector<std::uint64_t> words(stored + 1);
+            for (std::uint32_t k = 0; k < stored; ++k)
+                words[k] = r.get<std::uint64_t>();
+
+            if (c.how == column_format::encoding::bits)
+            {
+                for (std::size_t k = 0; k < c.rows; ++k)
+                    out[k] = lo + column_format::unpack(words.data(), k, w);
+            }
+            else if (c.how == column_format::encoding::delta)
+            {
+                out[0] = first;
+                for (std::size_t k = 1; k < c.rows; ++k)
+                    out[k] = out[k - 1] + step + column_format::unpack(words.data(), k - 1, w);
+            }
+            else
+            {
+                for (std::size_t k = 0; k < c.rows; ++k)
+                    out[k] = dict[column_format::unpack(words.data(), k, w)];
+            }
+        }
+
+    private:
+        struct chunk
+        {
+            std::size_t offset;
+            std::uint32_t rows;
+            column_format::encoding how;
+            std::int64_t min, max;
+        };
+
+        std::unique_ptr<mapped_file> file_;
+        std::string name_;
+        std::uint64_t rows_ = 0;
+        std::vector<chunk> chunks_;
+};
+
+// the columns a hand turns into
+namespace hand_columns
+{
+    enum field
+    {
+        time,    // round start, unix microseconds
+        table,
+        player,
+        seat,
+        upcard,  // dealer's face up card, 2 to 11
+        total,   // player's final total
+        dealer,  // dealer's final total
+        action,  // first thing the seat did after its cards came, hand_action_kind + 1, 0 for nothing
+        bet,
+        outcome, // net win or loss of the hand
+        count
+    };
+
+    typedef std::int64_t row[count];
+
+    static const char* const names[count] = {
+        "time", "table", "player", "seat", "upcard", "total", "dealer", "action", "bet", "outcome"
+    };
+
+    inline int column(const std::string& name)
+    {
+        for (int i = 0; i < count; ++i)
+            if (name == names[i])
+                return i;
+        return -1;
+    }
+
+    inline int rank_value(char rank)
+    {
+        if (rank == 'A')
+            return 11;
+        if (rank >= '2' && rank <= '9')
+            return rank - '0';
+        return 10;
+    }
+
+    template <typename F>
+    void rows(const hand_record& rec, F f)
+    {
+        if (rec.dealer.empty())
+            return;
+        for (const hand_seat& s : rec.seats)
+        {
+            row r;
+            r[time] = rec.started_us;
+            r[table] = rec.table;
+            r[player] = s.player;
+            r[seat] = s.seat;
+            r[upcard] = rank_value(rec.dealer[0].rank_);
+            r[dealer] = handTotal(rec.dealer);
+            r[bet] = s.bet;
+            r[action] = 0;
+            bool dealt = false;
+            for (const hand_action& a : rec.actions)
+            {
+                if (a.seat != s.seat)
+                    continue;
+                if (dealt)
+                {
+                    r[action] = static_cast<int>(a.kind) + 1;
+                    break;
+                }
+                dealt = a.kind == hand_action_kind::play;
+            }
+            for (const std::vector<Card>& h : s.hands)
+            {
+                r[total] = handTotal(h);
+                r[outcome] = payout(h, rec.dealer, s.bet, s.hands.size() == 1);
+                f(r);
+            }
+        }
+    }
+
+    // every record in the hand log into dir/<column>.col, returns the rows written
+    inline std::uint64_t export_log(hand_log_reader& log, const hand_query& q, const std::string& dir)
+    {
+        std::vector<column_writer> columns;
+        for (int i = 0; i < count; ++i)
+            columns.emplace_back(names[i]);
+        std::uint64_t n = 0;
+        log.each(q, [&](const hand_view& v)
+                {
+                hand_record rec;
+                if (!v.decode(rec))
+                    return true;
+                rows(rec, [&](const row& r)
+                        {
+                        for (int i = 0; i < count; ++i)
+                            columns[i].add(r[i]);
+                        n++;
+                        });
+                return true;
+                });
+        ::mkdir(dir.c_str(), 0755);
+        for (auto& c : columns)
+            if (!log_format::write_file(dir + "/" + c.name() + ".col", c.finish()))
+                throw std::runtime_error("can't write " + dir + "/" + c.name() + ".col");
+        return n;
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Card.hpp"
+#include "snapshot.hpp"
+
+// one round at one table, as written to the hand-history log
+// the shoe seed plus how far into the shoe the round started is enough to deal it again
+
+enum class hand_action_kind : std::uint8_t
+{
+    play,
+    hit,
+    stand,
+    split,
+    leave,
+    dealer  // everyone is done and the dealer draws
+};
+
+struct hand_action
+{
+    std::uint8_t seat = 0;
+    hand_action_kind kind = hand_action_kind::play;
+    std::uint32_t at_ms = 0; // since the round started
+};
+
+struct hand_seat
+{
+    std::uint32_t player = 0; // server wide player number
+    std::uint8_t seat = 0;
+    std::int32_t bet = 0;
+    std::int32_t payout = 0; // net, negative when the player lost
+    std::vector<std::vector<Card>> hands;
+};
+
+struct hand_record
+{
+    std::uint32_t round = 0; // counts up per table
+    std::int32_t table = 0;
+    std::int32_t stake = 0;
+    std::int64_t started_us = 0; // unix time
+    std::int64_t finished_us = 0;
+    std::uint32_t seed = 0;
+    std::uint16_t shoe_offset = 0; // cards dealt from the shoe before this round
+    std::vector<Card> dealer;
+    std::vector<hand_seat> seats;
+    std::vector<hand_action> actions;
+
+    static std::int64_t now_us()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::string encode() const
+    {
+        std::string out;
+        snapshot_writer w(out);
+        w.put<std::uint32_t>(round);
+        w.put<std::int32_t>(table);
+        w.put<std::int32_t>(stake);
+        w.put<std::int64_t>(started_us);
+        w.put<std::int64_t>(finished_us);
+        w.put<std::uint32_t>(seed);
+        w.put<std::uint16_t>(shoe_offset);
+        w.put<std::uint8_t>(dealer.size());
+        for (const Card& c : dealer)
+            w.put_card(c);
+        w.put<std::uint8_t>(seats.size());
+        for (const hand_seat& s : seats)
+        {
+            w.put<std::uint32_t>(s.player);
+            w.put<std::uint8_t>(s.seat);
+            w.put<std::int32_t>(s.bet);
+            w.put<std::int32_t>(s.payout);
+            w.put<std::uint8_t>(s.hands.size());
+            for (const std::vector<Card>& h : s.hands)
+            {
+                w.put<std::uint8_t>(h.size());
+                for (const Card& c : h)
+                    w.put_card(c);
+            }
+        }
+        w.put<std::uint16_t>(actions.size());
+        for (const hand_action& a : actions)
+        {
+            w.put<std::uint8_t>(a.seat);
+            w.put<std::uint8_t>(static_cast<std::uint8_t>(a.kind));
+            w.put<std::uint32_t>(a.at_ms);
+        }
+        return out;
+    }
+
+    bool decode(const char* data, std::size_t size)
+    {
+        snapshot_reader r(data, size);
+        round = r.get<std::uint32_t>();
+        table = r.get<std::int32_t>();
+        stake = r.get<std::int32_t>();
+        started_us = r.get<std::int64_t>();
+        finished_us = r.get<std::int64_t>();
+        seed = r.get<std::uint32_t>();
+        shoe_offset = r.get<std::uint16_t>();
+        dealer.resize(r.get<std::uint8_t>());
+        for (Card& c : dealer)
+            c = r.get_card();
+        seats.resize(r.get<std::uint8_t>());
+        for (hand_seat& s : seats)
+        {
+            s.player = r.get<std::uint32_t>();
+            s.seat = r.get<std::uint8_t>();
+            s.bet = r.get<std::int32_t>();
+            s.payout = r.get<std::int32_t>();
+            s.hands.resize(r.get<std::uint8_t>());
+            for (std::vector<Card>& h : s.hands)
+            {
+                h.resize(r.get<std::uint8_t>());
+                for (Card& c : h)
+                    c = r.get_card();
+            }
+        }
+        actions.resize(r.get<std::uint16_t>());
+        for (hand_action& a : actions)
+        {
+            a.seat = r.get<std::uint8_t>();
+            a.kind = static_cast<hand_action_kind>(r.get<std::uint8_t>());
+            a.at_ms = r.get<std::uint32_t>();
+        }
+        return r.ok() && r.done();
+    }
+};
@@ -0,0 +1,453 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_writer.hpp"
+#include "hand_log.hpp"
+
+// read side of the hand-history log
+// segments are memory mapped, records come back as views into the mapping
+//
+// every segment gets a sparse side index "<segment>.idx": the records are cut into blocks,
+// each block keeps its offset and time range, and every table and player points at the
+// blocks they show up in. a query only touches the blocks that can match.
+// the index is rebuilt whenever the segment grew since it was written.
+
+class mapped_file
+{
+    public:
+        explicit mapped_file(const std::string& path)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                throw std::runtime_error("can't open " + path);
+            struct stat st;
+            ::fstat(fd, &st);
+            size_ = st.st_size;
+            if (size_ > 0)
+            {
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                {
+                    ::close(fd);
+                    throw std::runtime_error("can't map " + path);
+                }
+                data_ = static_cast<const char*>(p);
+                ::madvise(p, size_, MADV_RANDOM);
+            }
+            ::close(fd);
+        }
+
+        ~mapped_file()
+        {
+            if (data_)
+                ::munmap(const_cast<char*>(data_), size_);
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        const char* data() const
+        {
+            return data_;
+        }
+
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        const char* data_ = nullptr;
+        std::size_t size_ = 0;
+};
+
+// one record, pointing into the mapped segment, decoded only as far as asked
+class hand_view
+{
+    public:
+        hand_view(const char* data, std::uint32_t size, std::uint64_t seq)
+            : data_(data),
+            size_(size),
+            seq_(seq)
+        {
+        }
+
+        std::uint64_t seq() const { return seq_; }
+        const char* data() const { return data_; }
+        std::uint32_t size() const { return size_; }
+
+        std::uint32_t round() const { return field<std::uint32_t>(0); }
+        std::int32_t table() const { return field<std::int32_t>(4); }
+        std::int32_t stake() const { return field<std::int32_t>(8); }
+        std::int64_t started_us() const { return field<std::int64_t>(12); }
+        std::int64_t finished_us() const { return field<std::int64_t>(20); }
+
+        // player numbers of everyone who had a hand
+        std::vector<std::uint32_t> players() const
+        {
+            std::vector<std::uint32_t> result;
+            if (size_ < seats_offset)
+                return result;
+            snapshot_reader r(data_ + seats_offset, size_ - seats_offset);
+            std::uint8_t dealer = r.get<std::uint8_t>();
+            for (int i = 0; i < dealer; ++i)
+                r.get_card();
+            std::uint8_t seats = r.get<std::uint8_t>();
+            for (int i = 0; i < seats && r.ok(); ++i)
+            {
+                result.push_back(r.get<std::uint32_t>());
+                r.get<std::uint8_t>();  // seat
+                r.get<std::int32_t>();  // bet
+                r.get<std::int32_t>();  // payout
+                std::uint8_t hands = r.get<std::uint8_t>();
+                for (int h = 0; h < hands; ++h)
+                {
+                    std::uint8_t cards = r.get<std::uint8_t>();
+                    for (int c = 0; c < cards; ++c)
+                        r.get_card();
+                }
+            }
+            return result;
+        }
+
+        bool has_player(std::uint32_t player) const
+        {
+            std::vector<std::uint32_t> p = players();
+            return std::find(p.begin(), p.end(), player) != p.end();
+        }
+
+        bool decode(hand_record& out) const
+        {
+            return out.decode(data_, size_);
+        }
+
+    private:
+        enum { seats_offset = 34 }; // round .. shoe_offset
+
+        // little endian like everything snapshot_writer puts out
+        template <typename T>
+        T field(std::size_t offset) const
+        {
+            if (offset + sizeof(T) > size_)
+                return T();
+            return snapshot_reader(data_ + offset, sizeof(T)).get<T>();
+        }
+
+        const char* data_;
+        std::uint32_t size_;
+        std::uint64_t seq_;
+};
+
+struct hand_query
+{
+    std::int32_t table = -1;      // any table
+    std::uint32_t player = 0;     // any player
+    std::int64_t from_us = 0;     // on finished_us, inclusive
+    std::int64_t to_us = std::numeric_limits<std::int64_t>::max();
+    std::size_t limit = 0;        // 0 is no limit
+};
+
+class hand_log_reader
+{
+    public:
+        enum { block_records = 64 };
+
+        explicit hand_log_reader(const std::string& dir, const std::string& prefix = "hands")
+        {
+            for (auto& s : log_format::list(dir, prefix))
+            {
+                std::unique_ptr<segment> seg(new segment(s.path));
+                seg->index = load_index(s.path + ".idx", seg->file.size());
+                if (!seg->index.complete)
+                {
+                    seg->index = build_index(seg->file);
+                    save_index(s.path + ".idx", seg->index);
+                }
+                segments_.push_back(std::move(seg));
+            }
+        }
+
+        // calls f with each match in log order, f returns false to stop
+        // returns the number of matches
+        std::size_t each(const hand_query& q, const std::function<bool(const hand_view&)>& f) const
+        {
+            std::size_t found = 0;
+            for (auto& seg : segments_)
+            {
+                const segment_index& ix = seg->index;
+                for (std::uint32_t b : candidates(ix, q))
+                {
+                    const block& blk = ix.blocks[b];
+                    if (blk.max_us < q.from_us || blk.min_us > q.to_us)
+                        continue;
+                    std::size_t end = b + 1 < ix.blocks.size() ? ix.blocks[b + 1].offset : ix.end;
+                    log_format::cursor c(seg->file.data(), end);
+                    c.seek(blk.offset, blk.first_seq);
+                    const char* payload;
+                    std::uint32_t length;
+                    std::uint64_t seq;
+                    while (c.next(payload, length, seq))
+                    {
+                        hand_view v(payload, length, seq);
+                        if (v.finished_us() < q.from_us || v.finished_us() > q.to_us)
+                            continue;
+                        if (q.table != -1 && v.table() != q.table)
+                            continue;
+                        if (q.player != 0 && !v.has_player(q.player))
+                            continue;
+                        ++found;
+                        if (!f(v) || (q.limit && found >= q.limit))
+                            return found;
+                    }
+                }
+            }
+            return found;
+        }
+
+        std::size_t segments() const
+        {
+            return segments_.size();
+        }
+
+        std::uint64_t records() const
+        {
+            std::uint64_t n = 0;
+            for (auto& seg : segments_)
+                n += seg->index.records;
+            return n;
+        }
+
+        std::uint64_t bytes() const
+        {
+            std::uint64_t n = 0;
+            for (auto& seg : segments_)
+                n += seg->file.size();
+            return n;
+        }
+
+    private:
+        struct block
+        {
+            std::uint64_t offset;
+            std::uint64_t first_seq;
+            std::int64_t min_us;
+            std::int64_t max_us;
+        };
+
+        struct segment_index
+        {
+            bool complete = false;
+            std::uint64_t size = 0; // of the segment when it was indexed
+            std::uint64_t end = 0;  // just past the last good record
+            std::uint64_t records = 0;
+            std::vector<block> blocks;
+            std::map<std::int32_t, std::vector<std::uint32_t>> tables;   // to block numbers
+            std::map<std::uint32_t, std::vector<std::uint32_t>> players;
+        };
+
+        struct segment
+        {
+            explicit segment(const std::string& path)
+                : file(path)
+            {
+            }
+
+            mapped_file file;
+            segment_index index;
+        };
+
+        enum { index_magic = 0x58494c42, index_version = 1 };
+
+        static std::vector<std::uint32_t> candidates(const segment_index& ix, const hand_query& q)
+        {
+            const std::vector<std::uint32_t>* by_table = nullptr;
+            const std::vector<std::uint32_t>* by_player = nullptr;
+            static const std::vector<std::uint32_t> none;
+            if (q.table != -1)
+            {
+                auto it = ix.tables.find(q.table);
+                by_table = it == ix.tables.end() ? &none : &it->second;
+            }
+            if (q.player != 0)
+            {
+                auto it = ix.players.find(q.player);
+                by_player = it == ix.players.end() ? &none : &it->second;
+            }
+            std::vector<std::uint32_t> result;
+            if (by_table && by_player)
+                std::set_intersection(by_table->begin(), by_table->end(),
+                        by_player->begin(), by_player->end(), std::back_inserter(result));
+            else if (by_table || by_player)
+                result = by_table ? *by_table : *by_player;
+            else
+            {
+                // time only, every block and the time ranges do the skipping
+                for (std::uint32_t b = 0; b < ix.blocks.size(); ++b)
+                    result.push_back(b);
+            }
+            return result;
+        }
+
+        static segment_index build_index(const mapped_file& file)
+        {
+            segment_index ix;
+            log_format::cursor c(file.data(), file.size());
+            if (!c.valid())
+                return ix;
+            const char* payload;
+            std::uint32_t length;
+            std::uint64_t seq;
+            std::size_t at = c.end();
+            while (c.next(payload, length, seq))
+            {
+                hand_view v(payload, length, seq);
+                if (ix.records % block_records == 0)
+                {
+                    block b;
+                    b.offset = at;
+                    b.first_seq = seq;
+                    b.min_us = b.max_us = v.finished_us();
+                    ix.blocks.push_back(b);
+                }
+                block& b = ix.blocks.back();
+                b.min_us = std::min(b.min_us, v.finished_us());
+                b.max_us = std::max(b.max_us, v.finished_us());
+                std::uint32_t n = ix.blocks.size() - 1;
+                add(ix.tables[v.table()], n);
+                for (std::uint32_t p : v.players())
+                    add(ix.players[p], n);
+                ++ix.records;
+                at = c.end();
+            }
+            ix.size = file.size();
+            ix.end = at;
+            ix.complete = true;
+            return ix;
+        }
+
+        static void add(std::vector<std::uint32_t>& postings, std::uint32_t block)
+        {
+            if (postings.empty() || postings.back() != block)
+                postings.push_back(block);
+        }
+
+        static void put_postings(snapshot_writer& w, const std::vector<std::uint32_t>& postings)
+        {
+            w.put<std::uint32_t>(postings.size());
+            for (std::uint32_t b : postings)
+                w.put<std::uint32_t>(b);
+        }
+
+        static std::vector<std::uint32_t> get_postings(snapshot_reader& r)
+        {
+            std::vector<std::uint32_t> postings(std::min<std::uint32_t>(r.get<std::uint32_t>(), 1 << 24));
+            for (std::uint32_t& b : postings)
+                b = r.get<std::uint32_t>();
+            return postings;
+        }
+
+        // the index covers the segment as it was; any growth (the live segment) means a rebuild
+        static segment_index load_index(const std::string& path, std::size_t segment_size)
+        {
+            segment_index ix;
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return ix;
+            struct stat st;
+            ::fstat(fd, &st);
+            std::string data(st.st_size, '\0');
+            bool read = st.st_size > 0 && ::pread(fd, &data[0], st.st_size, 0) == st.st_size;
+            ::close(fd);
+            if (!read)
+                return ix;
+
+            snapshot_reader r(data);
+            if (r.get<std::uint32_t>() != index_magic || r.get<std::uint32_t>() != index_version)
+                return ix;
+            ix.size = r.get<std::uint64_t>();
+            if (ix.size != segment_size)
+                return ix;
+            ix.end = r.get<std::uint64_t>();
+            ix.records = r.get<std::uint64_t>();
+            ix.blocks.resize(std::min<std::uint32_t>(r.get<std::uint32_t>(), 1 << 24));
+            for (block& b : ix.blocks)
+            {
+                b.offset = r.get<std::uint64_t>();
+                b.first_seq = r.get<std::uint64_t>();
+                b.min_us = r.get<std::int64_t>();
+                b.max_us = r.get<std::int64_t>();
+            }
+            std::uint32_t tables = r.get<std::uint32_t>();
+            for (std::uint32_t i = 0; i < tables && r.ok(); ++i)
+            {
+                std::int32_t t = r.get<std::int32_t>();
+                ix.tables[t] = get_postings(r);
+            }
+            std::uint32_t players = r.get<std::uint32_t>();
+            for (std::uint32_t i = 0; i < players && r.ok(); ++i)
+            {
+                std::uint32_t p = r.get<std::uint32_t>();
+                ix.players[p] = get_postings(r);
+            }
+            ix.complete = r.ok() && r.done();
+            return ix;
+        }
+
+        // best effort, a reader without write access just rebuilds every time
+        static void save_index(const std::string& path, const segment_index& ix)
+        {
+            std::string out;
+            snapshot_writer w(out);
+            w.put<std::uint32_t>(index_magic);
+            w.put<std::uint32_t>(index_version);
+            w.put<std::uint64_t>(ix.size);
+            w.put<std::uint64_t>(ix.end);
+            w.put<std::uint64_t>(ix.records);
+            w.put<std::uint32_t>(ix.blocks.size());
+            for (const block& b : ix.blocks)
+            {
+                w.put<std::uint64_t>(b.offset);
+                w.put<std::uint64_t>(b.first_seq);
+                w.put<std::int64_t>(b.min_us);
+                w.put<std::int64_t>(b.max_us);
+            }
+            w.put<std::uint32_t>(ix.tables.size());
+            for (auto& t : ix.tables)
+            {
+                w.put<std::int32_t>(t.first);
+                put_postings(w, t.second);
+            }
+            w.put<std::uint32_t>(ix.players.size());
+            for (auto& p : ix.players)
+            {
+                w.put<std::uint32_t>(p.first);
+                put_postings(w, p.second);
+            }
+
+            std::string tmp = path + ".tmp";
+            int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+                return;
+            bool ok = ::write(fd, out.data(), out.size()) == (ssize_t)out.size();
+            ::close(fd);
+            if (ok)
+                ::rename(tmp.c_str(), path.c_str());
+            else
+                ::unlink(tmp.c_str());
+        }
+
+        std::vector<std::unique_ptr<segment>> segments_;
+};
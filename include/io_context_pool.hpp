@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "asio.hpp"
+
+// one io_context per thread
+// a session stays on the context that accepted it for its whole life
+class io_context_pool
+{
+    public:
+        explicit io_context_pool(std::size_t size)
+        {
+            if (size == 0)
+                size = 1;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                // only one thread runs each context, the hint lets asio queue what that thread posts
+                // to itself privately. it still locks, other threads post here too
+                contexts_.emplace_back(new asio::io_context(1));
+                work_.emplace_back(asio::make_work_guard(*contexts_.back()));
+            }
+        }
+
+        void run()
+        {
+            for (auto& context : contexts_)
+            {
+                asio::io_context* ctx = context.get();
+                threads_.emplace_back([ctx](){ ctx->run(); });
+            }
+        }
+
+        void stop()
+        {
+            for (auto& context : contexts_)
+                context->stop();
+        }
+
+        void join()
+        {
+            for (auto& t : threads_)
+                t.join();
+            threads_.clear();
+        }
+
+        std::size_t size() const
+        {
+            return contexts_.size();
+        }
+
+        asio::io_context& get(std::size_t i)
+        {
+            return *contexts_[i % contexts_.size()];
+        }
+
+        std::size_t index_of(const asio::io_context& context) const
+        {
+            for (std::size_t i = 0; i < contexts_.size(); ++i)
+                if (contexts_[i].get() == &context)
+                    return i;
+            return 0;
+        }
+
+        // round robin, for when a single acceptor hands out sessions
+        asio::io_context& next()
+        {
+            return get(next_++);
+        }
+
+    private:
+        typedef asio::executor_work_guard<asio::io_context::executor_type> work_guard;
+
+        std::vector<std::unique_ptr<asio::io_context>> contexts_;
+        std::vector<work_guard> work_;
+        std::vector<std::thread> threads_;
+        std::atomic<std::size_t> next_{0};
+};
@@ -0,0 +1,229 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// action latency histograms, cheap enough to leave on
+//
+// the buckets are log-linear like HdrHistogram: one per nanosecond below 128 ns, then 64 for
+// every power of two, so a value is never more than 1.6% off its bucket, up to about 36 minutes.
+// every thread counts into buckets of its own with plain relaxed stores, only it writes them.
+// a scrape adds all the threads up, it may miss a count that is being written, never more.
+
+namespace latency
+{
+    enum class action : int { play, hit, split, stand, dealer, count };
+
+    inline const char* name(action a)
+    {
+        static const char* names[] = { "play", "hit", "split", "stand", "dealer" };
+        return names[static_cast<int>(a)];
+    }
+
+    inline std::int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // a merged histogram, what a scrape hands out
+    class histogram
+    {
+        public:
+            enum { sub_bits = 6, max_shift = 34, buckets = (max_shift + 2) << sub_bits };
+
+            static int index(std::uint64_t ns)
+            {
+                if (ns < (2u << sub_bits))
+                    return static_cast<int>(ns);
+                ns = std::min<std::uint64_t>(ns, (std::uint64_t(2) << (max_shift + sub_bits)) - 1);
+                int shift = 63 - __builtin_clzll(ns) - sub_bits;
+                return (shift << sub_bits) + static_cast<int>(ns >> shift);
+            }
+
+            // the smallest value that lands in bucket i
+            static std::uint64_t lowest(int i)
+            {
+                if (i < (2 << sub_bits))
+                    return i;
+                int shift = (i >> sub_bits) - 1;
+                return std::uint64_t((i & ((1 << sub_bits) - 1)) + (1 << sub_bits)) << shift;
+            }
+
+            // the largest value that lands in bucket i
+            static std::uint64_t highest(int i)
+            {
+                return i + 1 < buckets ? lowest(i + 1) - 1 : lowest(i);
+            }
+
+            histogram()
+                : counts_(buckets)
+            {
+            }
+
+            void add(int bucket, std::uint64_t n)
+            {
+                counts_[bucket] += n;
+                count_ += n;
+            }
+
+            void add_sum(std::uint64_t sum, std::uint64_t max)
+            {
+                sum_ += sum;
+                max_ = std::max(max_, max);
+            }
+
+            std::uint64_t count() const
+            {
+                return count_;
+            }
+
+            std::uint64_t max() const
+            {
+                return max_;
+            }
+
+            std::uint64_t sum() const
+            {
+                return sum_;
+            }
+
+            double mean() const
+            {
+                return count_ ? double(sum_) / count_ : 0;
+            }
+
+            std::uint64_t bucket(int i) const
+            {
+                return counts_[i];
+            }
+
+            // the value q of the counts are at or below, reported as its bucket's top like hdr does
+            std::uint64_t percentile(double q) const
+            {
+                if (count_ == 0)
+                    return 0;
+                std::uint64_t want = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(q * count_ + 0.5));
+                std::uint64_t seen = 0;
+                for (int i = 0; i < buckets; ++i)
+                {
+                    seen += counts_[i];
+                    if (seen >= want)
+                        return std::min(highest(i), max_);
+                }
+                return max_;
+            }
+
+        private:
+            std::vector<std::uint64_t> counts_;
+            std::uint64_t count_ = 0;
+            std::uint64_t sum_ = 0;
+            std::uint64_t max_ = 0;
+    };
+
+    class recorder
+    {
+        public:
+            static recorder& instance()
+            {
+                static recorder r;
+                return r;
+            }
+
+            void record(action a, std::int64_t ns)
+            {
+                thread_local buckets* mine = attach();
+                if (ns < 0)
+                    ns = 0;
+                int k = static_cast<int>(a);
+                bump(mine->counts[k][histogram::index(ns)], 1);
+                bump(mine->sum[k], ns);
+                if (std::uint64_t(ns) > mine->max[k].load(std::memory_order_relaxed))
+                    mine->max[k].store(ns, std::memory_order_relaxed);
+            }
+
+            // every thread's buckets added up, one histogram per action
+            std::vector<histogram> scrape() const
+            {
+                std::vector<histogram> out(static_cast<int>(action::count));
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& t : threads_)
+                {
+                    for (int k = 0; k < static_cast<int>(action::count); ++k)
+                    {
+                        for (int i = 0; i < histogram::buckets; ++i)
+                        {
+                            std::uint64_t n = t->counts[k][i].load(std::memory_order_relaxed);
+                            if (n)
+                                out[k].add(i, n);
+                        }
+                        out[k].add_sum(t->sum[k].load(std::memory_order_relaxed),
+                                t->max[k].load(std::memory_order_relaxed));
+                    }
+                }
+                return out;
+            }
+
+        private:
+            struct buckets
+            {
+                std::atomic<std::uint64_t> counts[static_cast<int>(action::count)][histogram::buckets];
+                std::atomic<std::uint64_t> sum[static_cast<int>(action::count)];
+                std::atomic<std::uint64_t> max[static_cast<int>(action::count)];
+
+                buckets()
+                {
+                    for (int k = 0; k < static_cast<int>(action::count); ++k)
+                    {
+                        for (auto& c : counts[k])
+                            c.store(0, std::memory_order_relaxed);
+                        sum[k].store(0, std::memory_order_relaxed);
+                        max[k].store(0, std::memory_order_relaxed);
+                    }
+                }
+            };
+
+            // only the owning thread writes, so no read-modify-write is needed
+            static void bump(std::atomic<std::uint64_t>& c, std::uint64_t n)
+            {
+                c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+
+            // a thread's buckets outlive it, what it counted still shows up
+            buckets* attach()
+            {
+                std::unique_ptr<buckets> b(new buckets);
+                std::lock_guard<std::mutex> lock(mutex_);
+                threads_.push_back(std::move(b));
+                return threads_.back().get();
+            }
+
+            mutable std::mutex mutex_;
+            std::vector<std::unique_ptr<buckets>> threads_;
+    };
+
+    // travels with a broadcast, the action is timed when the last copy goes away,
+    // which is once the last recipient's write has finished or the message was dropped
+    class stamp
+    {
+        public:
+            stamp(action a, std::int64_t read_ns)
+                : action_(a),
+                read_ns_(read_ns)
+            {
+            }
+
+            ~stamp()
+            {
+                recorder::instance().record(action_, now_ns() - read_ns_);
+            }
+
+        private:
+            action action_;
+            std::int64_t read_ns_;
+    };
+}
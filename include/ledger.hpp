@@ -0,0 +1,372 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include "log_writer.hpp"
+#include "logger.hpp"
+#include "snapshot.hpp"
+
+// every player's credits, kept in memory and made durable through a write-ahead log
+//
+// a transaction is applied to the balances and appended to the WAL under one lock, so the
+// log order is the apply order. the log_writer batches appends from all tables into group
+// commits. every snapshot_every records a background thread writes the balances out as
+// "ledger-<seq>.snap" and drops WAL segments the snapshot covers, so a restart reads one
+// snapshot and at most about snapshot_every records.
+//
+// a bet stays open until its round pays out, a losing seat's payout is 0. a payout has to
+// close an open bet of the same player and round and may not take a balance below zero.
+
+enum class ledger_kind : std::uint8_t
+{
+    deposit,  // opening balance
+    bet,      // stake taken when a hand is dealt
+    payout    // stake back plus winnings when the round is settled
+};
+
+struct ledger_tx
+{
+    ledger_kind kind = ledger_kind::bet;
+    std::uint32_t player = 0;
+    std::int64_t amount = 0; // signed change to the balance
+    std::uint64_t ref = 0;   // table << 32 | round, for bets and payouts
+};
+
+class ledger
+{
+    public:
+        explicit ledger(const std::string& dir, std::uint64_t snapshot_every = 50000)
+            : dir_(dir),
+            snapshot_every_(snapshot_every),
+            wal_(dir, "ledger")
+        {
+            recover();
+            thread_ = std::thread([this]() { run(); });
+        }
+
+        ~ledger()
+        {
+            {
+                std::lock_guard<std::mutex> lock(snap_mutex_);
+                stop_ = true;
+            }
+            snap_cv_.notify_one();
+            thread_.join();
+        }
+
+        bool has(std::uint32_t player)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return balances_.count(player) != 0;
+        }
+
+        std::int64_t balance(std::uint32_t player)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = balances_.find(player);
+            return it == balances_.end() ? 0 : it->second;
+        }
+
+        // opens the account with opening credits the first time, then takes the bet if the balance
+        // covers it. false and nothing taken when it doesn't, balance is what is left either way
+        bool bet(std::uint32_t player, std::int64_t amount, std::int64_t opening, std::uint64_t ref,
+                std::int64_t& balance)
+        {
+            std::vector<ledger_tx> txs;
+            std::lock_guard<std::mutex> lock(mutex_);
+            bool open = balances_.count(player) != 0;
+            if (!open)
+                txs.push_back(make(ledger_kind::deposit, player, opening, ref));
+            bool covered = amount > 0 && amount <= (open ? balances_[player] : opening);
+            if (covered)
+                txs.push_back(make(ledger_kind::bet, player, -amount, ref));
+            if (!txs.empty())
+                commit(txs);
+            balance = balances_[player];
+            return covered;
+        }
+
+        // all payouts of one round go in as one record, a round is settled completely or not at all
+        // a payout without an open bet behind it, or one that would leave a balance below zero,
+        // is refused and left out, the number refused comes back
+        std::size_t apply(const std::vector<ledger_tx>& txs)
+        {
+            std::vector<ledger_tx> valid;
+            valid.reserve(txs.size());
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const ledger_tx& tx : txs)
+            {
+                if (tx.kind == ledger_kind::payout
+                        && (stakes_.count(std::make_pair(tx.player, tx.ref)) == 0 || balances_[tx.player] + tx.amount < 0))
+                {
+                    LOG_ERROR("Ledger: payout of {} to player {} for round {}/{} refused, {}", tx.amount, tx.player,
+                            tx.ref >> 32, tx.ref & 0xffffffff,
+                            stakes_.count(std::make_pair(tx.player, tx.ref)) ? "the balance would go negative" : "no bet on it");
+                    continue;
+                }
+                valid.push_back(tx);
+            }
+            if (!valid.empty())
+                commit(valid);
+            return txs.size() - valid.size();
+        }
+
+        // highest player number the ledger has seen, new numbers must start above it
+        std::uint32_t max_player()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return max_player_;
+        }
+
+        std::uint64_t transactions() const
+        {
+            return transactions_.load(std::memory_order_relaxed);
+        }
+
+        // blocks until everything applied so far is on disk, false if the disk is failing
+        bool sync()
+        {
+            std::uint64_t last;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                last = next_seq_;
+            }
+            return last == 0 || wal_.wait(last - 1);
+        }
+
+        log_writer& wal()
+        {
+            return wal_;
+        }
+
+    private:
+        enum { snap_magic = 0x50534c42, snap_version = 2 };
+
+        static ledger_tx make(ledger_kind kind, std::uint32_t player, std::int64_t amount, std::uint64_t ref)
+        {
+            ledger_tx tx;
+            tx.kind = kind;
+            tx.player = player;
+            tx.amount = amount;
+            tx.ref = ref;
+            return tx;
+        }
+
+        static std::string encode(const std::vector<ledger_tx>& txs)
+        {
+            std::string out;
+            snapshot_writer w(out);
+            w.put<std::uint16_t>(txs.size());
+            for (const ledger_tx& tx : txs)
+            {
+                w.put<std::uint8_t>(static_cast<std::uint8_t>(tx.kind));
+                w.put<std::uint32_t>(tx.player);
+                w.put<std::int64_t>(tx.amount);
+                w.put<std::uint64_t>(tx.ref);
+            }
+            return out;
+        }
+
+        // called with mutex_ held
+        void commit(const std::vector<ledger_tx>& txs)
+        {
+            for (const ledger_tx& tx : txs)
+                apply_one(tx);
+            next_seq_ = wal_.append(encode(txs)) + 1;
+            transactions_.fetch_add(txs.size(), std::memory_order_relaxed);
+            if (next_seq_ - snapshot_seq_ >= snapshot_every_ && !snapshot_due_)
+            {
+                std::lock_guard<std::mutex> lock(snap_mutex_);
+                snapshot_due_ = true;
+                snap_cv_.notify_one();
+            }
+        }
+
+        void apply_one(const ledger_tx& tx)
+        {
+            balances_[tx.player] += tx.amount;
+            if (tx.kind == ledger_kind::bet)
+                stakes_[std::make_pair(tx.player, tx.ref)] -= tx.amount;
+            else if (tx.kind == ledger_kind::payout)
+                stakes_.erase(std::make_pair(tx.player, tx.ref));
+            if (tx.player > max_player_)
+                max_player_ = tx.player;
+        }
+
+        void recover()
+        {
+            // newest snapshot that reads back whole
+            std::vector<std::pair<std::uint64_t, std::string>> snaps = snapshots();
+            for (auto it = snaps.rbegin(); it != snaps.rend(); ++it)
+            {
+                if (load_snapshot(it->second))
+                    break;
+                balances_.clear();
+                stakes_.clear();
+                max_player_ = 0;
+                snapshot_seq_ = 0;
+            }
+
+            std::uint64_t replayed = log_format::replay(dir_, "ledger", snapshot_seq_,
+                    [this](const char* payload, std::uint32_t length, std::uint64_t seq)
+                    {
+                    snapshot_reader r(payload, length);
+                    std::uint16_t n = r.get<std::uint16_t>();
+                    std::vector<ledger_tx> txs(n);
+                    for (ledger_tx& tx : txs)
+                    {
+                        tx.kind = static_cast<ledger_kind>(r.get<std::uint8_t>());
+                        tx.player = r.get<std::uint32_t>();
+                        tx.amount = r.get<std::int64_t>();
+                        tx.ref = r.get<std::uint64_t>();
+                    }
+                    if (!r.ok())
+                        return;
+                    for (const ledger_tx& tx : txs)
+                        apply_one(tx);
+                    });
+            next_seq_ = wal_.synced();
+            LOG_INFO("Ledger: {} accounts, snapshot at {}, {} WAL records replayed",
+                    balances_.size(), snapshot_seq_, replayed);
+        }
+
+        std::vector<std::pair<std::uint64_t, std::string>> snapshots()
+        {
+            std::vector<std::pair<std::uint64_t, std::string>> result;
+            DIR* d = ::opendir(dir_.c_str());
+            if (!d)
+                return result;
+            while (dirent* e = ::readdir(d))
+            {
+                std::string name = e->d_name;
+                if (name.size() > 12 && name.compare(0, 7, "ledger-") == 0
+                        && name.compare(name.size() - 5, 5, ".snap") == 0)
+                    result.push_back(std::make_pair(std::strtoull(name.c_str() + 7, nullptr, 10),
+                                dir_ + "/" + name));
+            }
+            ::closedir(d);
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+
+        bool load_snapshot(const std::string& path)
+        {
+            std::string data;
+            if (!log_format::read_file(path, data) || data.size() < 4)
+                return false;
+            std::uint32_t crc = snapshot_reader(data.data() + data.size() - 4, 4).get<std::uint32_t>();
+            if (log_format::crc32(data.data(), data.size() - 4) != crc)
+                return false;
+            snapshot_reader r(data.data(), data.size() - 4);
+            if (r.get<std::uint32_t>() != snap_magic || r.get<std::uint32_t>() != snap_version)
+                return false;
+            snapshot_seq_ = r.get<std::uint64_t>();
+            std::uint64_t n = r.get<std::uint64_t>();
+            for (std::uint64_t i = 0; i < n && r.ok(); ++i)
+            {
+                std::uint32_t player = r.get<std::uint32_t>();
+                balances_[player] = r.get<std::int64_t>();
+                if (player > max_player_)
+                    max_player_ = player;
+            }
+            std::uint64_t open = r.get<std::uint64_t>();
+            for (std::uint64_t i = 0; i < open && r.ok(); ++i)
+            {
+                std::uint32_t player = r.get<std::uint32_t>();
+                std::uint64_t ref = r.get<std::uint64_t>();
+                stakes_[std::make_pair(player, ref)] = r.get<std::int64_t>();
+            }
+            return r.ok() && r.done();
+        }
+
+        // the snapshot thread, copying the balances is the only time it holds the ledger lock
+        void run()
+        {
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(snap_mutex_);
+                    snap_cv_.wait(lock, [this]() { return stop_ || snapshot_due_; });
+                    if (stop_)
+                        return;
+                }
+
+                std::vector<std::pair<std::uint32_t, std::int64_t>> copy;
+                std::vector<std::pair<std::pair<std::uint32_t, std::uint64_t>, std::int64_t>> open;
+                std::uint64_t seq;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    copy.assign(balances_.begin(), balances_.end());
+                    open.assign(stakes_.begin(), stakes_.end());
+                    seq = next_seq_;
+                    wal_.roll(); // the next record starts a segment, everything before can go
+                }
+
+                std::string out;
+                snapshot_writer w(out);
+                w.put<std::uint32_t>(snap_magic);
+                w.put<std::uint32_t>(snap_version);
+                w.put<std::uint64_t>(seq);
+                w.put<std::uint64_t>(copy.size());
+                for (auto& b : copy)
+                {
+                    w.put<std::uint32_t>(b.first);
+                    w.put<std::int64_t>(b.second);
+                }
+                w.put<std::uint64_t>(open.size());
+                for (auto& o : open)
+                {
+                    w.put<std::uint32_t>(o.first.first);
+                    w.put<std::uint64_t>(o.first.second);
+                    w.put<std::int64_t>(o.second);
+                }
+                w.put<std::uint32_t>(log_format::crc32(out.data(), out.size()));
+
+                char name[48];
+                std::snprintf(name, sizeof(name), "/ledger-%020llu.snap", (unsigned long long)seq);
+                // the records the snapshot holds must be durable before the WAL under them goes
+                bool ok = (seq == 0 || wal_.wait(seq - 1)) && log_format::write_file(dir_ + name, out);
+                if (ok)
+                {
+                    for (auto& old : snapshots())
+                        if (old.first < seq)
+                            ::unlink(old.second.c_str());
+                    log_format::trim(dir_, "ledger", seq);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (ok)
+                    snapshot_seq_ = seq;
+                std::lock_guard<std::mutex> snap_lock(snap_mutex_);
+                snapshot_due_ = false;
+            }
+        }
+
+        std::string dir_;
+        std::uint64_t snapshot_every_;
+        log_writer wal_;
+        std::mutex mutex_;
+        std::unordered_map<std::uint32_t, std::int64_t> balances_;
+        std::map<std::pair<std::uint32_t, std::uint64_t>, std::int64_t> stakes_; // open bets by player and round
+        std::uint32_t max_player_ = 0;
+        std::uint64_t next_seq_ = 0;     // WAL seq of the next record
+        std::uint64_t snapshot_seq_ = 0; // records below this are in the snapshot
+        std::atomic<bool> snapshot_due_{false};
+        std::atomic<std::uint64_t> transactions_{0};
+        std::mutex snap_mutex_;
+        std::condition_variable snap_cv_;
+        bool stop_ = false;
+        std::thread thread_;
+};
@@ -0,0 +1,276 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// which open table a new player gets
+enum class placement
+{
+    fill,   // the fullest table that still has a seat, keeps tables lively
+    spread  // the emptiest table, evens players out
+};
+
+// open tables of every stake, bucketed by how many seats they have free
+// finding a seat is a walk over max_seats buckets plus one set lookup, so O(log n) in tables
+class seat_index
+{
+    public:
+        explicit seat_index(int max_seats = 6, placement how = placement::fill)
+            : max_seats_(max_seats),
+            how_(how)
+        {
+        }
+
+        void add(int table_id, int stake)
+        {
+            entry& e = tables_[table_id];
+            e.stake = stake;
+            e.occupied = 0;
+            e.open = true;
+            index(table_id, e);
+        }
+
+        void remove(int table_id)
+        {
+            auto it = tables_.find(table_id);
+            if (it == tables_.end())
+                return;
+            unindex(table_id, it->second);
+            tables_.erase(it);
+        }
+
+        // -1 when no open table of that stake has a free seat
+        int find(int stake) const
+        {
+            auto it = buckets_.find(stake);
+            if (it == buckets_.end())
+                return -1;
+            const std::vector<std::set<int>>& free = it->second;
+            if (how_ == placement::fill)
+            {
+                for (int n = 1; n <= max_seats_; ++n)
+                    if (!free[n].empty())
+                        return *free[n].begin();
+            }
+            else
+            {
+                for (int n = max_seats_; n >= 1; --n)
+                    if (!free[n].empty())
+                        return *free[n].begin();
+            }
+            return -1;
+        }
+
+        // an open table with a free seat and a lower id than avoid, -1 if none
+        // players only ever move down in id, so two half-empty tables never swap players
+        int find_below(int stake, int avoid) const
+        {
+            auto it = buckets_.find(stake);
+            if (it == buckets_.end())
+                return -1;
+            const std::vector<std::set<int>>& free = it->second;
+            for (int n = 1; n <= max_seats_; ++n)
+                if (!free[n].empty() && *free[n].begin() < avoid)
+                    return *free[n].begin();
+            return -1;
+        }
+
+        // a seat is taken (or given back with -1)
+        int occupy(int table_id, int delta)
+        {
+            auto it = tables_.find(table_id);
+            if (it == tables_.end())
+                return -1;
+            unindex(table_id, it->second);
+            it->second.occupied += delta;
+            index(table_id, it->second);
+            return it->second.occupied;
+        }
+
+        // closed tables are in a round and take nobody new
+        void set_open(int table_id, bool open)
+        {
+            auto it = tables_.find(table_id);
+            if (it == tables_.end())
+                return;
+            unindex(table_id, it->second);
+            it->second.open = open;
+            index(table_id, it->second);
+        }
+
+        std::size_t size() const
+        {
+            return tables_.size();
+        }
+
+    private:
+        struct entry
+        {
+            int stake;
+            int occupied;
+            bool open;
+        };
+
+        void index(int table_id, const entry& e)
+        {
+            int free = max_seats_ - e.occupied;
+            if (!e.open || free <= 0)
+                return;
+            std::vector<std::set<int>>& b = buckets_[e.stake];
+            if (b.empty())
+                b.resize(max_seats_ + 1);
+            b[free].insert(table_id);
+        }
+
+        void unindex(int table_id, const entry& e)
+        {
+            int free = max_seats_ - e.occupied;
+            if (!e.open || free <= 0)
+                return;
+            buckets_[e.stake][free].erase(table_id);
+        }
+
+        int max_seats_;
+        placement how_;
+        std::unordered_map<int, entry> tables_;
+        std::map<int, std::vector<std::set<int>>> buckets_;
+};
+
+// owns every table and hands out seats
+// a seat is reserved here before the join reaches the table, so a table never gets more players than seats
+// the list of tables is also published as an immutable copy whenever a table comes or goes, so
+// whoever only looks at the tables (metrics, the console) never waits on the seating lock
+template <typename Table>
+class lobby
+{
+    public:
+        typedef std::shared_ptr<Table> table_ptr;
+        typedef std::function<table_ptr(int id, int stake)> factory;
+        typedef std::shared_ptr<const std::vector<table_ptr>> table_list;
+
+        lobby(factory make, int max_seats = 6, placement how = placement::fill)
+            : make_(make),
+            index_(max_seats, how)
+        {
+        }
+
+        // reserves a seat, spinning up a new table when every table of that stake is full or playing
+        table_ptr place(int stake)
+        {
+            table_list replaced;
+            std::lock_guard<std::mutex> lock(mutex_);
+            int id = index_.find(stake);
+            if (id == -1)
+            {
+                id = next_id_++;
+                tables_[id] = make_(id, stake);
+                index_.add(id, stake);
+                replaced = publish();
+            }
+            index_.occupy(id, 1);
+            return tables_[id];
+        }
+
+        // reserves a seat at another table of the same stake for a player moving off table_id
+        // never creates a table, null when there is nowhere to go
+        table_ptr place_elsewhere(int stake, int table_id)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            int id = index_.find_below(stake, table_id);
+            if (id == -1)
+                return table_ptr();
+            index_.occupy(id, 1);
+            return tables_[id];
+        }
+
+        // a table carried over from another server process, with its id and seats already taken
+        table_ptr adopt(int id, int stake, int occupied)
+        {
+            table_list replaced;
+            std::lock_guard<std::mutex> lock(mutex_);
+            table_ptr& table = tables_[id];
+            if (!table)
+            {
+                table = make_(id, stake);
+                index_.add(id, stake);
+                replaced = publish();
+            }
+            index_.occupy(id, occupied);
+            if (id >= next_id_)
+                next_id_ = id + 1;
+            return table;
+        }
+
+        // a player left, an empty table is torn down
+        void release(int table_id)
+        {
+            table_ptr retired;
+            table_list replaced;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (index_.occupy(table_id, -1) == 0)
+                {
+                    index_.remove(table_id);
+                    auto it = tables_.find(table_id);
+                    if (it != tables_.end())
+                    {
+                        retired = it->second;
+                        tables_.erase(it);
+                        replaced = publish();
+                    }
+                }
+            }
+            // the last reference may go here, outside the lock
+        }
+
+        void set_open(int table_id, bool open)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            index_.set_open(table_id, open);
+        }
+
+        // null when there is no table with that id
+        table_ptr find(int table_id)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = tables_.find(table_id);
+            return it == tables_.end() ? table_ptr() : it->second;
+        }
+
+        std::size_t size()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return tables_.size();
+        }
+
+        // the published list, the seating lock isn't taken
+        std::vector<table_ptr> tables() const
+        {
+            return *std::atomic_load(&listed_);
+        }
+
+    private:
+        // under the lock, after a table came or went
+        // hands back the list it replaces, so a table in it isn't destroyed under the lock either
+        table_list publish()
+        {
+            std::shared_ptr<std::vector<table_ptr>> list = std::make_shared<std::vector<table_ptr>>();
+            list->reserve(tables_.size());
+            for (auto& t : tables_)
+                list->push_back(t.second);
+            table_list replaced = std::atomic_load(&listed_);
+            std::atomic_store(&listed_, table_list(list));
+            return replaced;
+        }
+
+        factory make_;
+        std::mutex mutex_;
+        seat_index index_;
+        std::unordered_map<int, table_ptr> tables_;
+        table_list listed_ = std::make_shared<std::vector<table_ptr>>();
+        int next_id_ = 1;
+};
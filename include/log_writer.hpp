@@ -0,0 +1,517 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// append-only log split into segment files
+//
+// segment: "<prefix>-<first seq>.log"
+//   header  magic (4 bytes) version (4 bytes) first record seq (8 bytes)
+//   records length (4 bytes) crc32 of payload (4 bytes) payload
+//
+// a crash can only leave a torn record at the end of the last segment, it is cut off on open
+// a batch that fails to get out is cut off right away and written again until it does
+
+namespace log_format
+{
+    enum { magic = 0x474c4a42, version = 1, header_size = 16, frame_size = 8 };
+
+    inline std::uint32_t crc32(const char* data, std::size_t size)
+    {
+        static std::uint32_t table[256];
+        static std::once_flag once;
+        std::call_once(once, []()
+                {
+                for (std::uint32_t i = 0; i < 256; ++i)
+                {
+                    std::uint32_t c = i;
+                    for (int k = 0; k < 8; ++k)
+                        c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                    table[i] = c;
+                }
+                });
+        std::uint32_t crc = 0xffffffff;
+        for (std::size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ (unsigned char)data[i]) & 0xff] ^ (crc >> 8);
+        return crc ^ 0xffffffff;
+    }
+
+    struct segment
+    {
+        std::string path;
+        std::uint64_t first_seq;
+    };
+
+    // segments of one log, oldest first
+    inline std::vector<segment> list(const std::string& dir, const std::string& prefix)
+    {
+        std::vector<segment> result;
+        DIR* d = ::opendir(dir.c_str());
+        if (!d)
+            return result;
+        std::string start = prefix + "-";
+        while (dirent* e = ::readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name.size() <= start.size() + 4 || name.compare(0, start.size(), start) != 0
+                    || name.compare(name.size() - 4, 4, ".log") != 0)
+                continue;
+            segment s;
+            s.path = dir + "/" + name;
+            s.first_seq = std::strtoull(name.c_str() + start.size(), nullptr, 10);
+            result.push_back(s);
+        }
+        ::closedir(d);
+        std::sort(result.begin(), result.end(),
+                [](const segment& a, const segment& b) { return a.first_seq < b.first_seq; });
+        return result;
+    }
+
+    inline std::string segment_name(const std::string& dir, const std::string& prefix, std::uint64_t first_seq)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%020llu", (unsigned long long)first_seq);
+        return dir + "/" + prefix + "-" + name + ".log";
+    }
+
+    // walks the records of a segment held in memory
+    // stops at the first torn or corrupt record, end() tells how far the good part goes
+    class cursor
+    {
+        public:
+            cursor(const char* data, std::size_t size)
+                : data_(data),
+                size_(size)
+            {
+                std::uint32_t m = 0, v = 0;
+                if (size_ >= header_size)
+                {
+                    std::memcpy(&m, data_, 4);
+                    std::memcpy(&v, data_ + 4, 4);
+                    std::memcpy(&seq_, data_ + 8, 8);
+                }
+                pos_ = (m == magic && v == version) ? header_size : size_;
+                good_ = pos_ == header_size;
+            }
+
+            bool valid() const
+            {
+                return good_;
+            }
+
+            // false at the end or at damage
+            bool next(const char*& payload, std::uint32_t& length, std::uint64_t& seq)
+            {
+                if (size_ - pos_ < frame_size)
+                    return false;
+                std::uint32_t len, crc;
+                std::memcpy(&len, data_ + pos_, 4);
+                std::memcpy(&crc, data_ + pos_ + 4, 4);
+                if (size_ - pos_ - frame_size < len || crc32(data_ + pos_ + frame_size, len) != crc)
+                    return false;
+                payload = data_ + pos_ + frame_size;
+                length = len;
+                seq = seq_++;
+                pos_ += frame_size + len;
+                return true;
+            }
+
+            // jump to a record boundary found earlier, seq is that record's number
+            void seek(std::size_t offset, std::uint64_t seq)
+            {
+                if (good_ && offset >= header_size && offset <= size_)
+                {
+                    pos_ = offset;
+                    seq_ = seq;
+                }
+            }
+
+            // offset just past the last good record
+            std::size_t end() const
+            {
+                return pos_;
+            }
+
+            std::uint64_t next_seq() const
+            {
+                return seq_;
+            }
+
+        private:
+            const char* data_;
+            std::size_t size_;
+            std::size_t pos_;
+            std::uint64_t seq_ = 0;
+            bool good_;
+    };
+
+    inline bool read_file(const std::string& path, std::string& data)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        ::fstat(fd, &st);
+        data.resize(st.st_size);
+        bool ok = st.st_size == 0 || ::pread(fd, &data[0], st.st_size, 0) == st.st_size;
+        ::close(fd);
+        return ok;
+    }
+
+    // replaces path in one step, a crash leaves either the old or the new file
+    inline bool write_file(const std::string& path, const std::string& data)
+    {
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        bool ok = ::write(fd, data.data(), data.size()) == (ssize_t)data.size() && ::fdatasync(fd) == 0;
+        ::close(fd);
+        if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        std::size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash ? slash : 1);
+        int d = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+        if (d >= 0)
+        {
+            ::fsync(d);
+            ::close(d);
+        }
+        return true;
+    }
+
+    // calls f(payload, length, seq) for every good record from seq from on, oldest first
+    template <typename F>
+    std::uint64_t replay(const std::string& dir, const std::string& prefix, std::uint64_t from, F f)
+    {
+        std::uint64_t count = 0;
+        std::vector<segment> segments = list(dir, prefix);
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            if (i + 1 < segments.size() && segments[i + 1].first_seq <= from)
+                continue;
+            std::string data;
+            if (!read_file(segments[i].path, data))
+                continue;
+            cursor c(data.data(), data.size());
+            const char* payload;
+            std::uint32_t length;
+            std::uint64_t seq;
+            while (c.next(payload, length, seq))
+            {
+                if (seq < from)
+                    continue;
+                f(payload, length, seq);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    // drops segments that only hold records below seq, the newest one always stays
+    inline void trim(const std::string& dir, const std::string& prefix, std::uint64_t seq)
+    {
+        std::vector<segment> segments = list(dir, prefix);
+        for (std::size_t i = 0; i + 1 < segments.size(); ++i)
+        {
+            if (segments[i + 1].first_seq <= seq)
+                ::unlink(segments[i].path.c_str());
+        }
+    }
+}
+
+// one thread owns the files, everyone else hands it records
+// appending is a short lock and a move, the writer thread batches whatever piled up
+// into one write and one fdatasync (group commit)
+class log_writer
+{
+    public:
+        log_writer(const std::string& dir, const std::string& prefix,
+                std::size_t segment_bytes = 64 << 20)
+            : dir_(dir),
+            prefix_(prefix),
+            segment_bytes_(segment_bytes)
+        {
+            ::mkdir(dir_.c_str(), 0755);
+            recover();
+            thread_ = std::thread([this]() { run(); });
+        }
+
+        ~log_writer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_one();
+            thread_.join();
+            if (fd_ >= 0)
+                ::close(fd_);
+        }
+
+        // any thread, returns the record's sequence number
+        std::uint64_t append(std::string record)
+        {
+            std::uint64_t seq;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                seq = next_seq_++;
+                pending_.push_back(std::move(record));
+            }
+            wake_.notify_one();
+            return seq;
+        }
+
+        // blocks until the record is on disk, false if the disk is failing and it isn't yet
+        bool wait(std::uint64_t seq)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            synced_cv_.wait(lock, [this, seq]() { return synced_ > seq || failed_; });
+            return synced_ > seq;
+        }
+
+        // the last batch couldn't be written, clears once a retry gets it out
+        bool failed() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return failed_;
+        }
+
+        // everything below this sequence number is on disk
+        std::uint64_t synced() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return synced_;
+        }
+
+        std::uint64_t batches() const
+        {
+            return batches_.load(std::memory_order_relaxed);
+        }
+
+        // starts the next segment at the next record, older ones can then be dropped
+        void roll()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            roll_ = true;
+        }
+
+        const std::string& dir() const
+        {
+            return dir_;
+        }
+
+        const std::string& prefix() const
+        {
+            return prefix_;
+        }
+
+    private:
+        // continue the last segment after its last good record
+        void recover()
+        {
+            std::vector<log_format::segment> segments = log_format::list(dir_, prefix_);
+            if (segments.empty())
+                return;
+            const log_format::segment& last = segments.back();
+            int fd = ::open(last.path.c_str(), O_RDWR | O_CLOEXEC);
+            if (fd < 0)
+                throw std::runtime_error("can't open " + last.path);
+            struct stat st;
+            ::fstat(fd, &st);
+            std::string data(st.st_size, '\0');
+            if (st.st_size > 0 && ::pread(fd, &data[0], st.st_size, 0) != st.st_size)
+            {
+                ::close(fd);
+                throw std::runtime_error("can't read " + last.path);
+            }
+            log_format::cursor c(data.data(), data.size());
+            if (!c.valid())
+            {
+                // never got its header out, start it over
+                ::close(fd);
+                ::unlink(last.path.c_str());
+                next_seq_ = synced_ = last.first_seq;
+                return;
+            }
+            const char* payload;
+            std::uint32_t length;
+            std::uint64_t seq;
+            while (c.next(payload, length, seq))
+            {
+            }
+            if (c.end() != data.size() && ::ftruncate(fd, c.end()) == 0)
+                ::fdatasync(fd);
+            ::lseek(fd, c.end(), SEEK_SET);
+            fd_ = fd;
+            size_ = c.end();
+            next_seq_ = synced_ = c.next_seq();
+        }
+
+        void open_segment(std::uint64_t first_seq)
+        {
+            if (fd_ >= 0)
+                ::close(fd_);
+            std::string path = log_format::segment_name(dir_, prefix_, first_seq);
+            fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd_ < 0)
+                throw std::runtime_error("can't create " + path);
+            char header[log_format::header_size];
+            std::uint32_t m = log_format::magic, v = log_format::version;
+            std::memcpy(header, &m, 4);
+            std::memcpy(header + 4, &v, 4);
+            std::memcpy(header + 8, &first_seq, 8);
+            if (!write_all(header, sizeof(header)))
+            {
+                ::close(fd_);
+                fd_ = -1;
+                throw std::runtime_error("can't write " + path);
+            }
+            size_ = sizeof(header);
+            // the new file's directory entry has to survive a crash too
+            int d = ::open(dir_.c_str(), O_RDONLY | O_CLOEXEC);
+            if (d >= 0)
+            {
+                ::fsync(d);
+                ::close(d);
+            }
+        }
+
+        bool write_all(const char* data, std::size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t n = ::write(fd_, data, size);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                data += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        // cuts the segment back to the end of the last good batch
+        // if even that fails the segment is given up, the next batch starts a new one
+        void discard()
+        {
+            if (fd_ >= 0 && (::ftruncate(fd_, size_) != 0 || ::lseek(fd_, size_, SEEK_SET) < 0))
+            {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        void run()
+        {
+            // a batch that failed stays here and goes out again with whatever came in since,
+            // so it always starts at synced_ and no record is ever skipped
+            std::vector<std::string> batch;
+            std::string buffer;
+            for (;;)
+            {
+                std::uint64_t first;
+                bool roll;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [this, &batch]() { return stop_ || !pending_.empty() || !batch.empty(); });
+                    if (stop_ && (failed_ || (pending_.empty() && batch.empty())))
+                    {
+                        if (failed_)
+                            std::cerr << "log " << prefix_ << ": " << next_seq_ - synced_
+                                << " records never got to disk" << std::endl;
+                        return;
+                    }
+                    for (auto& record : pending_)
+                        batch.push_back(std::move(record));
+                    pending_.clear();
+                    first = synced_;
+                    roll = roll_;
+                    roll_ = false;
+                }
+
+                buffer.clear();
+                for (auto& record : batch)
+                {
+                    std::uint32_t len = record.size();
+                    std::uint32_t crc = log_format::crc32(record.data(), record.size());
+                    buffer.append(reinterpret_cast<const char*>(&len), 4);
+                    buffer.append(reinterpret_cast<const char*>(&crc), 4);
+                    buffer.append(record);
+                }
+
+                bool ok = true;
+                try
+                {
+                    if (fd_ < 0 || roll || size_ >= segment_bytes_)
+                        open_segment(first);
+                }
+                catch (std::exception& e)
+                {
+                    std::cerr << "log " << prefix_ << ": " << e.what() << std::endl;
+                    ok = false;
+                }
+                ok = ok && write_all(buffer.data(), buffer.size()) && ::fdatasync(fd_) == 0;
+                int err = errno;
+                if (ok)
+                    size_ += buffer.size();
+                else
+                    discard();
+                batches_.fetch_add(1, std::memory_order_relaxed);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (ok)
+                        synced_ = first + batch.size();
+                    if (ok && failed_)
+                        std::cerr << "log " << prefix_ << ": writing again" << std::endl;
+                    else if (!ok && !failed_)
+                        std::cerr << "log " << prefix_ << ": write failed, retrying: "
+                            << std::strerror(err) << std::endl;
+                    failed_ = !ok;
+                }
+                synced_cv_.notify_all();
+                if (ok)
+                    batch.clear();
+                else
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+
+        std::string dir_;
+        std::string prefix_;
+        std::size_t segment_bytes_;
+        mutable std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable synced_cv_;
+        std::vector<std::string> pending_;
+        std::uint64_t next_seq_ = 0;
+        std::uint64_t synced_ = 0;
+        bool stop_ = false;
+        bool roll_ = false;
+        bool failed_ = false;
+        std::atomic<std::uint64_t> batches_{0};
+        int fd_ = -1;
+        std::size_t size_ = 0;
+        std::thread thread_;
+};
@@ -0,0 +1,429 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+// the server's log, so io threads never wait on a terminal
+//
+// every thread logs into its own ring buffer: a single producer, single consumer byte ring
+// that the thread writes without a lock. a record is the format string's address, the
+// level, a timestamp and the arguments in binary, strings copied. a background thread
+// drains every ring, formats the records in time order and writes them out, warnings and
+// errors to stderr, the rest to stdout. a full ring drops the record and counts it.
+//
+//   LOG_INFO("Restored {} tables in {} ms", tables, ms);
+//
+// formats take literal strings, each {} is the next argument. levels below LOG_LEVEL are
+// compiled out, arguments and all.
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+namespace logging
+{
+    enum level : std::uint8_t { trace, debug, info, warn, error };
+
+    enum arg_type : std::uint8_t { signed_arg, unsigned_arg, double_arg, string_arg };
+
+    // one thread's records on their way to the flusher
+    class ring
+    {
+        public:
+            enum { capacity = 1 << 18 }; // a power of two
+
+            // copies a record's pieces in one after the other
+            class cursor
+            {
+                public:
+                    cursor(ring& r, std::uint64_t at) : ring_(r), at_(at) {}
+
+                    void operator()(const void* data, std::size_t len)
+                    {
+                        ring_.put(at_, data, len);
+                        at_ += len;
+                    }
+
+                private:
+                    ring& ring_;
+                    std::uint64_t at_;
+            };
+
+            // false when the record doesn't fit, the flusher is behind
+            template <typename Fill>
+            bool write(std::size_t size, Fill fill)
+            {
+                std::uint64_t head = head_.load(std::memory_order_relaxed);
+                if (capacity - (head - tail_.load(std::memory_order_acquire)) < size + 4)
+                {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                std::uint32_t n = size;
+                put(head, &n, 4);
+                cursor c(*this, head + 4);
+                fill(c);
+                head_.store(head + 4 + size, std::memory_order_release);
+                return true;
+            }
+
+            // the flusher's side, every whole record written so far
+            void drain(std::string& out)
+            {
+                std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+                std::uint64_t head = head_.load(std::memory_order_acquire);
+                std::size_t start = out.size();
+                out.resize(start + (head - tail));
+                get(tail, &out[start], head - tail);
+                tail_.store(head, std::memory_order_release);
+            }
+
+            std::size_t used() const
+            {
+                return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed);
+            }
+
+            std::uint64_t dropped()
+            {
+                return dropped_.exchange(0, std::memory_order_relaxed);
+            }
+
+        private:
+            void put(std::uint64_t at, const void* data, std::size_t len)
+            {
+                std::size_t i = at & (capacity - 1);
+                std::size_t first = std::min<std::size_t>(len, capacity - i);
+                std::memcpy(buffer_ + i, data, first);
+                std::memcpy(buffer_, (const char*)data + first, len - first);
+            }
+
+            void get(std::uint64_t at, char* data, std::size_t len)
+            {
+                std::size_t i = at & (capacity - 1);
+                std::size_t first = std::min<std::size_t>(len, capacity - i);
+                std::memcpy(data, buffer_ + i, first);
+                std::memcpy(data + first, buffer_, len - first);
+            }
+
+            alignas(64) std::atomic<std::uint64_t> head_{0};
+            alignas(64) std::atomic<std::uint64_t> tail_{0};
+            std::atomic<std::uint64_t> dropped_{0};
+            char buffer_[capacity];
+    };
+
+    // how many bytes each argument takes in a record
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, std::size_t>::type arg_size(const T&)
+    {
+        return 9;
+    }
+
+    inline std::size_t arg_size(const std::string& s)
+    {
+        return 3 + std::min<std::size_t>(s.size(), 0xffff);
+    }
+
+    inline std::size_t arg_size(const char* s)
+    {
+        return 3 + std::min<std::size_t>(s ? std::strlen(s) : 0, 0xffff);
+    }
+
+    inline std::size_t args_size()
+    {
+        return 0;
+    }
+
+    template <typename T, typename... Rest>
+    std::size_t args_size(const T& first, const Rest&... rest)
+    {
+        return arg_size(first) + args_size(rest...);
+    }
+
+    // the arguments in binary, one type byte then the value
+    template <typename Put, typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type put_arg(Put& put, T v)
+    {
+        std::uint8_t t = double_arg;
+        double d = v;
+        put(&t, 1);
+        put(&d, 8);
+    }
+
+    template <typename Put, typename T>
+    typename std::enable_if<std::is_integral<T>::value>::type put_arg(Put& put, T v)
+    {
+        std::uint8_t t = std::is_signed<T>::value ? signed_arg : unsigned_arg;
+        std::uint64_t u = std::is_signed<T>::value ? (std::uint64_t)(std::int64_t)v : (std::uint64_t)v;
+        put(&t, 1);
+        put(&u, 8);
+    }
+
+    template <typename Put>
+    void put_string(Put& put, const char* s, std::size_t len)
+    {
+        std::uint8_t t = string_arg;
+        std::uint16_t n = std::min<std::size_t>(len, 0xffff);
+        put(&t, 1);
+        put(&n, 2);
+        put(s, n);
+    }
+
+    template <typename Put>
+    void put_arg(Put& put, const std::string& s)
+    {
+        put_string(put, s.data(), s.size());
+    }
+
+    template <typename Put>
+    void put_arg(Put& put, const char* s)
+    {
+        put_string(put, s ? s : "", s ? std::strlen(s) : 0);
+    }
+
+    template <typename Put>
+    void put_args(Put&)
+    {
+    }
+
+    template <typename Put, typename T, typename... Rest>
+    void put_args(Put& put, const T& first, const Rest&... rest)
+    {
+        put_arg(put, first);
+        put_args(put, rest...);
+    }
+
+    class logger
+    {
+        public:
+            enum { flush_ms = 20 };
+
+            static logger& instance()
+            {
+                static logger log;
+                return log;
+            }
+
+            ~logger()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stop_ = true;
+                }
+                cv_.notify_one();
+                thread_.join();
+                flush();
+            }
+
+            // record layout: format pointer, level, microseconds since the epoch, argument count, arguments
+            template <typename... Args>
+            void log(level lvl, const char* format, const Args&... args)
+            {
+                std::int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+                std::uint8_t l = lvl, n = sizeof...(Args);
+                ring& r = mine();
+                r.write(sizeof(format) + 10 + args_size(args...), [&](ring::cursor& put)
+                        {
+                        put(&format, sizeof(format));
+                        put(&l, 1);
+                        put(&now, 8);
+                        put(&n, 1);
+                        put_args(put, args...);
+                        });
+                // warnings go out at once, and a ring half full doesn't wait for the next flush
+                if (lvl >= warn || r.used() > ring::capacity / 2)
+                    cv_.notify_one();
+            }
+
+            // writes out everything logged so far, the flusher does this every flush_ms
+            void flush()
+            {
+                std::lock_guard<std::mutex> lock(flush_mutex_);
+                std::vector<std::shared_ptr<ring>> rings;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    rings = rings_;
+                }
+                std::vector<std::pair<std::int64_t, std::string>> lines[2]; // stdout, stderr
+                std::uint64_t dropped = 0;
+                for (auto& r : rings)
+                {
+                    std::string data;
+                    r->drain(data);
+                    dropped += r->dropped();
+                    for (std::size_t at = 0; at + 4 <= data.size();)
+                    {
+                        std::uint32_t size;
+                        std::memcpy(&size, data.data() + at, 4);
+                        format(data.data() + at + 4, lines);
+                        at += 4 + size;
+                    }
+                }
+                if (dropped)
+                    lines[1].push_back(std::make_pair(std::numeric_limits<std::int64_t>::max(),
+                                "[warn] log ring full, " + std::to_string(dropped) + " records dropped\n"));
+                for (int i = 0; i < 2; ++i)
+                {
+                    // each thread's records are in order already, this merges the threads
+                    std::stable_sort(lines[i].begin(), lines[i].end(),
+                            [](const std::pair<std::int64_t, std::string>& a,
+                                const std::pair<std::int64_t, std::string>& b) { return a.first < b.first; });
+                    std::string out;
+                    for (auto& line : lines[i])
+                        out += line.second;
+                    write_all(i == 0 ? STDOUT_FILENO : STDERR_FILENO, out);
+                }
+            }
+
+        private:
+            logger()
+            {
+                thread_ = std::thread([this]() { run(); });
+            }
+
+            ring& mine()
+            {
+                thread_local ring* r = nullptr;
+                if (!r)
+                {
+                    auto created = std::make_shared<ring>();
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    rings_.push_back(created);
+                    r = created.get();
+                }
+                return *r;
+            }
+
+            static void format(const char* p, std::vector<std::pair<std::int64_t, std::string>>* lines)
+            {
+                static const char* const names[] = { "trace", "debug", "info", "warn", "error" };
+                const char* fmt;
+                std::uint8_t lvl, n;
+                std::int64_t at;
+                std::memcpy(&fmt, p, sizeof(fmt));
+                p += sizeof(fmt);
+                lvl = *p++;
+                std::memcpy(&at, p, 8);
+                p += 8;
+                n = *p++;
+
+                std::string line;
+                if (lvl != info)
+                    line = std::string("[") + names[lvl % 5] + "] ";
+                for (; *fmt; ++fmt)
+                {
+                    if (fmt[0] != '{' || fmt[1] != '}' || n == 0)
+                    {
+                        line += *fmt;
+                        continue;
+                    }
+                    ++fmt;
+                    --n;
+                    std::uint8_t type = *p++;
+                    if (type == string_arg)
+                    {
+                        std::uint16_t len;
+                        std::memcpy(&len, p, 2);
+                        line.append(p + 2, len);
+                        p += 2 + len;
+                        continue;
+                    }
+                    std::uint64_t v;
+                    std::memcpy(&v, p, 8);
+                    p += 8;
+                    if (type == signed_arg)
+                        line += std::to_string((std::int64_t)v);
+                    else if (type == unsigned_arg)
+                        line += std::to_string(v);
+                    else
+                    {
+                        double d;
+                        std::memcpy(&d, &v, 8);
+                        char buf[32];
+                        std::snprintf(buf, sizeof(buf), "%g", d);
+                        line += buf;
+                    }
+                }
+                line += '\n';
+                lines[lvl >= warn].push_back(std::make_pair(at, std::move(line)));
+            }
+
+            static void write_all(int fd, const std::string& out)
+            {
+                std::size_t done = 0;
+                while (done < out.size())
+                {
+                    ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+                    if (n <= 0)
+                        return;
+                    done += n;
+                }
+            }
+
+            void run()
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!stop_)
+                {
+                    cv_.wait_for(lock, std::chrono::milliseconds(flush_ms));
+                    lock.unlock();
+                    flush();
+                    lock.lock();
+                }
+            }
+
+            std::mutex mutex_; // the ring list and stop_, never taken on the logging path once a thread has its ring
+            std::condition_variable cv_;
+            std::vector<std::shared_ptr<ring>> rings_;
+            bool stop_ = false;
+            std::mutex flush_mutex_;
+            std::thread thread_;
+    };
+}
+
+#define LOG_AT(lvl, ...) logging::logger::instance().log(lvl, __VA_ARGS__)
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_AT(logging::trace, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(logging::debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(logging::info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(logging::warn, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#define LOG_ERROR(...) LOG_AT(logging::error, __VA_ARGS__)
@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// server wide counters and gauges, read by the metrics endpoint
+//
+// every thread gets a slot of its own the first time it counts something and only ever writes
+// that slot, with plain relaxed stores. reading adds the slots up without stopping anyone.
+// a gauge is counted the same way, +1 and -1 from wherever it changes, so only the sum means
+// anything. claiming a slot doesn't allocate, operator new counts through here too.
+
+namespace metrics
+{
+    enum stat : int
+    {
+        // counters
+        messages_in,
+        bytes_in,
+        messages_out,
+        bytes_out,
+        messages_dropped,  // thrown away by a full send queue
+        queue_overflows,
+        rounds,
+        reshuffles,
+        allocations,
+        frees,
+        allocated_bytes,
+        thread_moves,
+        // gauges
+        tables,
+        seats,
+        sessions,
+        queued_messages,
+        queued_bytes,
+        stats
+    };
+
+    struct description
+    {
+        const char* name;
+        const char* type;
+        const char* help;
+    };
+
+    inline const description& describe(stat s)
+    {
+        static const description all[stats] = {
+            { "blackjack_messages_in_total", "counter", "Messages read from players." },
+            { "blackjack_bytes_in_total", "counter", "Bytes read from players." },
+            { "blackjack_messages_out_total", "counter", "Messages written to players." },
+            { "blackjack_bytes_out_total", "counter", "Bytes written to players." },
+            { "blackjack_messages_dropped_total", "counter", "Queued messages thrown away for slow players." },
+            { "blackjack_queue_overflows_total", "counter", "Times a send queue hit its limit." },
+            { "blackjack_rounds_total", "counter", "Rounds settled." },
+            { "blackjack_reshuffles_total", "counter", "New shoes after the cut card." },
+            { "blackjack_allocations_total", "counter", "Calls to operator new." },
+            { "blackjack_frees_total", "counter", "Calls to operator delete." },
+            { "blackjack_allocated_bytes_total", "counter", "Bytes asked of operator new." },
+            { "blackjack_thread_moves_total", "counter", "Sessions handed to another io thread." },
+            { "blackjack_tables", "gauge", "Open tables." },
+            { "blackjack_seats", "gauge", "Occupied seats, held ones included." },
+            { "blackjack_sessions", "gauge", "Player connections." },
+            { "blackjack_queued_messages", "gauge", "Messages waiting in send queues." },
+            { "blackjack_queued_bytes", "gauge", "Memory held by send queues." },
+        };
+        return all[s];
+    }
+
+    enum { max_slots = 256 };
+
+    struct alignas(64) slot
+    {
+        std::atomic<std::int64_t> values[stats];
+    };
+
+    // zero initialised before anything runs, no constructor to order
+    inline slot* slots()
+    {
+        static slot all[max_slots];
+        return all;
+    }
+
+    inline std::atomic<int>& slots_taken()
+    {
+        static std::atomic<int> taken{0};
+        return taken;
+    }
+
+    // the last slot is shared by whatever threads come after the others ran out
+    inline void add(stat s, std::int64_t n)
+    {
+        static thread_local int mine = -1;
+        if (mine < 0)
+            mine = std::min<int>(slots_taken().fetch_add(1, std::memory_order_relaxed), max_slots - 1);
+        std::atomic<std::int64_t>& v = slots()[mine].values[s];
+        if (mine == max_slots - 1)
+            v.fetch_add(n, std::memory_order_relaxed);
+        else
+            v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline std::int64_t read(stat s)
+    {
+        int used = std::min<int>(slots_taken().load(std::memory_order_relaxed), max_slots);
+        std::int64_t sum = 0;
+        for (int i = 0; i < used; ++i)
+            sum += slots()[i].values[s].load(std::memory_order_relaxed);
+        return sum;
+    }
+}
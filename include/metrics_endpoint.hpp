@@ -0,0 +1,177 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "asio.hpp"
+#include "latency.hpp"
+#include "metrics.hpp"
+
+// serves the metrics as prometheus text exposition on GET /metrics, plain HTTP/1.0
+// everything it reads is per thread slots and atomics, a scrape never waits on a table
+// other plain text pages can be added with page(), they get the query string after the ?
+class metrics_endpoint
+{
+    public:
+        metrics_endpoint(asio::io_context& io_context, const asio::ip::tcp::endpoint& endpoint)
+            : acceptor_(io_context, endpoint),
+            sampled_at_(std::chrono::steady_clock::now())
+        {
+            do_accept();
+        }
+
+        // the whole exposition, only ever called from the endpoint's thread
+        std::string render()
+        {
+            std::ostringstream out;
+            for (int i = 0; i < metrics::stats; ++i)
+            {
+                const metrics::description& d = metrics::describe(static_cast<metrics::stat>(i));
+                out << "# HELP " << d.name << " " << d.help << "\n"
+                    << "# TYPE " << d.name << " " << d.type << "\n"
+                    << d.name << " " << metrics::read(static_cast<metrics::stat>(i)) << "\n";
+            }
+
+            out << "# HELP blackjack_live_allocations Allocations not freed yet.\n"
+                << "# TYPE blackjack_live_allocations gauge\n"
+                << "blackjack_live_allocations "
+                << metrics::read(metrics::allocations) - metrics::read(metrics::frees) << "\n";
+
+            out << "# HELP blackjack_rounds_per_second Rounds settled per second, over at least the last second.\n"
+                << "# TYPE blackjack_rounds_per_second gauge\n"
+                << "blackjack_rounds_per_second " << rounds_per_second(metrics::read(metrics::rounds)) << "\n";
+
+            std::vector<latency::histogram> all = latency::recorder::instance().scrape();
+            out << "# HELP blackjack_action_latency_seconds From reading an action to the last write of its broadcast.\n"
+                << "# TYPE blackjack_action_latency_seconds summary\n";
+            for (std::size_t k = 0; k < all.size(); ++k)
+            {
+                const latency::histogram& h = all[k];
+                std::string action = latency::name(static_cast<latency::action>(k));
+                for (double q : { 0.5, 0.9, 0.99, 0.999 })
+                    out << "blackjack_action_latency_seconds{action=\"" << action << "\",quantile=\"" << q << "\"} "
+                        << h.percentile(q) / 1e9 << "\n";
+                out << "blackjack_action_latency_seconds_sum{action=\"" << action << "\"} " << h.sum() / 1e9 << "\n"
+                    << "blackjack_action_latency_seconds_count{action=\"" << action << "\"} " << h.count() << "\n";
+            }
+            return out.str();
+        }
+
+        typedef std::function<std::string(const std::string& query)> page_renderer;
+
+        void page(const std::string& path, page_renderer render)
+        {
+            pages_[path] = render;
+        }
+
+    private:
+        // one request per connection, answered and closed
+        class request : public std::enable_shared_from_this<request>
+        {
+            public:
+                request(asio::ip::tcp::socket socket, metrics_endpoint& owner)
+                    : socket_(std::move(socket)),
+                    owner_(owner),
+                    timer_(static_cast<asio::io_context&>(socket_.get_executor().context())),
+                    in_(max_request)
+                {
+                }
+
+                void start()
+                {
+                    auto self(shared_from_this());
+                    timer_.expires_after(std::chrono::seconds(5));
+                    timer_.async_wait([this, self](std::error_code ec)
+                            {
+                            if (!ec)
+                                socket_.close(ec);
+                            });
+                    asio::async_read_until(socket_, in_, "\r\n\r\n",
+                            [this, self](std::error_code ec, std::size_t)
+                            {
+                            if (ec)
+                            {
+                                timer_.cancel();
+                                return;
+                            }
+                            std::istream lines(&in_);
+                            std::string method, target;
+                            lines >> method >> target;
+                            std::size_t mark = target.find('?');
+                            std::string path = target.substr(0, mark);
+                            std::string query = mark == std::string::npos ? "" : target.substr(mark + 1);
+                            auto page = owner_.pages_.find(path);
+                            if (method != "GET")
+                                respond("405 Method Not Allowed", "only GET\n");
+                            else if (path == "/metrics" || path == "/")
+                                respond("200 OK", owner_.render());
+                            else if (page != owner_.pages_.end())
+                                respond("200 OK", page->second(query));
+                            else
+                                respond("404 Not Found", "try /metrics\n");
+                            });
+                }
+
+            private:
+                enum { max_request = 8192 };
+
+                void respond(const char* status, const std::string& body)
+                {
+                    std::ostringstream head;
+                    head << "HTTP/1.0 " << status << "\r\n"
+                        << "Content-Type: text/plain; version=0.0.4\r\n"
+                        << "Content-Length: " << body.size() << "\r\n"
+                        << "Connection: close\r\n\r\n";
+                    out_ = head.str() + body;
+                    auto self(shared_from_this());
+                    asio::async_write(socket_, asio::buffer(out_),
+                            [this, self](std::error_code ec, std::size_t)
+                            {
+                            timer_.cancel();
+                            socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                            });
+                }
+
+                asio::ip::tcp::socket socket_;
+                metrics_endpoint& owner_;
+                asio::steady_timer timer_;
+                asio::streambuf in_;
+                std::string out_;
+        };
+
+        void do_accept()
+        {
+            acceptor_.async_accept(
+                    [this](std::error_code ec, asio::ip::tcp::socket socket)
+                    {
+                    if (!ec)
+                        std::make_shared<request>(std::move(socket), *this)->start();
+                    do_accept();
+                    });
+        }
+
+        // scrapes closer together than a second reuse the last rate
+        double rounds_per_second(std::int64_t rounds)
+        {
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - sampled_at_).count();
+            if (seconds >= 1)
+            {
+                rate_ = (rounds - sampled_rounds_) / seconds;
+                sampled_at_ = now;
+                sampled_rounds_ = rounds;
+            }
+            return rate_;
+        }
+
+        asio::ip::tcp::acceptor acceptor_;
+        std::map<std::string, page_renderer> pages_;
+        std::chrono::steady_clock::time_point sampled_at_;
+        std::int64_t sampled_rounds_ = 0;
+        double rate_ = 0;
+};
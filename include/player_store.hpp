@@ -0,0 +1,485 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_writer.hpp"
+
+// every registered player's profile, by name
+//
+// a name is registered to whoever sends it first and they get a random key for it. a name
+// only opens its profile together with that key, the name alone is no proof of anything.
+//
+// on disk it is one hash table file: a header slot, then fixed slots of slot_size bytes,
+// open addressing with linear probing on the fnv-1a hash of the name. a lookup is one or a
+// few preads, nothing about the players who aren't playing is kept in memory. past
+// max_load the table is rewritten at twice the size.
+//
+// in front of it sits an LRU cache cut into shards by name hash, each with its own lock,
+// so tables on different threads rarely meet. updates only touch the cache and mark the
+// entry dirty; a background thread writes dirty entries out every flush_ms, and an entry
+// that is evicted dirty is written before it goes.
+
+struct player_profile
+{
+    std::string name;
+    std::uint64_t key = 0;      // handed out at registration, needed to open the profile again
+    std::uint32_t player = 0;   // server wide player number
+    std::int64_t credits = 0;
+    std::uint64_t hands = 0;
+    std::uint64_t wins = 0;
+    std::int64_t net = 0;       // won minus lost over every hand
+    std::int64_t created_us = 0;
+    std::int64_t seen_us = 0;   // last time they sat down
+};
+
+class player_store
+{
+    public:
+        enum { max_name = 47 };
+
+        player_store(const std::string& path, std::size_t cache_entries = 100000,
+                std::size_t shards = 16, int flush_ms = 1000)
+            : path_(path),
+            shards_(shards),
+            per_shard_(std::max<std::size_t>(1, cache_entries / shards)),
+            flush_ms_(flush_ms)
+        {
+            open();
+            thread_ = std::thread([this]() { run(); });
+        }
+
+        ~player_store()
+        {
+            {
+                std::lock_guard<std::mutex> lock(flush_mutex_);
+                stop_ = true;
+            }
+            flush_cv_.notify_one();
+            thread_.join();
+            flush();
+            ::close(fd_);
+        }
+
+        // the profile from the cache, or from disk into the cache, false for an unknown name
+        bool get(const std::string& name, player_profile& out)
+        {
+            std::uint64_t h = hash(name);
+            shard& s = shards_[h % shards_.size()];
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                auto it = s.index.find(name);
+                if (it != s.index.end())
+                {
+                    s.lru.splice(s.lru.begin(), s.lru, it->second);
+                    out = it->second->profile;
+                    hits_.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            player_profile p;
+            if (!read(name, p))
+                return false;
+            insert(s, p, false);
+            out = p;
+            return true;
+        }
+
+        // the profile into out, registering the name with a new key first if it is new
+        // false when the name is taken and key isn't the one it was registered with
+        // number hands out a player number for a new player
+        bool open(const std::string& name, std::uint64_t key, std::int64_t opening,
+                std::function<std::uint32_t()> number, player_profile& out)
+        {
+            player_profile p;
+            if (get(name, p))
+            {
+                if (p.key != key)
+                    return false;
+                out = p;
+                return true;
+            }
+            p.name = name.substr(0, max_name);
+            p.credits = opening;
+            p.created_us = now_us();
+            p.seen_us = p.created_us;
+            {
+                // a new name goes to disk at once under the lock, so two sessions can't both register it
+                std::lock_guard<std::mutex> lock(disk_mutex_);
+                player_profile taken;
+                char slot[slot_size];
+                if (probe(fd_, slots_, p.name, slot) >= 0 && decode(slot, taken))
+                {
+                    if (taken.key != key)
+                        return false;
+                    p = taken;
+                }
+                else
+                {
+                    do
+                        p.key = (std::uint64_t)random_() << 32 | random_();
+                    while (p.key == 0);
+                    p.player = number();
+                    if (p.player > max_player_)
+                        max_player_ = p.player;
+                    if (used_ + 1 > slots_ * max_load)
+                        grow();
+                    place(fd_, slots_, p, true);
+                }
+            }
+            insert(shards_[hash(p.name) % shards_.size()], p, false);
+            out = p;
+            return true;
+        }
+
+        // updates the cached profile, it reaches the disk with the next flush
+        void update(const std::string& name, std::function<void(player_profile&)> f)
+        {
+            player_profile p;
+            if (!get(name, p))
+                return;
+            shard& s = shards_[hash(name) % shards_.size()];
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.index.find(name);
+            if (it == s.index.end()) // evicted in between, comes back dirty
+            {
+                f(p);
+                insert_locked(s, p, true);
+                return;
+            }
+            f(it->second->profile);
+            it->second->dirty = true;
+        }
+
+        // writes every dirty profile, then syncs the file
+        void flush()
+        {
+            for (shard& s : shards_)
+            {
+                std::vector<player_profile> dirty;
+                {
+                    std::lock_guard<std::mutex> lock(s.mutex);
+                    for (entry& e : s.lru)
+                    {
+                        if (e.dirty)
+                        {
+                            dirty.push_back(e.profile);
+                            e.dirty = false;
+                        }
+                    }
+                }
+                for (auto& p : dirty)
+                    write(p);
+            }
+            std::lock_guard<std::mutex> lock(disk_mutex_);
+            write_header();
+            ::fdatasync(fd_);
+        }
+
+        std::uint32_t max_player()
+        {
+            std::lock_guard<std::mutex> lock(disk_mutex_);
+            return max_player_;
+        }
+
+        std::uint64_t players()
+        {
+            std::lock_guard<std::mutex> lock(disk_mutex_);
+            return used_;
+        }
+
+        std::uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+        std::uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    private:
+        enum { magic = 0x53504c42, version = 2, slot_size = 128, initial_slots = 1024, probe_slots = 32, scan_slots = 8192 };
+        static constexpr double max_load = 0.7;
+
+        struct entry
+        {
+            player_profile profile;
+            bool dirty;
+        };
+
+        struct shard
+        {
+            std::mutex mutex;
+            std::list<entry> lru; // most recent first
+            std::unordered_map<std::string, std::list<entry>::iterator> index;
+        };
+
+        static std::uint64_t hash(const std::string& name)
+        {
+            std::uint64_t h = 14695981039346656037ull;
+            for (unsigned char c : name)
+            {
+                h ^= c;
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+        // the first slot to look at, fnv leaves the low bits too alike for a power of two table
+        static std::uint64_t home(const std::string& name, std::uint64_t slots)
+        {
+            std::uint64_t h = hash(name);
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            return h % slots;
+        }
+
+        static std::int64_t now_us()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        void insert(shard& s, const player_profile& p, bool dirty)
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            insert_locked(s, p, dirty);
+        }
+
+        void insert_locked(shard& s, const player_profile& p, bool dirty)
+        {
+            auto it = s.index.find(p.name);
+            if (it != s.index.end())
+            {
+                s.lru.splice(s.lru.begin(), s.lru, it->second);
+                return;
+            }
+            s.lru.push_front(entry{p, dirty});
+            s.index[p.name] = s.lru.begin();
+            if (s.lru.size() > per_shard_)
+            {
+                entry& last = s.lru.back();
+                if (last.dirty)
+                    write(last.profile);
+                s.index.erase(last.profile.name);
+                s.lru.pop_back();
+            }
+        }
+
+        // slot layout: crc of the rest, used, name length, name, then the numbers
+        static void encode(const player_profile& p, char* slot)
+        {
+            std::memset(slot, 0, slot_size);
+            slot[4] = 1;
+            slot[5] = (char)std::min<std::size_t>(p.name.size(), max_name);
+            std::memcpy(slot + 8, p.name.data(), (unsigned char)slot[5]);
+            std::memcpy(slot + 56, &p.player, 4);
+            std::memcpy(slot + 64, &p.credits, 8);
+            std::memcpy(slot + 72, &p.hands, 8);
+            std::memcpy(slot + 80, &p.wins, 8);
+            std::memcpy(slot + 88, &p.net, 8);
+            std::memcpy(slot + 96, &p.created_us, 8);
+            std::memcpy(slot + 104, &p.seen_us, 8);
+            std::memcpy(slot + 112, &p.key, 8);
+            std::uint32_t crc = log_format::crc32(slot + 4, slot_size - 4);
+            std::memcpy(slot, &crc, 4);
+        }
+
+        static bool decode(const char* slot, player_profile& p)
+        {
+            std::uint32_t crc;
+            std::memcpy(&crc, slot, 4);
+            if (slot[4] != 1 || crc != log_format::crc32(slot + 4, slot_size - 4))
+                return false;
+            p.name.assign(slot + 8, (unsigned char)slot[5]);
+            std::memcpy(&p.player, slot + 56, 4);
+            std::memcpy(&p.credits, slot + 64, 8);
+            std::memcpy(&p.hands, slot + 72, 8);
+            std::memcpy(&p.wins, slot + 80, 8);
+            std::memcpy(&p.net, slot + 88, 8);
+            std::memcpy(&p.created_us, slot + 96, 8);
+            std::memcpy(&p.seen_us, slot + 104, 8);
+            std::memcpy(&p.key, slot + 112, 8);
+            return true;
+        }
+
+        // the slot holding name, or the free one where it would go, copied to found
+        // reads probe_slots slots at a time, a probe rarely needs a second read
+        // called with disk_mutex_ held, -1 when the table is full or can't be read
+        std::int64_t probe(int fd, std::uint64_t slots, const std::string& name, char* found)
+        {
+            std::size_t len = std::min<std::size_t>(name.size(), max_name);
+            std::uint64_t n = home(name, slots);
+            for (std::uint64_t seen = 0; seen < slots;)
+            {
+                std::uint64_t run = std::min<std::uint64_t>(probe_slots, slots - n);
+                ssize_t got = ::pread(fd, probe_, run * slot_size, (n + 1) * slot_size);
+                if (got < (ssize_t)slot_size)
+                    return -1;
+                for (std::uint64_t k = 0; k < (std::uint64_t)got / slot_size && seen < slots; ++k, ++seen)
+                {
+                    const char* slot = probe_ + k * slot_size;
+                    if (slot[4] != 1 || ((unsigned char)slot[5] == len && std::memcmp(slot + 8, name.data(), len) == 0))
+                    {
+                        std::memcpy(found, slot, slot_size);
+                        return n + k;
+                    }
+                }
+                n = (n + run) % slots;
+            }
+            return -1;
+        }
+
+        bool read(const std::string& name, player_profile& out)
+        {
+            std::lock_guard<std::mutex> lock(disk_mutex_);
+            char slot[slot_size];
+            return probe(fd_, slots_, name, slot) >= 0 && decode(slot, out);
+        }
+
+        // into the name's slot, or the first free one after it
+        void write(const player_profile& p)
+        {
+            std::lock_guard<std::mutex> lock(disk_mutex_);
+            if (used_ + 1 > slots_ * max_load)
+                grow();
+            place(fd_, slots_, p, true);
+        }
+
+        // called with disk_mutex_ held
+        void place(int fd, std::uint64_t slots, const player_profile& p, bool count)
+        {
+            char slot[slot_size];
+            std::int64_t n = probe(fd, slots, p.name, slot);
+            if (n < 0)
+                throw std::runtime_error("can't find a slot in " + path_);
+            bool taken = slot[4] == 1;
+            encode(p, slot);
+            if (::pwrite(fd, slot, slot_size, (n + 1) * slot_size) != slot_size)
+                throw std::runtime_error("can't write " + path_);
+            if (!taken && count)
+                used_++;
+        }
+
+        // everything into a file twice the size, swapped in with a rename
+        void grow()
+        {
+            std::uint64_t slots = slots_ * 2;
+            std::string tmp = path_ + ".grow";
+            int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0 || ::posix_fallocate(fd, 0, (slots + 1) * slot_size) != 0)
+                throw std::runtime_error("can't grow " + path_);
+            scan([this, fd, slots](const player_profile& p) { place(fd, slots, p, false); });
+            std::swap(fd, fd_);
+            slots_ = slots;
+            write_header();
+            ::fdatasync(fd_);
+            ::rename(tmp.c_str(), path_.c_str());
+            ::close(fd);
+        }
+
+        // called with disk_mutex_ held
+        void write_header()
+        {
+            char slot[slot_size] = {};
+            std::uint32_t m = magic, v = version;
+            std::memcpy(slot, &m, 4);
+            std::memcpy(slot + 4, &v, 4);
+            std::memcpy(slot + 8, &slots_, 8);
+            std::memcpy(slot + 16, &used_, 8);
+            std::memcpy(slot + 24, &max_player_, 4);
+            ::pwrite(fd_, slot, slot_size, 0);
+        }
+
+        void open()
+        {
+            fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd_ < 0)
+                throw std::runtime_error("can't open " + path_);
+            char slot[slot_size];
+            std::uint32_t m = 0, v = 0;
+            if (::pread(fd_, slot, slot_size, 0) == slot_size)
+            {
+                std::memcpy(&m, slot, 4);
+                std::memcpy(&v, slot + 4, 4);
+            }
+            if (m != magic)
+            {
+                slots_ = initial_slots;
+                if (::posix_fallocate(fd_, 0, (slots_ + 1) * slot_size) != 0)
+                    throw std::runtime_error("can't size " + path_);
+                write_header();
+                return;
+            }
+            if (v != version)
+                throw std::runtime_error(path_ + " has an unknown version");
+            std::memcpy(&slots_, slot + 8, 8);
+            // the header is only written on flush, count the slots in case we crashed before one
+            used_ = 0;
+            scan([this](const player_profile& p)
+                    {
+                    used_++;
+                    max_player_ = std::max(max_player_, p.player);
+                    });
+        }
+
+        // every profile in the file, read a block of slots at a time
+        template <typename F>
+        void scan(F f)
+        {
+            std::vector<char> block(scan_slots * slot_size);
+            player_profile p;
+            for (std::uint64_t n = 0; n < slots_; n += scan_slots)
+            {
+                std::uint64_t run = std::min<std::uint64_t>(scan_slots, slots_ - n);
+                ssize_t got = ::pread(fd_, block.data(), run * slot_size, (n + 1) * slot_size);
+                for (ssize_t k = 0; k + (ssize_t)slot_size <= got; k += slot_size)
+                    if (decode(block.data() + k, p))
+                        f(p);
+            }
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(flush_mutex_);
+            while (!stop_)
+            {
+                flush_cv_.wait_for(lock, std::chrono::milliseconds(flush_ms_));
+                if (stop_)
+                    break;
+                lock.unlock();
+                flush();
+                lock.lock();
+            }
+        }
+
+        std::string path_;
+        std::vector<shard> shards_;
+        std::size_t per_shard_;
+        int flush_ms_;
+        std::mutex disk_mutex_;
+        std::random_device random_; // keys for new names, under disk_mutex_
+        char probe_[probe_slots * slot_size];
+        int fd_ = -1;
+        std::uint64_t slots_ = 0;
+        std::uint64_t used_ = 0;
+        std::uint32_t max_player_ = 0;
+        std::atomic<std::uint64_t> hits_{0}, misses_{0};
+        std::mutex flush_mutex_;
+        std::condition_variable flush_cv_;
+        bool stop_ = false;
+        std::thread thread_;
+};
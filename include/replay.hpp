@@ -0,0 +1,100 @@
+#pragma once
+#include <string>
+#include "hand_log.hpp"
+#include "table_game.hpp"
+
+// deals a logged round again from its shoe seed and action stream
+// the table_game is the same one the server plays with, so a build that changed the
+// game shows up as rounds that no longer come out the way they were logged
+class round_replay
+{
+    public:
+        // one action the way the server carried it out, a bust stands the hand
+        static void apply(table_game& game, const hand_action& a)
+        {
+            switch (a.kind)
+            {
+                case hand_action_kind::play:
+                    game.play(a.seat);
+                    break;
+                case hand_action_kind::hit:
+                    if (game.hit(a.seat))
+                        game.stand(a.seat);
+                    break;
+                case hand_action_kind::split:
+                    if (game.split(a.seat))
+                        game.stand(a.seat);
+                    break;
+                case hand_action_kind::stand:
+                    game.stand(a.seat);
+                    break;
+                case hand_action_kind::leave:
+                    game.leave(a.seat);
+                    break;
+                case hand_action_kind::dealer:
+                    game.dealerPlay();
+                    break;
+            }
+        }
+
+        // deals the round up to where the record ends, on a game shuffled with the record's seed
+        static void deal(table_game& game, const hand_record& logged)
+        {
+            game.shuffle(logged.seed);
+            game.burn(logged.shoe_offset);
+            for (const hand_action& a : logged.actions)
+                apply(game, a);
+        }
+
+        // the round as this build plays it, same metadata and actions as the logged one
+        static hand_record run(const hand_record& logged)
+        {
+            table_game game;
+            deal(game, logged);
+
+            hand_record out = logged;
+            out.dealer = game.dealer.hand().inHand;
+            for (hand_seat& seat : out.seats)
+            {
+                seat.hands.clear();
+                auto cards = game.seats().find(seat.seat);
+                if (cards != game.seats().end())
+                    for (auto& hand : cards->second.hands())
+                        seat.hands.push_back(hand.inHand);
+                seat.payout = game.settle(seat.seat, seat.bet);
+            }
+            return out;
+        }
+
+        // empty when the replay matches, otherwise what differs first
+        static std::string diff(const hand_record& logged, const hand_record& replayed)
+        {
+            if (!same(logged.dealer, replayed.dealer))
+                return "dealer cards";
+            for (std::size_t i = 0; i < logged.seats.size(); ++i)
+            {
+                const hand_seat& a = logged.seats[i];
+                const hand_seat& b = replayed.seats[i];
+                std::string seat = "seat " + std::to_string(a.seat);
+                if (a.hands.size() != b.hands.size())
+                    return seat + " hand count";
+                for (std::size_t h = 0; h < a.hands.size(); ++h)
+                    if (!same(a.hands[h], b.hands[h]))
+                        return seat + " cards";
+                if (a.payout != b.payout)
+                    return seat + " payout " + std::to_string(a.payout) + " now " + std::to_string(b.payout);
+            }
+            return std::string();
+        }
+
+    private:
+        static bool same(const std::vector<Card>& a, const std::vector<Card>& b)
+        {
+            if (a.size() != b.size())
+                return false;
+            for (std::size_t i = 0; i < a.size(); ++i)
+                if (a[i].rank_ != b[i].rank_ || a[i].suit_ != b[i].suit_)
+                    return false;
+            return true;
+        }
+};
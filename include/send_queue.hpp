@@ -0,0 +1,201 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include "chat_message.hpp"
+#include "metrics.hpp"
+
+// what a session does once its outgoing queue is over the byte limit
+enum class overflow_policy
+{
+    resync,     // throw away everything queued and send one fresh table snapshot
+    coalesce,   // the new message replaces every queued message not yet on the wire that a later one makes up for
+    disconnect  // drop the client, it can't keep up with the table
+};
+
+struct queue_limits
+{
+    std::size_t max_bytes = 96 * sizeof(chat_message); // roughly 2MB per session
+    overflow_policy policy = overflow_policy::coalesce;
+};
+
+struct queue_stats
+{
+    std::size_t depth = 0;          // messages waiting, including the one being written
+    std::size_t bytes = 0;          // memory held by those messages
+    std::size_t high_water = 0;     // largest value bytes ever reached
+    std::uint64_t dropped = 0;      // messages thrown away by resync/coalesce
+    std::uint64_t overflows = 0;    // times the limit was hit
+
+    queue_stats& operator+=(const queue_stats& other)
+    {
+        depth += other.depth;
+        bytes += other.bytes;
+        if (other.high_water > high_water)
+            high_water = other.high_water;
+        dropped += other.dropped;
+        overflows += other.overflows;
+        return *this;
+    }
+};
+
+// outgoing messages of one session
+// the front message is the one async_write is working on and is never dropped. neither is what
+// no later message or snapshot repeats: a handshake with its seat and resume token, a shoe's
+// reveal with the next shoe's commitment, and the newest reject or notice to the player
+// only the session's thread changes the queue, stats() may be read from anywhere
+class send_queue
+{
+    public:
+        enum push_result
+        {
+            queued,
+            need_resync,    // pending messages were dropped, caller must push a snapshot
+            need_disconnect
+        };
+
+        explicit send_queue(const queue_limits& limits = queue_limits())
+            : limits_(limits)
+        {
+        }
+
+        ~send_queue()
+        {
+            clear();
+        }
+
+        push_result push(const chat_message& msg)
+        {
+            if ((msgs_.size() + 1) * sizeof(chat_message) > limits_.max_bytes && msgs_.size() > 1)
+            {
+                bump(overflows_, 1);
+                metrics::add(metrics::queue_overflows, 1);
+                switch (limits_.policy)
+                {
+                    case overflow_policy::disconnect:
+                        return need_disconnect;
+                    case overflow_policy::resync:
+                        drop_pending();
+                        return need_resync;
+                    case overflow_policy::coalesce:
+                        drop_pending();
+                        break;
+                }
+            }
+            add(msg);
+            return queued;
+        }
+
+        // a snapshot always gets in, it replaces whatever was pending
+        void push_snapshot(const chat_message& msg)
+        {
+            drop_pending();
+            add(msg);
+        }
+
+        bool empty() const
+        {
+            return msgs_.empty();
+        }
+
+        chat_message& front()
+        {
+            return msgs_.front();
+        }
+
+        void pop_front()
+        {
+            msgs_.pop_front();
+            publish();
+        }
+
+        void clear()
+        {
+            msgs_.clear();
+            publish();
+        }
+
+        queue_stats stats() const
+        {
+            queue_stats s;
+            s.depth = depth_.load(std::memory_order_relaxed);
+            s.bytes = bytes_.load(std::memory_order_relaxed);
+            s.high_water = high_water_.load(std::memory_order_relaxed);
+            s.dropped = dropped_.load(std::memory_order_relaxed);
+            s.overflows = overflows_.load(std::memory_order_relaxed);
+            return s;
+        }
+
+        const queue_limits& limits() const
+        {
+            return limits_;
+        }
+
+    private:
+        static bool unrepeated(const chat_message& msg)
+        {
+            return msg.ca.given_id != 0 || msg.ca.revealed;
+        }
+
+        // keeps the in-flight front message, the unrepeated ones and the newest notice, drops the rest
+        // only one notice is kept, a client sending rejected actions can't grow the queue with them
+        void drop_pending()
+        {
+            if (msgs_.size() <= 1)
+                return;
+            std::size_t notice = 0;
+            for (std::size_t i = 1; i < msgs_.size(); ++i)
+                if (msgs_[i].ca.notice)
+                    notice = i;
+            std::size_t kept = 1;
+            for (std::size_t i = 1; i < msgs_.size(); ++i)
+            {
+                if (!unrepeated(msgs_[i]) && i != notice)
+                    continue;
+                if (kept != i)
+                    msgs_[kept] = msgs_[i];
+                kept++;
+            }
+            std::size_t dropped = msgs_.size() - kept;
+            if (dropped == 0)
+                return;
+            bump(dropped_, dropped);
+            metrics::add(metrics::messages_dropped, dropped);
+            msgs_.erase(msgs_.begin() + kept, msgs_.end());
+            publish();
+        }
+
+        void add(const chat_message& msg)
+        {
+            msgs_.push_back(msg);
+            std::size_t bytes = publish();
+            if (bytes > high_water_.load(std::memory_order_relaxed))
+                high_water_.store(bytes, std::memory_order_relaxed);
+        }
+
+        // single writer, so plain stores are enough
+        // the server wide gauges move by the difference
+        std::size_t publish()
+        {
+            std::size_t bytes = msgs_.size() * sizeof(chat_message);
+            metrics::add(metrics::queued_messages, std::int64_t(msgs_.size()) - std::int64_t(depth_.load(std::memory_order_relaxed)));
+            metrics::add(metrics::queued_bytes, std::int64_t(bytes) - std::int64_t(bytes_.load(std::memory_order_relaxed)));
+            depth_.store(msgs_.size(), std::memory_order_relaxed);
+            bytes_.store(bytes, std::memory_order_relaxed);
+            return bytes;
+        }
+
+        static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        queue_limits limits_;
+        std::deque<chat_message> msgs_;
+        std::atomic<std::size_t> depth_{0};
+        std::atomic<std::size_t> bytes_{0};
+        std::atomic<std::size_t> high_water_{0};
+        std::atomic<std::uint64_t> dropped_{0};
+        std::atomic<std::uint64_t> overflows_{0};
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// SHA-256 (FIPS 180-4), enough of it to commit to shoes
+class sha256
+{
+    public:
+        enum { digest_size = 32, block_size = 64 };
+
+        sha256()
+        {
+            static const std::uint32_t init[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+            std::memcpy(h_, init, sizeof(h_));
+        }
+
+        void update(const void* data, std::size_t size)
+        {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            total_ += size;
+            if (used_ > 0)
+            {
+                std::size_t take = std::min<std::size_t>(size, block_size - used_);
+                std::memcpy(block_ + used_, p, take);
+                used_ += take;
+                p += take;
+                size -= take;
+                if (used_ < block_size)
+                    return;
+                compress(block_);
+                used_ = 0;
+            }
+            for (; size >= block_size; p += block_size, size -= block_size)
+                compress(p);
+            std::memcpy(block_, p, size);
+            used_ = size;
+        }
+
+        void finish(unsigned char out[digest_size])
+        {
+            std::uint64_t bits = total_ * 8;
+            unsigned char pad = 0x80;
+            update(&pad, 1);
+            pad = 0;
+            while (used_ != block_size - 8)
+                update(&pad, 1);
+            unsigned char length[8];
+            for (int i = 0; i < 8; ++i)
+                length[i] = bits >> (56 - 8 * i);
+            update(length, 8);
+            for (int i = 0; i < 8; ++i)
+                for (int k = 0; k < 4; ++k)
+                    out[4 * i + k] = h_[i] >> (24 - 8 * k);
+        }
+
+        static std::string hex(const unsigned char* digest, std::size_t size = digest_size)
+        {
+            static const char digits[] = "0123456789abcdef";
+            std::string out;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                out += digits[digest[i] >> 4];
+                out += digits[digest[i] & 15];
+            }
+            return out;
+        }
+
+    private:
+        static std::uint32_t rotr(std::uint32_t x, int n)
+        {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        void compress(const unsigned char* p)
+        {
+            static const std::uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+            std::uint32_t w[64];
+            for (int i = 0; i < 16; ++i)
+                w[i] = (std::uint32_t)p[4 * i] << 24 | (std::uint32_t)p[4 * i + 1] << 16
+                    | (std::uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+            for (int i = 16; i < 64; ++i)
+            {
+                std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            std::uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+            for (int i = 0; i < 64; ++i)
+            {
+                std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            h_[0] += a;
+            h_[1] += b;
+            h_[2] += c;
+            h_[3] += d;
+            h_[4] += e;
+            h_[5] += f;
+            h_[6] += g;
+            h_[7] += h;
+        }
+
+        std::uint32_t h_[8];
+        unsigned char block_[block_size];
+        std::size_t used_ = 0;
+        std::uint64_t total_ = 0;
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include "Deck.hpp"
+#include "sha256.hpp"
+#include "snapshot.hpp"
+
+// provably fair shoes
+//
+// before a shoe's first card the table publishes sha256(salt, seed, every card in the order
+// it will be dealt). once the shoe is done it reveals the seed and the salt, and anyone can
+// shuffle the seed again and check the hash. the salt is 256 random bits, without it the
+// 32 bit seed could be found from the commitment by trying them all.
+//
+// a shoe_maker thread works the commitments out ahead of time, a table that reshuffles
+// takes a finished one and only shuffles, the hashing never runs on a table's strand.
+
+struct shoe_secret
+{
+    enum { salt_size = 32 };
+
+    std::uint32_t seed = 0;
+    unsigned char salt[salt_size] = {};
+    unsigned char commitment[sha256::digest_size] = {};
+
+    // the hash a seed and salt commit to, over the shoe exactly as table_game::shuffle deals it
+    static void commit(std::uint32_t seed, const unsigned char* salt, unsigned char* out)
+    {
+        Deck d;
+        d.build();
+        d.shuffle(seed);
+        std::string cards;
+        cards.reserve(2 * d.cards_.size());
+        for (const Card& c : d.cards_)
+        {
+            cards += c.rank_;
+            cards += c.suit_;
+        }
+        unsigned char s[4] = { (unsigned char)seed, (unsigned char)(seed >> 8),
+            (unsigned char)(seed >> 16), (unsigned char)(seed >> 24) };
+        sha256 h;
+        h.update(salt, salt_size);
+        h.update(s, 4);
+        h.update(cards.data(), cards.size());
+        h.finish(out);
+    }
+
+    // a new shoe, seed and salt from the random device
+    static shoe_secret make(std::random_device& random)
+    {
+        shoe_secret s;
+        s.seed = random();
+        for (int i = 0; i < salt_size; i += 4)
+        {
+            std::uint32_t r = random();
+            std::memcpy(s.salt + i, &r, 4);
+        }
+        commit(s.seed, s.salt, s.commitment);
+        return s;
+    }
+
+    // true when seed and salt give the commitment
+    bool verify() const
+    {
+        unsigned char h[sha256::digest_size];
+        commit(seed, salt, h);
+        return std::memcmp(h, commitment, sizeof(h)) == 0;
+    }
+};
+
+// keeps ahead shoes ready for the tables
+class shoe_maker
+{
+    public:
+        explicit shoe_maker(std::size_t ahead = 64)
+            : ahead_(ahead)
+        {
+            thread_ = std::thread([this]() { run(); });
+        }
+
+        ~shoe_maker()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_one();
+            thread_.join();
+        }
+
+        // a finished shoe, made right here only if a burst of reshuffles emptied the queue
+        shoe_secret take()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!ready_.empty())
+                {
+                    shoe_secret s = ready_.front();
+                    ready_.pop_front();
+                    cv_.notify_one();
+                    return s;
+                }
+            }
+            std::random_device random;
+            return shoe_secret::make(random);
+        }
+
+    private:
+        void run()
+        {
+            std::random_device random;
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;)
+            {
+                cv_.wait(lock, [this]() { return stop_ || ready_.size() < ahead_; });
+                if (stop_)
+                    return;
+                lock.unlock();
+                shoe_secret s = shoe_secret::make(random);
+                lock.lock();
+                ready_.push_back(s);
+            }
+        }
+
+        std::size_t ahead_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<shoe_secret> ready_;
+        bool stop_ = false;
+        std::thread thread_;
+};
+
+// the shoe log, written next to the hand log: a commit when a shoe starts, a reveal when it ends
+// a reveal names its shoe by the commitment, so tables can come and go and restart
+struct shoe_record
+{
+    enum class kind_t : std::uint8_t { commit, reveal };
+
+    kind_t kind = kind_t::commit;
+    std::int32_t table = 0;
+    std::int64_t at_us = 0; // unix time
+    shoe_secret shoe;       // only the commitment in a commit
+    std::uint16_t dealt = 0; // cards dealt from the shoe, reveals only
+
+    std::string encode() const
+    {
+        std::string out;
+        snapshot_writer w(out);
+        w.put<std::uint8_t>(static_cast<std::uint8_t>(kind));
+        w.put<std::int32_t>(table);
+        w.put<std::int64_t>(at_us);
+        w.put_bytes(std::string((const char*)shoe.commitment, sizeof(shoe.commitment)));
+        if (kind == kind_t::reveal)
+        {
+            w.put<std::uint32_t>(shoe.seed);
+            w.put_bytes(std::string((const char*)shoe.salt, sizeof(shoe.salt)));
+            w.put<std::uint16_t>(dealt);
+        }
+        return out;
+    }
+
+    bool decode(const char* data, std::size_t size)
+    {
+        snapshot_reader r(data, size);
+        kind = static_cast<kind_t>(r.get<std::uint8_t>());
+        table = r.get<std::int32_t>();
+        at_us = r.get<std::int64_t>();
+        std::string commitment = r.get_bytes();
+        if (!r.ok() || commitment.size() != sizeof(shoe.commitment))
+            return false;
+        std::memcpy(shoe.commitment, commitment.data(), commitment.size());
+        if (kind == kind_t::reveal)
+        {
+            shoe.seed = r.get<std::uint32_t>();
+            std::string salt = r.get_bytes();
+            dealt = r.get<std::uint16_t>();
+            if (salt.size() != sizeof(shoe.salt))
+                return false;
+            std::memcpy(shoe.salt, salt.data(), salt.size());
+        }
+        return r.ok() && r.done();
+    }
+};
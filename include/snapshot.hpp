@@ -0,0 +1,214 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Card.hpp"
+
+// plain binary encoding for state that has to outlive the process
+// integers only, fixed width, little endian whatever the host is, no padding
+
+class snapshot_writer
+{
+    public:
+        explicit snapshot_writer(std::string& out)
+            : out_(out)
+        {
+        }
+
+        template <typename T>
+        void put(T value)
+        {
+            static_assert(std::is_integral<T>::value, "snapshots hold integers");
+            typename std::make_unsigned<T>::type bits = value;
+            char bytes[sizeof(T)];
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+                bytes[i] = char(std::uint64_t(bits) >> (8 * i));
+            out_.append(bytes, sizeof(T));
+        }
+
+        void put_bytes(const std::string& bytes)
+        {
+            put<std::uint32_t>(bytes.size());
+            out_.append(bytes);
+        }
+
+        void put_card(const Card& c)
+        {
+            put<char>(c.rank_);
+            put<char>(c.suit_);
+            put<std::int8_t>(c.value);
+        }
+
+    private:
+        std::string& out_;
+};
+
+class snapshot_reader
+{
+    public:
+        snapshot_reader(const char* data, std::size_t size)
+            : p_(data),
+            end_(data + size)
+        {
+        }
+
+        explicit snapshot_reader(const std::string& in)
+            : snapshot_reader(in.data(), in.size())
+        {
+        }
+
+        // a short buffer leaves ok() false and returns zeros from then on
+        template <typename T>
+        T get()
+        {
+            static_assert(std::is_integral<T>::value, "snapshots hold integers");
+            if (end_ - p_ < (std::ptrdiff_t)sizeof(T))
+            {
+                ok_ = false;
+                p_ = end_;
+                return T();
+            }
+            std::uint64_t bits = 0;
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+                bits |= std::uint64_t((unsigned char)p_[i]) << (8 * i);
+            p_ += sizeof(T);
+            return T(typename std::make_unsigned<T>::type(bits));
+        }
+
+        std::string get_bytes()
+        {
+            std::uint32_t n = get<std::uint32_t>();
+            if ((std::size_t)(end_ - p_) < n)
+            {
+                ok_ = false;
+                p_ = end_;
+                return std::string();
+            }
+            std::string bytes(p_, n);
+            p_ += n;
+            return bytes;
+        }
+
+        Card get_card()
+        {
+            Card c;
+            char rank = get<char>();
+            char suit = get<char>();
+            int value = get<std::int8_t>();
+            c.setInfo(value, rank, suit);
+            return c;
+        }
+
+        bool ok() const
+        {
+            return ok_;
+        }
+
+        bool done() const
+        {
+            return p_ == end_;
+        }
+
+        // bytes not read yet
+        std::size_t left() const
+        {
+            return end_ - p_;
+        }
+
+        void skip(std::size_t n)
+        {
+            if (left() < n)
+            {
+                ok_ = false;
+                n = left();
+            }
+            p_ += n;
+        }
+
+    private:
+        const char* p_;
+        const char* end_;
+        bool ok_ = true;
+};
+
+struct seat_snapshot
+{
+    int seat = 0;
+    int credits = 0;
+    std::uint32_t player = 0;
+    int bet = 0;
+    std::uint64_t token = 0; // resume token, the player can still come back with it
+    bool waiting = false; // sat down during a round, plays the next one
+    std::string name; // empty unless the server keeps a profile for them
+};
+
+// a table: the shoe as it stands, who sits where and the round being played
+// the round is its hand-history record so far, dealing it again from the seed gives the cards
+struct table_snapshot
+{
+    int id = 0;
+    int stake = 0;
+    std::uint32_t seed = 0; // of the shoe, for the hand history
+    std::vector<seat_snapshot> seats;
+    int dealt = 0; // cards gone from the shoe
+    std::uint32_t rounds = 0; // rounds finished at this table
+    bool inplay = false;
+    int turn = 0;
+    std::string round; // encoded hand_record, only while inplay
+    std::string salt;  // the shoe's commitment salt, see shoe_commit.hpp
+
+    std::string encode() const
+    {
+        std::string out;
+        snapshot_writer w(out);
+        w.put<std::int32_t>(id);
+        w.put<std::int32_t>(stake);
+        w.put<std::uint32_t>(seed);
+        w.put_bytes(salt);
+        w.put<std::uint16_t>(dealt);
+        w.put<std::uint32_t>(rounds);
+        w.put<std::uint8_t>(inplay);
+        w.put<std::int8_t>(turn);
+        w.put_bytes(round);
+        w.put<std::uint8_t>(seats.size());
+        for (const seat_snapshot& s : seats)
+        {
+            w.put<std::int8_t>(s.seat);
+            w.put<std::int32_t>(s.credits);
+            w.put<std::uint32_t>(s.player);
+            w.put<std::int32_t>(s.bet);
+            w.put<std::uint64_t>(s.token);
+            w.put<std::uint8_t>(s.waiting);
+            w.put_bytes(s.name);
+        }
+        return out;
+    }
+
+    bool decode(const std::string& in)
+    {
+        snapshot_reader r(in);
+        id = r.get<std::int32_t>();
+        stake = r.get<std::int32_t>();
+        seed = r.get<std::uint32_t>();
+        salt = r.get_bytes();
+        dealt = r.get<std::uint16_t>();
+        rounds = r.get<std::uint32_t>();
+        inplay = r.get<std::uint8_t>();
+        turn = r.get<std::int8_t>();
+        round = r.get_bytes();
+        seats.resize(r.get<std::uint8_t>());
+        for (seat_snapshot& s : seats)
+        {
+            s.seat = r.get<std::int8_t>();
+            s.credits = r.get<std::int32_t>();
+            s.player = r.get<std::uint32_t>();
+            s.bet = r.get<std::int32_t>();
+            s.token = r.get<std::uint64_t>();
+            s.waiting = r.get<std::uint8_t>();
+            s.name = r.get_bytes();
+        }
+        return r.ok() && r.done();
+    }
+};
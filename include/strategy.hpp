@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "table_game.hpp"
+
+// how the headless players decide, shared by the load generator and the simulator
+// stand always stands, dealer hits below 17, basic hits below 12 and below 17 against a dealer 7 or better
+enum class strategy { stand, dealer, basic };
+
+inline bool parse_strategy(const std::string& name, strategy& out)
+{
+    if (name == "stand")
+        out = strategy::stand;
+    else if (name == "dealer")
+        out = strategy::dealer;
+    else if (name == "basic")
+        out = strategy::basic;
+    else
+        return false;
+    return true;
+}
+
+// up is the dealer's face up card value, 11 for an ace
+inline bool should_hit(strategy s, const std::vector<Card>& hand, int up)
+{
+    if (hand.empty())
+        return false;
+    int total = handTotal(hand);
+    switch (s)
+    {
+        case strategy::stand:
+            return false;
+        case strategy::dealer:
+            return total < 17;
+        case strategy::basic:
+            return total < 12 || (total < 17 && up >= 7);
+    }
+    return false;
+}
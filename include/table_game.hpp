@@ -0,0 +1,333 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Deck.hpp"
+#include "Hand.hpp"
+
+// the cards side of a table, without any networking
+// the server and the replay engine both drive it, so a round replays card for card
+
+// one seat's hands, more than one after a split
+class seat_hands
+{
+    public:
+        enum { max_hands = 4 };
+
+        void pHand(Card t)
+        {
+            getCurrentHand().addCard(t);
+        }
+
+        std::string printHand(int id)
+        {
+            std::string result = "";
+            int i = 0;
+            for(auto hand : playerHand)
+            {
+                result += hand.printAllHand(id);
+                result += "hand: " + std::to_string(i++) + "\n";
+            }
+            return result;
+        }
+
+        Hand& getCurrentHand()
+        {
+            if (playerHand.size() == 0)
+            {
+                Hand h;
+                playerHand.push_back(h);
+            }
+            return playerHand[currentHand];
+        }
+
+        //TODO check why it works only sometimes
+        //FIXME hand.hpp only checks if ace in hand,
+        //if yes -10, and sets ace.value = 1,
+        //but this cannot work for reference...
+        bool checkBust()
+        {
+            return getCurrentHand().isBust();
+        }
+
+        bool setNextHand()
+        {
+            if(currentHand + 1 < (int)playerHand.size())
+            {
+                currentHand++;
+                return true;
+            }
+            else
+                return false;
+        }
+
+        void split(Deck& d)
+        {
+            if(checkSplit())
+            {
+                Hand h;
+                playerHand.insert(playerHand.begin()+currentHand+1, h);
+                Card temp;
+                temp = d.getCard();
+                Card c = getCurrentHand().split();
+                pHand(temp);
+                temp = d.getCard();
+                playerHand[currentHand+1].addCard(c);
+                playerHand[currentHand+1].addCard(temp);
+            }
+        }
+
+        // a pair, and the seat hasn't split into max_hands yet
+        bool checkSplit()
+        {
+            return playerHand.size() < max_hands && getCurrentHand().canSplit();
+        }
+
+        const std::vector<Hand>& hands() const
+        {
+            return playerHand;
+        }
+
+    private:
+        int currentHand = 0;
+        std::vector<Hand> playerHand;
+};
+
+class Dealer
+{
+    public:
+        Dealer() {}
+        ~Dealer() {}
+        std::string printHand()
+        {
+            std::string result;
+            result = playerHand.printAllHand(id);
+            if(reveal == false)
+            {
+                std::stringstream ss(result);
+                std::string s = "";
+                std::string token = "";
+                std::getline(ss, s); //line with <-- Player 0...
+                s += "\n";
+                std::getline(ss, token); //line with first card
+                s += token;
+                s += "\n";
+                s += "B ACK2\n"; //give back of card
+                result = s;
+            }
+            return result;
+        }
+
+        void pHand(Card t)
+        {
+            playerHand.addCard(t);
+        }
+
+        void clearHand()
+        {
+            playerHand = Hand();
+            reveal = false;
+        }
+
+        void deal(Deck& d)
+        {
+            while(playerHand.getTotal() < 17)
+            {
+                Card temp;
+                temp = d.getCard();
+                pHand(temp);
+            }
+        }
+
+        const Hand& hand() const
+        {
+            return playerHand;
+        }
+
+        int id = 0;
+        bool reveal = false;
+    private:
+        Hand playerHand;
+};
+
+// best total of a hand, aces count 1 where 11 would bust
+inline int handTotal(const std::vector<Card>& cards)
+{
+    int total = 0, aces = 0;
+    for (auto card : cards)
+    {
+        total += card.value;
+        if (card.value == 11)
+            aces++;
+    }
+    while (total > 21 && aces-- > 0)
+        total -= 10;
+    return total;
+}
+
+// what one hand wins against the dealer, blackjack pays 3 to 2
+inline int payout(const std::vector<Card>& hand, const std::vector<Card>& dealer, int bet, bool only_hand)
+{
+    int player = handTotal(hand);
+    int house = handTotal(dealer);
+    bool blackjack = only_hand && hand.size() == 2 && player == 21;
+    bool house_blackjack = dealer.size() == 2 && house == 21;
+    if (player > 21)
+        return -bet;
+    if (blackjack && !house_blackjack)
+        return bet * 3 / 2;
+    if (house_blackjack && !blackjack)
+        return -bet;
+    if (house > 21 || player > house)
+        return bet;
+    if (player == house)
+        return 0;
+    return -bet;
+}
+
+// shoe, dealer and every seat's hands for one round at a time
+class table_game
+{
+    public:
+        enum { shoe_cards = 312 };
+
+        // a fresh six deck shoe in the order the seed gives
+        void shuffle(std::uint32_t seed)
+        {
+            d.cards_.clear();
+            d.build();
+            d.shuffle(seed);
+            seed_ = seed;
+        }
+
+        std::uint32_t seed() const
+        {
+            return seed_;
+        }
+
+        Deck& deck()
+        {
+            return d;
+        }
+
+        // cards gone from the shoe since it was shuffled
+        int dealt()
+        {
+            return (d.refilled() ? 2 * shoe_cards : shoe_cards) - d.cardsLeft();
+        }
+
+        void burn(int cards)
+        {
+            while (cards-- > 0)
+                d.getCard();
+        }
+
+        // a seat asks in: the dealer gets two cards with the first one, the seat always gets two
+        void play(int seat)
+        {
+            if (!deal_)
+            {
+                dealer.pHand(d.getCard());
+                dealer.pHand(d.getCard());
+                deal_ = true;
+            }
+            seats_[seat].pHand(d.getCard());
+            seats_[seat].pHand(d.getCard());
+        }
+
+        // true when the hand went bust
+        bool hit(int seat)
+        {
+            seats_[seat].pHand(d.getCard());
+            return seats_[seat].checkBust();
+        }
+
+        bool split(int seat)
+        {
+            seats_[seat].split(d);
+            return seats_[seat].checkBust();
+        }
+
+        bool canSplit(int seat)
+        {
+            auto it = seats_.find(seat);
+            return it != seats_.end() && it->second.checkSplit();
+        }
+
+        // true when the seat moved on to its next split hand
+        bool stand(int seat)
+        {
+            return seats_[seat].setNextHand();
+        }
+
+        void leave(int seat)
+        {
+            seats_.erase(seat);
+        }
+
+        // everyone is done, the dealer turns the hole card and draws to 17
+        void dealerPlay()
+        {
+            dealer.reveal = true;
+            dealer.deal(d);
+        }
+
+        // net win or loss of all a seat's hands against the dealer
+        int settle(int seat, int bet) const
+        {
+            auto it = seats_.find(seat);
+            if (it == seats_.end())
+                return 0;
+            const std::vector<Hand>& hands = it->second.hands();
+            int net = 0;
+            for (auto& hand : hands)
+                net += payout(hand.inHand, dealer.hand().inHand, bet, hands.size() == 1);
+            return net;
+        }
+
+        std::string printSeat(int seat)
+        {
+            auto it = seats_.find(seat);
+            return it == seats_.end() ? std::string() : it->second.printHand(seat);
+        }
+
+        // every seat's cards in the order given, then the dealer's, the text a table sends its players
+        // seat_of turns whatever the table keeps its seats as into the seat number
+        template <typename Seats, typename SeatOf>
+        std::string printTable(const Seats& seats, SeatOf seat_of)
+        {
+            std::string result;
+            for (auto& s : seats)
+                result += printSeat(seat_of(s));
+            result += dealer.printHand();
+            return result;
+        }
+
+        const std::map<int, seat_hands>& seats() const
+        {
+            return seats_;
+        }
+
+        // start of a new round
+        void clear()
+        {
+            seats_.clear();
+            dealer.clearHand();
+            deal_ = false;
+        }
+
+        bool dealing() const
+        {
+            return deal_;
+        }
+
+        Dealer dealer;
+
+    private:
+        Deck d;
+        std::uint32_t seed_ = 0;
+        bool deal_ = false;
+        std::map<int, seat_hands> seats_;
+};
@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_writer.hpp"
+#include "snapshot.hpp"
+
+// crash snapshots of every table, so a restarted server picks up rounds where they were
+//
+// tables hand in their encoded state from their own strand, only when something changed.
+// the store keeps the latest encoding of each table behind a shared_ptr, so taking a
+// snapshot copies pointers under the lock and never the tables. a background thread writes
+// all of them as one "tables-<n>.snap" file, at most once per interval, with a crc trailer
+// and the usual tmp + rename, so a crash leaves either the old file or the new one.
+
+class table_store
+{
+    public:
+        typedef std::shared_ptr<const std::string> state_ptr;
+
+        explicit table_store(const std::string& dir, int interval_ms = 1000)
+            : dir_(dir),
+            interval_ms_(interval_ms)
+        {
+            ::mkdir(dir_.c_str(), 0755);
+            std::vector<std::pair<std::uint64_t, std::string>> files = snapshots();
+            if (!files.empty())
+                epoch_ = files.back().first + 1;
+            thread_ = std::thread([this]() { run(); });
+        }
+
+        ~table_store()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_one();
+            thread_.join();
+        }
+
+        // the latest state of one table
+        void put(int table, state_ptr state)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tables_[table] = state;
+            changed_ = true;
+            cv_.notify_one();
+        }
+
+        // tables that are gone drop out of the next snapshot
+        void retain(const std::set<int>& ids)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = tables_.begin(); it != tables_.end();)
+            {
+                if (ids.count(it->first) == 0)
+                {
+                    it = tables_.erase(it);
+                    changed_ = true;
+                }
+                else
+                    ++it;
+            }
+            if (changed_)
+                cv_.notify_one();
+        }
+
+        // every table in the newest snapshot that reads back whole
+        std::vector<table_snapshot> load()
+        {
+            std::vector<table_snapshot> result;
+            std::vector<std::pair<std::uint64_t, std::string>> files = snapshots();
+            for (auto it = files.rbegin(); it != files.rend(); ++it)
+            {
+                if (load_file(it->second, result))
+                    break;
+                result.clear();
+            }
+            return result;
+        }
+
+        std::uint64_t written() const
+        {
+            return written_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        enum { magic = 0x53544c42, version = 1 };
+
+        std::vector<std::pair<std::uint64_t, std::string>> snapshots()
+        {
+            std::vector<std::pair<std::uint64_t, std::string>> result;
+            DIR* d = ::opendir(dir_.c_str());
+            if (!d)
+                return result;
+            while (dirent* e = ::readdir(d))
+            {
+                std::string name = e->d_name;
+                if (name.size() > 12 && name.compare(0, 7, "tables-") == 0
+                        && name.compare(name.size() - 5, 5, ".snap") == 0)
+                    result.push_back(std::make_pair(std::strtoull(name.c_str() + 7, nullptr, 10),
+                                dir_ + "/" + name));
+            }
+            ::closedir(d);
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+
+        static bool load_file(const std::string& path, std::vector<table_snapshot>& out)
+        {
+            std::string data;
+            if (!log_format::read_file(path, data) || data.size() < 4)
+                return false;
+            std::uint32_t crc = snapshot_reader(data.data() + data.size() - 4, 4).get<std::uint32_t>();
+            if (log_format::crc32(data.data(), data.size() - 4) != crc)
+                return false;
+            snapshot_reader r(data.data(), data.size() - 4);
+            if (r.get<std::uint32_t>() != magic || r.get<std::uint32_t>() != version)
+                return false;
+            r.get<std::uint64_t>(); // epoch
+            r.get<std::int64_t>();  // taken at
+            std::uint32_t n = r.get<std::uint32_t>();
+            out.reserve(n);
+            for (std::uint32_t i = 0; i < n && r.ok(); ++i)
+            {
+                table_snapshot s;
+                if (!s.decode(r.get_bytes()))
+                    return false;
+                out.push_back(std::move(s));
+            }
+            return r.ok() && r.done();
+        }
+
+        // the writer thread, holds the lock only to copy the table pointers
+        void run()
+        {
+            auto last = std::chrono::steady_clock::now() - std::chrono::milliseconds(interval_ms_);
+            for (;;)
+            {
+                std::vector<std::pair<int, state_ptr>> copy;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this]() { return stop_ || changed_; });
+                    if (stop_)
+                        return;
+                    auto next = last + std::chrono::milliseconds(interval_ms_);
+                    if (cv_.wait_until(lock, next, [this]() { return stop_; }))
+                        return;
+                    copy.assign(tables_.begin(), tables_.end());
+                    changed_ = false;
+                }
+                last = std::chrono::steady_clock::now();
+
+                std::string out;
+                snapshot_writer w(out);
+                w.put<std::uint32_t>(magic);
+                w.put<std::uint32_t>(version);
+                w.put<std::uint64_t>(epoch_);
+                w.put<std::int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count());
+                w.put<std::uint32_t>(copy.size());
+                for (auto& t : copy)
+                    w.put_bytes(*t.second);
+                w.put<std::uint32_t>(log_format::crc32(out.data(), out.size()));
+
+                char name[48];
+                std::snprintf(name, sizeof(name), "/tables-%020llu.snap", (unsigned long long)epoch_);
+                if (log_format::write_file(dir_ + name, out))
+                {
+                    for (auto& old : snapshots())
+                        if (old.first < epoch_)
+                            ::unlink(old.second.c_str());
+                    epoch_++;
+                    written_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        std::string dir_;
+        int interval_ms_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::map<int, state_ptr> tables_;
+        bool changed_ = false;
+        bool stop_ = false;
+        std::uint64_t epoch_ = 0;
+        std::atomic<std::uint64_t> written_{0};
+        std::thread thread_;
+};
@@ -0,0 +1,174 @@
+#pragma once
+#include <time.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// what a table costs the process: cpu time, handlers run and heap used on its strand
+//
+// the strand runs one handler at a time, so the counters are only ever written by the
+// thread running the table at that moment, with relaxed stores; anyone may read them.
+// allocations are charged to the table whose handler is running on the allocating thread.
+
+struct table_usage
+{
+    std::atomic<std::int64_t> cpu_ns{0};
+    std::atomic<std::int64_t> handlers{0};
+    std::atomic<std::int64_t> allocations{0};
+    std::atomic<std::int64_t> allocated_bytes{0};
+
+    static void bump(std::atomic<std::int64_t>& c, std::int64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // the table the calling thread is running a handler for, null outside one
+    static table_usage*& current()
+    {
+        static thread_local table_usage* running = nullptr;
+        return running;
+    }
+
+    // from operator new, has to stay allocation free
+    static void charge(std::size_t bytes)
+    {
+        if (table_usage* u = current())
+        {
+            bump(u->allocations, 1);
+            bump(u->allocated_bytes, bytes);
+        }
+    }
+
+    static std::int64_t thread_cpu_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return std::int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+};
+
+// one handler's run, charged to its table
+// a handler dispatched inline from one of the same table's is already being charged
+class usage_scope
+{
+    public:
+        explicit usage_scope(table_usage* usage)
+            : usage_(usage),
+            outer_(table_usage::current())
+        {
+            if (usage_ == outer_)
+                return;
+            table_usage::current() = usage_;
+            start_ns_ = table_usage::thread_cpu_ns();
+        }
+
+        ~usage_scope()
+        {
+            if (usage_ == outer_)
+                return;
+            table_usage::bump(usage_->cpu_ns, table_usage::thread_cpu_ns() - start_ns_);
+            table_usage::bump(usage_->handlers, 1);
+            table_usage::current() = outer_;
+        }
+
+    private:
+        table_usage* usage_;
+        table_usage* outer_;
+        std::int64_t start_ns_ = 0;
+};
+
+// an executor that runs everything through Executor (a table's strand) inside a usage_scope
+// asio takes it wherever it takes the strand: post, dispatch, bind_executor
+// every handler shares the counters, a handler may drop the last reference to its table and
+// still be charged once it returns
+template <typename Executor>
+class accounted_executor
+{
+    public:
+        accounted_executor(const Executor& inner, std::shared_ptr<table_usage> usage)
+            : inner_(inner),
+            usage_(std::move(usage))
+        {
+        }
+
+        auto context() const noexcept -> decltype(std::declval<const Executor&>().context())
+        {
+            return inner_.context();
+        }
+
+        void on_work_started() const noexcept
+        {
+            inner_.on_work_started();
+        }
+
+        void on_work_finished() const noexcept
+        {
+            inner_.on_work_finished();
+        }
+
+        template <typename Function, typename Allocator>
+        void dispatch(Function&& f, const Allocator& a) const
+        {
+            inner_.dispatch(wrap(std::forward<Function>(f)), a);
+        }
+
+        template <typename Function, typename Allocator>
+        void post(Function&& f, const Allocator& a) const
+        {
+            inner_.post(wrap(std::forward<Function>(f)), a);
+        }
+
+        template <typename Function, typename Allocator>
+        void defer(Function&& f, const Allocator& a) const
+        {
+            inner_.defer(wrap(std::forward<Function>(f)), a);
+        }
+
+        bool running_in_this_thread() const noexcept
+        {
+            return inner_.running_in_this_thread();
+        }
+
+        friend bool operator==(const accounted_executor& a, const accounted_executor& b) noexcept
+        {
+            return a.inner_ == b.inner_ && a.usage_ == b.usage_;
+        }
+
+        friend bool operator!=(const accounted_executor& a, const accounted_executor& b) noexcept
+        {
+            return !(a == b);
+        }
+
+    private:
+        template <typename Function>
+        class handler
+        {
+            public:
+                handler(Function f, std::shared_ptr<table_usage> usage)
+                    : f_(std::move(f)),
+                    usage_(std::move(usage))
+                {
+                }
+
+                void operator()()
+                {
+                    usage_scope scope(usage_.get());
+                    f_();
+                }
+
+            private:
+                Function f_;
+                std::shared_ptr<table_usage> usage_;
+        };
+
+        template <typename Function>
+        handler<typename std::decay<Function>::type> wrap(Function&& f) const
+        {
+            return handler<typename std::decay<Function>::type>(std::forward<Function>(f), usage_);
+        }
+
+        Executor inner_;
+        std::shared_ptr<table_usage> usage_;
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "latency.hpp"
+
+// spans around the stages of a round, written out as Chrome trace event JSON
+// (chrome://tracing or ui.perfetto.dev open it)
+//
+// off unless enable() was called, then a span costs one relaxed load and nothing else.
+// when on every thread keeps the last events_per_thread spans in a ring of its own, behind a
+// mutex only a dump ever contends for. names have to be string literals, they are kept as pointers.
+
+namespace trace
+{
+    struct event
+    {
+        const char* name;
+        std::int64_t start_ns;
+        std::int64_t duration_ns;
+        int table;
+        int seat;
+    };
+
+    class recorder
+    {
+        public:
+            enum { events_per_thread = 65536 };
+
+            static recorder& instance()
+            {
+                static recorder r;
+                return r;
+            }
+
+            void enable()
+            {
+                start_ns_ = latency::now_ns();
+                enabled_.store(true, std::memory_order_release);
+            }
+
+            bool enabled() const
+            {
+                return enabled_.load(std::memory_order_relaxed);
+            }
+
+            void add(const event& e)
+            {
+                thread_local ring* mine = nullptr;
+                if (!mine)
+                    mine = attach();
+                std::lock_guard<std::mutex> lock(mine->mutex);
+                mine->events[mine->next++ % events_per_thread] = e;
+            }
+
+            // everything still in the rings, as one JSON document
+            std::string dump() const
+            {
+                std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+                char line[256];
+                bool first = true;
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (std::size_t t = 0; t < threads_.size(); ++t)
+                {
+                    std::snprintf(line, sizeof(line),
+                            "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"io %zu\"}}",
+                            first ? "" : ",", t, t);
+                    out += line;
+                    first = false;
+
+                    ring& r = *threads_[t];
+                    std::lock_guard<std::mutex> ring_lock(r.mutex);
+                    std::uint64_t from = r.next > events_per_thread ? r.next - events_per_thread : 0;
+                    for (std::uint64_t i = from; i < r.next; ++i)
+                    {
+                        const event& e = r.events[i % events_per_thread];
+                        std::snprintf(line, sizeof(line),
+                                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                                "\"args\":{\"table\":%d,\"seat\":%d}}",
+                                e.name, t, (e.start_ns - start_ns_) / 1000.0, e.duration_ns / 1000.0, e.table, e.seat);
+                        out += line;
+                    }
+                }
+                out += "\n]}\n";
+                return out;
+            }
+
+        private:
+            struct ring
+            {
+                std::mutex mutex;
+                std::vector<event> events;
+                std::uint64_t next = 0;
+
+                ring()
+                    : events(events_per_thread)
+                {
+                }
+            };
+
+            // a thread's ring outlives it, its spans still show up
+            ring* attach()
+            {
+                std::unique_ptr<ring> r(new ring);
+                std::lock_guard<std::mutex> lock(mutex_);
+                threads_.push_back(std::move(r));
+                return threads_.back().get();
+            }
+
+            std::atomic<bool> enabled_{false};
+            std::int64_t start_ns_ = 0;
+            mutable std::mutex mutex_;
+            std::vector<std::unique_ptr<ring>> threads_;
+    };
+
+    inline bool enabled()
+    {
+        return recorder::instance().enabled();
+    }
+
+    // a span that began at start_ns and ends now, for work that isn't one scope (an async write)
+    inline void complete(const char* name, std::int64_t start_ns, int table = -1, int seat = -1)
+    {
+        if (start_ns && enabled())
+            recorder::instance().add(event{ name, start_ns, latency::now_ns() - start_ns, table, seat });
+    }
+
+    // the rest of the scope is one span
+    class span
+    {
+        public:
+            span(const char* name, int table = -1, int seat = -1)
+                : name_(name),
+                start_ns_(enabled() ? latency::now_ns() : 0),
+                table_(table),
+                seat_(seat)
+            {
+            }
+
+            ~span()
+            {
+                complete(name_, start_ns_, table_, seat_);
+            }
+
+            // for spans that only learn their seat on the way
+            void seat(int seat)
+            {
+                seat_ = seat;
+            }
+
+        private:
+            const char* name_;
+            std::int64_t start_ns_;
+            int table_;
+            int seat_;
+    };
+}
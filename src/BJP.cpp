@@ -15,10 +15,10 @@ void BJP::set_player_name(string p_name)
 }
 int BJP::get_chips()
 {
-
+    return chips;
 }
 void BJP::set_chips(int chip){
-
+    chips = chip;
 }
 Hand BJP::currentHand()
 {
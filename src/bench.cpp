@@ -0,0 +1,444 @@
+//
+// bench.cpp
+// ~~~~~~~~~
+//
+// microbenchmarks for the cards, hands and messages every action goes through
+//
+//   bench [-f <filter>] [-r <repetitions>] [-b <baseline file>] [-s <baseline file>] [-t <percent>] [-j]
+//
+// every benchmark is sized to run about 5 ms per sample, warmed up for 3 samples, then
+// sampled -r times (15 unless given). ns/op is the median sample, +- the median absolute
+// deviation of the samples. allocs/op counts calls to operator new.
+// -s writes the results as a baseline, -b compares against one: a benchmark more than
+// -t percent (10 unless given) and more than its noise slower, or one that allocates more,
+// is a regression and bench exits with 2. -f runs only names containing the filter.
+// -j prints <name>.ns and <name>.allocs as JSON, the table goes to stderr.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../include/Deck.hpp"
+#include "../include/Hand.hpp"
+#include "../include/table_game.hpp"
+#include "../include/chat_message.hpp"
+#include "../include/flat_json.hpp"
+
+// the benchmarks run on one thread, a plain counter will do
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    allocations++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+// keeps the compiler from dropping work whose result nobody looks at
+template <typename T>
+static void keep(T&& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// a benchmark's clock, setup between operations can be left out with pause() and resume()
+class bench_timer
+{
+    public:
+        void start()
+        {
+            paused_ = std::chrono::nanoseconds(0);
+            paused_allocations_ = 0;
+            allocations_ = allocations;
+            start_ = std::chrono::steady_clock::now();
+        }
+
+        void pause()
+        {
+            pause_allocations_ = allocations;
+            pause_ = std::chrono::steady_clock::now();
+        }
+
+        void resume()
+        {
+            paused_ += std::chrono::steady_clock::now() - pause_;
+            paused_allocations_ += allocations - pause_allocations_;
+        }
+
+        double stop(std::size_t* allocs)
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start_ - paused_;
+            *allocs = allocations - allocations_ - paused_allocations_;
+            return std::chrono::duration<double, std::nano>(elapsed).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point start_, pause_;
+        std::chrono::steady_clock::duration paused_;
+        std::size_t allocations_ = 0, pause_allocations_ = 0, paused_allocations_ = 0;
+};
+
+// runs the operation n times
+typedef std::function<void(std::size_t n, bench_timer& t)> bench_body;
+
+struct benchmark
+{
+    std::string name;
+    bench_body body;
+};
+
+struct result
+{
+    double ns = 0;      // median ns/op
+    double noise = 0;   // median absolute deviation, ns/op
+    double allocs = 0;  // allocs/op
+};
+
+static result run(const benchmark& b, int repetitions)
+{
+    bench_timer t;
+    std::size_t allocs = 0;
+
+    // grow n until a sample is long enough to time, then size it to about 5 ms
+    std::size_t n = 1;
+    double ns = 0;
+    for (;;)
+    {
+        t.start();
+        b.body(n, t);
+        ns = t.stop(&allocs);
+        if (ns > 1e6 || n >= (std::size_t(1) << 30))
+            break;
+        n *= ns < 1e4 ? 10 : 2;
+    }
+    n = std::max<std::size_t>(1, n * 5e6 / std::max(ns, 1.0));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        t.start();
+        b.body(n, t);
+        t.stop(&allocs);
+    }
+
+    std::vector<double> samples;
+    std::size_t total_allocs = 0;
+    for (int i = 0; i < repetitions; ++i)
+    {
+        t.start();
+        b.body(n, t);
+        samples.push_back(t.stop(&allocs) / n);
+        total_allocs += allocs;
+    }
+
+    result r;
+    std::sort(samples.begin(), samples.end());
+    r.ns = samples[samples.size() / 2];
+    std::vector<double> deviations;
+    for (double s : samples)
+        deviations.push_back(std::fabs(s - r.ns));
+    std::sort(deviations.begin(), deviations.end());
+    r.noise = deviations[deviations.size() / 2];
+    r.allocs = double(total_allocs) / (double(n) * repetitions);
+    return r;
+}
+
+static Card card(int value, char rank, char suit)
+{
+    Card c;
+    c.setInfo(value, rank, suit);
+    return c;
+}
+
+static std::vector<benchmark> benchmarks()
+{
+    std::vector<benchmark> all;
+
+    all.push_back({ "Deck::build", [](std::size_t n, bench_timer& t)
+            {
+            Deck d;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                d.cards_.clear();
+                d.build();
+                keep(d.cards_);
+            }
+            } });
+
+    all.push_back({ "Deck::shuffle", [](std::size_t n, bench_timer& t)
+            {
+            t.pause();
+            Deck d;
+            d.build();
+            t.resume();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                d.shuffle(std::uint32_t(i));
+                keep(d.cards_);
+            }
+            } });
+
+    // a whole shoe is dealt between refills, the refill isn't timed
+    all.push_back({ "Deck::getCard", [](std::size_t n, bench_timer& t)
+            {
+            t.pause();
+            Deck shoe;
+            shoe.build();
+            shoe.shuffle(1);
+            Deck d;
+            t.resume();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (d.deck_is_empty())
+                {
+                    t.pause();
+                    d.cards_ = shoe.cards_;
+                    t.resume();
+                }
+                Card c = d.getCard();
+                keep(c);
+            }
+            } });
+
+    // five cards to a hand, then the hand starts over without giving its memory back
+    all.push_back({ "Hand::addCard", [](std::size_t n, bench_timer& t)
+            {
+            const Card cards[5] = { card(2, '2', 'S'), card(3, '3', 'H'), card(11, 'A', 'C'),
+                card(4, '4', 'D'), card(10, 'K', 'S') };
+            Hand h;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (i % 5 == 0)
+                {
+                    h.inHand.clear();
+                    h.handValue = 0;
+                    h.count = 0;
+                }
+                h.addCard(cards[i % 5]);
+                keep(h);
+            }
+            } });
+
+    // a hand at 21 with an ace, the ace check runs but never takes the 10 off
+    all.push_back({ "Hand::getTotal", [](std::size_t n, bench_timer& t)
+            {
+            Hand h;
+            h.addCard(card(11, 'A', 'S'));
+            h.addCard(card(4, '4', 'H'));
+            h.addCard(card(6, '6', 'D'));
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                int total = h.getTotal();
+                keep(total);
+            }
+            } });
+
+    all.push_back({ "Hand::isBust", [](std::size_t n, bench_timer& t)
+            {
+            Hand h;
+            h.addCard(card(10, 'K', 'S'));
+            h.addCard(card(6, '6', 'H'));
+            h.addCard(card(5, '5', 'D'));
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                bool bust = h.isBust();
+                keep(bust);
+            }
+            } });
+
+    all.push_back({ "Hand::printAllHand", [](std::size_t n, bench_timer& t)
+            {
+            Hand h;
+            h.addCard(card(10, 'K', 'S'));
+            h.addCard(card(6, '6', 'H'));
+            h.addCard(card(5, '5', 'D'));
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                std::string s = h.printAllHand(3);
+                keep(s);
+            }
+            } });
+
+    // what chat_room::stringOfCards sends: five seats with three cards each and the dealer
+    all.push_back({ "chat_room::stringOfCards", [](std::size_t n, bench_timer& t)
+            {
+            t.pause();
+            table_game g;
+            g.shuffle(7);
+            std::vector<int> seats = { 1, 2, 3, 4, 5 };
+            for (int seat : seats)
+            {
+                g.play(seat);
+                g.hit(seat);
+            }
+            t.resume();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                std::string s = g.printTable(seats, [](int seat) { return seat; });
+                keep(s);
+            }
+            } });
+
+    all.push_back({ "chat_message::encode_header", [](std::size_t n, bench_timer& t)
+            {
+            chat_message msg;
+            std::strcpy(msg.ca.g, "<-- Player 1 hand:\nK of S  \n6 of H  \nhand: 0\n");
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                msg.ca.turn = int(i);
+                msg.encode_header();
+                keep(msg);
+            }
+            } });
+
+    all.push_back({ "chat_message::decode_header", [](std::size_t n, bench_timer& t)
+            {
+            chat_message msg;
+            std::strcpy(msg.ca.g, "<-- Player 1 hand:\nK of S  \n6 of H  \nhand: 0\n");
+            msg.encode_header();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                bool ok = msg.decode_header();
+                keep(ok);
+                keep(msg);
+            }
+            } });
+
+    return all;
+}
+
+// name ns/op noise allocs/op, one benchmark a line, # starts a comment
+static std::map<std::string, result> load_baseline(const std::string& path)
+{
+    std::map<std::string, result> out;
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("can't read baseline " + path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name;
+        result r;
+        if (fields >> name >> r.ns >> r.noise >> r.allocs)
+            out[name] = r;
+    }
+    return out;
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        std::string filter, baseline_file, save_file;
+        int repetitions = 15;
+        double threshold = 10;
+        bool json = false;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-f" && i + 1 < argc)
+                filter = argv[++i];
+            else if (arg == "-r" && i + 1 < argc)
+                repetitions = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "-b" && i + 1 < argc)
+                baseline_file = argv[++i];
+            else if (arg == "-s" && i + 1 < argc)
+                save_file = argv[++i];
+            else if (arg == "-t" && i + 1 < argc)
+                threshold = std::atof(argv[++i]);
+            else if (arg == "-j")
+                json = true;
+            else
+            {
+                std::cerr << "Usage: bench [-f <filter>] [-r <repetitions>] [-b <baseline file>] "
+                    "[-s <baseline file>] [-t <percent>] [-j]\n";
+                return 1;
+            }
+        }
+
+        std::map<std::string, result> baseline;
+        if (!baseline_file.empty())
+            baseline = load_baseline(baseline_file);
+
+        std::ostream& table = json ? std::cerr : std::cout;
+        table << std::left << std::setw(30) << "benchmark" << std::right
+            << std::setw(12) << "ns/op" << std::setw(9) << "+-" << std::setw(11) << "allocs/op";
+        if (!baseline.empty())
+            table << std::setw(12) << "baseline" << std::setw(9) << "change";
+        table << "\n";
+
+        std::ostringstream saved;
+        saved << "# name ns/op noise allocs/op\n";
+        flat_json results;
+        int regressions = 0;
+        for (auto& b : benchmarks())
+        {
+            if (!filter.empty() && b.name.find(filter) == std::string::npos)
+                continue;
+            result r = run(b, repetitions);
+            saved << b.name << " " << r.ns << " " << r.noise << " " << r.allocs << "\n";
+            results.add(b.name + ".ns", r.ns);
+            results.add(b.name + ".allocs", r.allocs);
+            table << std::left << std::setw(30) << b.name << std::right << std::fixed
+                << std::setprecision(1) << std::setw(12) << r.ns << std::setw(8)
+                << (r.ns > 0 ? 100 * r.noise / r.ns : 0) << "%" << std::setprecision(2) << std::setw(11) << r.allocs;
+            auto base = baseline.find(b.name);
+            if (base != baseline.end())
+            {
+                const result& was = base->second;
+                double change = was.ns > 0 ? 100 * (r.ns - was.ns) / was.ns : 0;
+                table << std::setprecision(1) << std::setw(12) << was.ns << std::showpos
+                    << std::setw(8) << change << "%" << std::noshowpos;
+                if (change > threshold && r.ns - was.ns > 3 * (r.noise + was.noise))
+                {
+                    table << "  SLOWER";
+                    regressions++;
+                }
+                else if (r.allocs > was.allocs + 0.005)
+                {
+                    table << "  MORE ALLOCATIONS";
+                    regressions++;
+                }
+            }
+            table << std::endl;
+        }
+
+        if (json)
+            std::cout << results.str();
+        if (!save_file.empty())
+        {
+            std::ofstream out(save_file);
+            out << saved.str();
+            if (!out)
+                throw std::runtime_error("can't write baseline " + save_file);
+        }
+        if (regressions)
+            std::cerr << regressions << " regressed against " << baseline_file << "\n";
+        return regressions ? 2 : 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -10,11 +10,13 @@
 
 #include <cstdlib>
 #include <deque>
+#include <fstream>
 #include <iostream>
 #include <thread>
 #include "asio.hpp"
 #include "../include/chat_message.hpp"
 #include "../include/Hand.hpp"
+#include "../include/shoe_commit.hpp"
 #include "../include/UI_Interface.h"
 #include "../include/controller.h"
 
@@ -25,6 +27,8 @@ using asio::ip::tcp;
 
 typedef std::deque<chat_message> chat_message_queue;
 
+enum { opening_credits = 100 }; // what a new player starts with
+
 Hand h;
 UI_Interface* win;
 
@@ -34,10 +38,16 @@ class chat_client
 {
     public:
         chat_client(asio::io_context& io_context,
-                const tcp::resolver::results_type& endpoints)
+                const tcp::resolver::results_type& endpoints,
+                const std::string& player)
             : io_context_(io_context),
-            socket_(io_context)
+            socket_(io_context),
+            endpoints_(endpoints),
+            retry_(io_context),
+            name(player)
     {
+        std::ifstream in(key_file());
+        in >> profile_key_;
         do_connect(endpoints);
     }
 
@@ -58,7 +68,12 @@ class chat_client
 
         void close()
         {
-            asio::post(io_context_, [this]() { socket_.close(); });
+            asio::post(io_context_, [this]()
+                    {
+                    closing_ = true;
+                    retry_.cancel();
+                    socket_.close();
+                    });
         }
 
         int get_id()
@@ -74,9 +89,67 @@ class chat_client
                     {
                     if (!ec)
                     {
-                    std::cout << "\n\nWELCOME TO CASINO ROYALE!" << std::endl;
+                    if (token_ == 0)
+                        std::cout << "\n\nWELCOME TO CASINO ROYALE!" << std::endl;
+                    hello();
                     do_read_header();
                     }
+                    else
+                    {
+                    retry();
+                    }
+                    });
+        }
+
+        // the first message decides the seat: the old one when we have a token for it
+        void hello()
+        {
+            chat_message msg;
+            msg.ca.resume = token_ != 0;
+            msg.ca.token = token_;
+            msg.ca.client_credits = opening_credits;
+            std::strncpy(msg.ca.name, name.c_str(), sizeof(msg.ca.name) - 1);
+            msg.ca.profile_key = profile_key_;
+            msg.encode_header();
+            write_msgs_.clear();
+            write_msgs_.push_back(msg);
+            do_write();
+        }
+
+        // the key the server gave our name, without it the name's credits aren't ours next time
+        std::string key_file() const
+        {
+            const char* home = std::getenv("HOME");
+            return std::string(home ? home : ".") + "/.blackjack-" + name;
+        }
+
+        void saveKey(std::uint64_t key)
+        {
+            profile_key_ = key;
+            std::ofstream out(key_file());
+            out << key << "\n";
+        }
+
+        // a dropped connection is tried again, the server holds the seat for a while
+        // the read and the write both see the error, only the first one gets here
+        void reconnect()
+        {
+            if (!socket_.is_open())
+                return;
+            socket_.close();
+            std::cout << "Connection lost, reconnecting" << std::endl;
+            retry();
+        }
+
+        void retry()
+        {
+            if (closing_)
+                return;
+            retry_.expires_after(std::chrono::seconds(1));
+            retry_.async_wait([this](std::error_code ec)
+                    {
+                    if (!ec)
+                        do_connect(endpoints_);
                     });
         }
 
@@ -89,6 +162,14 @@ class chat_client
                       if (!ec && read_msg_.decode_header())
                       {
                         //system("clear");
+                        if (read_msg_.ca.token)
+                          token_ = read_msg_.ca.token;
+                        if (read_msg_.ca.profile_key && read_msg_.ca.profile_key != profile_key_)
+                          saveKey(read_msg_.ca.profile_key);
+                        if (read_msg_.ca.revealed)
+                          checkShoe();
+                        if (!blank(read_msg_.ca.commitment))
+                          std::memcpy(commitment_, read_msg_.ca.commitment, sizeof(commitment_));
                         if(!gotId) //runs only first time
                         {
                           id = read_msg_.ca.id;
@@ -97,6 +178,13 @@ class chat_client
                           std::cout << "New Player connected with Player ID "<< id << std::endl;
                           std::cout << "Your Player id: "<< id << std::endl;
                         }
+                        else if(read_msg_.ca.given_id && read_msg_.ca.given_id != id)
+                        {
+                          // the server moved us to another seat or table
+                          id = read_msg_.ca.given_id;
+                          win->set_id(id);
+                          std::cout << "Moved, your Player id: "<< id << std::endl;
+                        }
                         std::cout << std::endl;
                         std::cout << read_msg_.ca.g << std::endl;
                         do_read_body();
@@ -104,7 +192,7 @@ class chat_client
                       }
                       else
                       {
-                        socket_.close();
+                        reconnect();
                       }
                     });
         }
@@ -121,7 +209,7 @@ class chat_client
                     }
                     else
                     {
-                    socket_.close();
+                    reconnect();
                     }
                     });
         }
@@ -143,11 +231,30 @@ class chat_client
                     }
                     else
                     {
-                    socket_.close();
+                    reconnect();
                     }
                     });
         }
 
+        // the shoe that just ran out, shuffled again from its seed, has to hash to what we were promised
+        void checkShoe()
+        {
+            if (blank(commitment_))
+                return; // we came in after its commitment
+            unsigned char h[sizeof(commitment_)];
+            shoe_secret::commit(read_msg_.ca.shoe_seed, read_msg_.ca.shoe_salt, h);
+            if (std::memcmp(h, commitment_, sizeof(h)) == 0)
+                std::cout << "Shoe " << sha256::hex(h).substr(0, 16) << " checked, it was dealt fair" << std::endl;
+            else
+                std::cout << "WARNING: the shoe that just ended is not the one the server committed to" << std::endl;
+        }
+
+        static bool blank(const unsigned char* commitment)
+        {
+            static const unsigned char none[sha256::digest_size] = {};
+            return std::memcmp(commitment, none, sizeof(none)) == 0;
+        }
+
         void storeData()
         {
             std::string data(read_msg_.ca.g);
@@ -159,6 +266,13 @@ class chat_client
         chat_message read_msg_;
         chat_message_queue write_msgs_;
 
+        tcp::resolver::results_type endpoints_;
+        asio::steady_timer retry_;
+        std::uint64_t token_ = 0; // from the server, gets our seat back after a reconnect
+        std::uint64_t profile_key_ = 0; // from the server when it registered our name, kept in key_file()
+        unsigned char commitment_[32] = {}; // the shoe being dealt, see shoe_commit.hpp
+        bool closing_ = false;
+
         std::string name;
         int id;
         bool gotId = false;
@@ -231,24 +345,27 @@ int main(int argc, char* argv[])
 
     auto app = Gtk::Application::create("");
     //gtk_init( &argc, &argv);
-    if (argc != 3)
+    if (argc != 3 && argc != 4)
     {
-        std::cerr << "Usage: chat_client <host> <port>\n";
+        std::cerr << "Usage: chat_client <host> <port> [<name>]\n";
         return 1;
     }
+    // the server keeps credits and stats under the name, without one every session starts fresh
+    const char* user = std::getenv("USER");
+    std::string name = argc == 4 ? argv[3] : user ? user : "";
 
     asio::io_context io_context; 
     std::cout << "Play" << std::endl;
 
     tcp::resolver resolver(io_context);
     auto endpoints = resolver.resolve(argv[1], argv[2]);
-    c = new chat_client(io_context, endpoints);
+    c = new chat_client(io_context, endpoints, name);
     Controller* controller = new Controller();
     win = new UI_Interface(controller); 
 
     std::thread t([&io_context](){ io_context.run(); });
     chat_message msg;
-    msg.ca.client_credits = 100;
+    msg.ca.client_credits = opening_credits; // the server ignores it for a name it knows
 
     char line[chat_message::max_body_length + 1];
     msg.body_length(std::strlen(line));
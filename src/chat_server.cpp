@@ -8,20 +8,51 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <thread>
 #include <deque>
 #include <iostream>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <set>
+#include <unordered_map>
 #include <utility>
 #include <string>
 #include <ctime>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <sstream>
 #include "asio.hpp"
 #include "../include/chat_message.hpp"
 #include "../include/Deck.hpp"
 #include "../include/Hand.hpp"
+#include "../include/table_game.hpp"
+#include "../include/send_queue.hpp"
+#include "../include/io_context_pool.hpp"
+#include "../include/lobby.hpp"
+#include "../include/snapshot.hpp"
+#include "../include/fd_passing.hpp"
+#include "../include/log_writer.hpp"
+#include "../include/hand_log.hpp"
+#include "../include/ledger.hpp"
+#include "../include/replay.hpp"
+#include "../include/table_store.hpp"
+#include "../include/player_store.hpp"
+#include "../include/logger.hpp"
+#include "../include/shoe_commit.hpp"
+#include "../include/latency.hpp"
+#include "../include/metrics.hpp"
+#include "../include/metrics_endpoint.hpp"
+#include "../include/trace.hpp"
+#include "../include/table_usage.hpp"
+#include "../include/alloc_profile.hpp"
 
 
 
@@ -31,187 +62,420 @@ using asio::ip::tcp;
 
 typedef std::deque<chat_message> chat_message_queue;
 
+// every allocation in the server is counted for the metrics endpoint, and the table it was for
+void* operator new(std::size_t size)
+{
+    metrics::add(metrics::allocations, 1);
+    metrics::add(metrics::allocated_bytes, size);
+    table_usage::charge(size);
+    alloc_profile::count(size);
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
 
+void operator delete(void* p) noexcept
+{
+    if (!p)
+        return;
+    metrics::add(metrics::frees, 1);
+    std::free(p);
+}
 
-//------------------------------------------------------------------------------------------------
 
-// deck and hand are global variables so all classes can access
-Deck d;
-Hand h;
-int turn = 0;
 
-bool reveal              = false;
-bool deal                = false;
-bool dealer_initialized  = false;
+#if defined(SO_REUSEPORT)
+// lets several acceptors listen on one port, the kernel spreads connections over them
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
 
-//------------------------------------------------------------------------------------------------
 
 
 
+class chat_room;
 
 class chat_participant
 {
     public:
         virtual ~chat_participant() {}
         virtual void deliver(const chat_message& msg) = 0;
+        virtual queue_stats queue_info() const { return queue_stats(); }
+        // leave this table for target, the lobby already holds a seat there
+        virtual void move_table(std::shared_ptr<chat_room> target) {}
+        // false for a seat kept for a player who hasn't come back yet
+        virtual bool present() const { return true; }
+        // drop the connection, the table sees it leave like any other
+        virtual void disconnect() {}
+
+        int id = 0;
+        int credits = 0;
+        int bet = 0;
+        int staked = 0;           // taken for this round's hands, a split takes the bet again
+        std::uint32_t player = 0; // server wide, unlike id which is the seat
+        std::uint64_t token = 0;  // gets the seat back after a dropped connection
+        std::string name;         // set when the server keeps their credits and stats
+        std::uint64_t key = 0;    // to their profile, goes out with the seat
+};
 
-        void pHand(Card t)
-        {
-            getCurrentHand().addCard(t);
-        }
+typedef std::shared_ptr<chat_participant> chat_participant_ptr;
 
-        std::string printHand()
-        {
-            std::string result = "";
-            int i = 0;
-            for(auto hand : playerHand)
-            {
-                result += hand.printAllHand(id);
-                result += "hand: " + std::to_string(i++) + "\n";
-            }
-            return result;
-        }
+// a seat kept for a player whose connection dropped, or who came from a snapshot,
+// standing in for them until they are back. it plays no part in the round, when its
+// turn comes the table waits for it
+class held_seat : public chat_participant
+{
+    public:
+        void deliver(const chat_message&) {}
+        bool present() const { return false; }
+
+        std::chrono::steady_clock::time_point expires;
+};
 
-        Hand& getCurrentHand()
+// which table holds the seat behind every resume token, so a reconnect goes straight there
+// tokens come from the random device, they are all a player needs to take a seat
+class resume_registry
+{
+    public:
+        std::uint64_t issue(std::shared_ptr<chat_room> table)
         {
-            if (playerHand.size() == 0)
-            {
-                Hand h;
-                playerHand.push_back(h);
-            }
-            return playerHand[currentHand];
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::uint64_t token;
+            do
+                token = (std::uint64_t)random_() << 32 | random_();
+            while (token == 0 || tokens_.count(token));
+            tokens_[token] = table;
+            return token;
         }
 
-        //TODO check why it works only sometimes
-        //FIXME hand.hpp only checks if ace in hand, 
-        //if yes -10, and sets ace.value = 1,
-        //but this cannot work for reference...
-        bool checkBust()
+        // a token that came with a snapshot or a handoff
+        void adopt(std::uint64_t token, std::shared_ptr<chat_room> table)
         {
-            std::cout << "HERE\n " << getCurrentHand().isBust() << std::endl;
-            std::cout << getCurrentHand().getTotal() << std::endl;
-            return getCurrentHand().isBust();
+            std::lock_guard<std::mutex> lock(mutex_);
+            tokens_[token] = table;
         }
 
-        bool setNextHand()
+        void revoke(std::uint64_t token)
         {
-            if(currentHand < playerHand.size()-1)
-            {
-                currentHand++;
-                return true;
-            }
-            else
-                return false;
+            std::lock_guard<std::mutex> lock(mutex_);
+            tokens_.erase(token);
         }
 
-        //TODO test if its working
-        void split()
+        std::shared_ptr<chat_room> find(std::uint64_t token)
         {
-            if(getCurrentHand().canSplit())
-            {
-		std::cout << "called split" << std::endl;
-                Hand h;
-                playerHand.insert(playerHand.begin()+currentHand+1, h);
-                Card temp;
-                temp = d.getCard();
-                Card c = getCurrentHand().split();
-                pHand(temp);
-                temp = d.getCard();
-                playerHand[currentHand+1].addCard(c);
-                playerHand[currentHand+1].addCard(temp);
-            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = tokens_.find(token);
+            return it == tokens_.end() ? std::shared_ptr<chat_room>() : it->second.lock();
         }
 
-	bool checkSplit()
-	{
-	    return getCurrentHand().canSplit();	
-	}
+    private:
+        std::mutex mutex_;
+        std::random_device random_;
+        std::unordered_map<std::uint64_t, std::weak_ptr<chat_room>> tokens_;
+};
 
+resume_registry resume_tokens;
 
-        int id;
-        bool play = false;
-    private:
-        int currentHand = 0;
-        std::vector<Hand> playerHand;
+// server wide player numbers, they follow a player across tables, threads and restarts
+std::atomic<std::uint32_t> player_numbers{1};
 
+// profiles of named players, null and everyone is whoever the client says they are
+player_store* player_profiles = nullptr;
 
+//----------------------------------------------------------------------
+
+enum { max_seats = 6 };
+
+// what every table is set up with
+struct table_config
+{
+    int wait_seconds = 10;
+    int hold_seconds = 30;       // a dropped or restored seat waits this long for its player, 0 gives it up at once
+    log_writer* hands = nullptr; // null, rounds aren't recorded
+    ledger* credits = nullptr;   // null, the client's word on credits is taken
+    shoe_maker* shoes = nullptr; // null, shoes are made and committed to on the strand
+    log_writer* shoe_log = nullptr; // null, commitments only go to the players
 };
 
-class Dealer : public chat_participant
+// a table, everything in here runs on the room's strand
+// a player's id is their seat number at the table, 1 to max_seats
+// a table's strand, every handler on it is charged to the table
+typedef accounted_executor<asio::strand<asio::io_context::executor_type>> table_strand;
+
+class chat_room : public std::enable_shared_from_this<chat_room>
 {
     public:
-        Dealer() {}
-        ~Dealer() {}
-        std::string printHand()
-        {
-            std::string result;
-            result = playerHand.printAllHand(id);
-            std::cout << result << std::endl;
-            std::cout << "reveal: " << reveal << std::endl;
-            if(reveal == false)
-            {
-                std::stringstream ss(result);
-                std::string s = "";
-                std::string token = "";
-                std::getline(ss, s); //line with <-- Player 0...
-                s += "\n";
-                std::getline(ss, token); //line with first card
-                s += token;
-                s += "\n";
-                s += "B ACK2\n"; //give back of card
-                result = s;
-            }
-            return result;
+        chat_room(asio::io_context& io_context, lobby<chat_room>& lobby, int id, int stake,
+                const table_config& config)
+            : strand_(asio::strand<asio::io_context::executor_type>(io_context.get_executor()), usage_),
+            timer_(io_context),
+            hold_timer_(io_context),
+            lobby_(lobby),
+            config_(config),
+            id_(id),
+            stake_(stake)
+        {
+            metrics::add(metrics::tables, 1);
+            //making deck and shuffling
+            newShoe();
+        }
+
+        ~chat_room()
+        {
+            metrics::add(metrics::tables, -1);
+            metrics::add(metrics::seats, -seated_.load(std::memory_order_relaxed));
+        }
+
+        int id() const
+        {
+            return id_;
+        }
+
+        int stake() const
+        {
+            return stake_;
+        }
+
+        table_strand& strand()
+        {
+            return strand_;
+        }
+
+        // safe to read from any thread
+        const table_usage& usage() const
+        {
+            return *usage_;
+        }
+
+        // safe to call from any thread
+        int numPlayers() const
+        {
+            return seated_.load(std::memory_order_relaxed);
         }
 
-        void pHand(Card t)
+        void start_play()
         {
-            playerHand.addCard(t);
+            if (inplay || draining_ || present() == 0)
+                return;
+            // nobody has bet yet, the first bet starts the clock again
+            int first = nextTurn(0);
+            if (first == -1)
+                return;
+            inplay = true;
+            dirty_ = true;
+            lobby_.set_open(id_, false);
+            changeActivePlayer(first);
         }
 
-        void deal()
+        // game logic for one message from a client, then broadcast it
+        // read_ns is when its header was read, the broadcast times the action from there
+        void on_action(chat_participant_ptr participant, chat_message msg, std::int64_t read_ns = 0)
         {
-            while(playerHand.getTotal() < 17)
+            // late messages from someone who already left, or is waiting for the next round
+            if (participants_.count(participant) == 0)
+                return;
+            dirty_ = true;
+            msg.ca.id = participant->id;
+            bool timed = msg.ca.play || msg.ca.hit || msg.ca.split || msg.ca.stand;
+            latency::action action = msg.ca.play ? latency::action::play : msg.ca.hit ? latency::action::hit
+                : msg.ca.split ? latency::action::split : latency::action::stand;
+            trace::span span(timed ? latency::name(action) : "action", id_, msg.ca.id);
+            alloc_profile::scope tag(timed ? latency::name(action) : "action");
+            // only the player to act hits, splits or stands, and a seat bets once a round
+            if ((msg.ca.hit || msg.ca.split || msg.ca.stand)
+                    && (!inplay || turn != participant->id || !game_.seats().count(participant->id)))
             {
-                Card temp;
-                temp = d.getCard();
-                pHand(temp);
+                reject(participant, "It isn't your turn\n");
+                return;
+            }
+            if (msg.ca.play && draining_)
+            {
+                reject(participant, "This table is closing\n");
+                return;
+            }
+            if (msg.ca.play && game_.seats().count(participant->id))
+            {
+                reject(participant, "You already have a bet on this round\n");
+                return;
+            }
+            if (msg.ca.split && !canBeSplit(participant->id))
+            {
+                reject(participant, "That hand can't be split\n");
+                return;
+            }
+            if (msg.ca.play)
+            {
+                int bet = msg.ca.bet > 0 ? msg.ca.bet : stake_;
+                // with a ledger the server keeps the money, the client's credits only open the account
+                // a player with a profile brings their credits from it instead
+                int opening = participant->name.empty() ? msg.ca.client_credits : participant->credits;
+                if (!takeStake(participant, bet, opening))
+                {
+                    reject(participant, "Not enough credits for that bet\n");
+                    return;
+                }
+                participant->bet = bet;
+                if (!inplay && !clock_)
+                    startClock();
+            }
+            // the second hand of a split is staked like the first
+            if (msg.ca.split && !takeStake(participant, participant->bet, participant->credits))
+            {
+                reject(participant, "Not enough credits to split\n");
+                return;
             }
-        }
 
-        void deliver(const chat_message& msg) {}
-    private:
-        Hand playerHand;
-};
+            if(msg.ca.play == true)
+            {
+                record(msg.ca.id, hand_action_kind::play);
+                trace::span deal("deal", id_, msg.ca.id);
+                game_.play(msg.ca.id); // the dealer's cards come with the first play
+                std::string gui = stringOfCards();
+                char g[gui.size() +1 ];
+                std::copy(gui.begin(), gui.end(), g);
+                g[gui.size()] = '\0';
+                strcpy(msg.ca.g, g);
+                msg.ca.split_button = canBeSplit(msg.ca.id);
+            }
 
-typedef std::shared_ptr<chat_participant> chat_participant_ptr;
+            // a bust stands the hand without being recorded, a replay busts the same way
+            bool standing = msg.ca.stand;
+            if(msg.ca.hit == true)
+            {
+                record(msg.ca.id, hand_action_kind::hit);
+                bool busted = game_.hit(msg.ca.id);
+                std::string gui = stringOfCards();
+
+                char g[gui.size() +1 ];
+                std::copy(gui.begin(), gui.end(), g);
+                g[gui.size()] = '\0';
+                strcpy(msg.ca.g, g);
+                if(busted)
+                    msg.ca.stand = true;
+            }
+            else if(msg.ca.split == true)
+            {
+                record(msg.ca.id, hand_action_kind::split);
+                bool busted = game_.split(msg.ca.id);
+                msg.ca.split_button = canBeSplit(msg.ca.id);
+                std::string gui = stringOfCards();
+
+                char g[gui.size() +1 ];
+                std::copy(gui.begin(), gui.end(), g);
+                g[gui.size()] = '\0';
+                strcpy(msg.ca.g, g);
+                if(busted)
+                    msg.ca.stand = true;
+            }
 
-//----------------------------------------------------------------------
+            if(msg.ca.stand == true)
+            {
+                if (standing)
+                    record(msg.ca.id, hand_action_kind::stand);
+                //if stand true, it sets player hand to next hand
+                if(!game_.stand(msg.ca.id))
+                {
+                    turn = nextTurn(turn);
+                    if(turn == -1) //everyone is finished so dealer's turn
+                    {
+                        dealerPlay();
+                        std::string gui = stringOfCards();
+
+                        char g[gui.size() +1 ];
+                        std::copy(gui.begin(), gui.end(), g);
+                        g[gui.size()] = '\0';
+                        strcpy(msg.ca.g, g);
+                    }
+                }
+            }
 
-int playercount = 0;
-bool inplay = false;
+            msg.ca.turn = turn;
+            msg.encode_header(); // save info in msg to be sent to client
+            LOG_DEBUG("table {} player {} acted, turn {}", id_, msg.ca.id, msg.ca.turn);
+            // the action that ends the round is timed as the dealer's turn, which it also pays for
+            if (timed && read_ns)
+                msg.timing = std::make_shared<latency::stamp>(turn == -1 ? latency::action::dealer : action, read_ns);
+            deliver(msg); // deliver msg to all clients
+
+            if (turn == -1)
+                endRound();
+        }
+
+        // a stake off the player's credits, false and nothing taken when they don't cover it
+        // opening is what a player the ledger doesn't know yet starts with
+        bool takeStake(chat_participant_ptr participant, int amount, int opening)
+        {
+            if (config_.credits)
+            {
+                std::int64_t balance;
+                bool taken = config_.credits->bet(participant->player, amount, opening, roundRef(rounds_ + 1), balance);
+                participant->credits = balance;
+                if (!taken)
+                    return false;
+            }
+            else
+            {
+                if (amount <= 0 || amount > opening)
+                    return false;
+                participant->credits = opening - amount;
+            }
+            participant->staked += amount;
+            return true;
+        }
+
+        // tells one player their message was turned down, the rest of the table never sees it
+        void reject(chat_participant_ptr participant, const char* why)
+        {
+            LOG_DEBUG("table {} player {}: {}", id_, participant->id, why);
+            chat_message msg;
+            std::strncpy(msg.ca.g, why, sizeof(msg.ca.g) - 1);
+            msg.ca.id = participant->id;
+            msg.ca.turn = turn;
+            msg.ca.client_credits = participant->credits;
+            msg.ca.notice = true;
+            commitment(msg.ca);
+            msg.encode_header();
+            participant->deliver(msg);
+        }
 
-class chat_room
-{
-    public:
         // puts client in participants vector and sends past msg logs
+        // the lobby already reserved a seat here
         void join(chat_participant_ptr participant) 
         {
-            participant->id = ++playercount;
-
-            if(inplay || playercount > 6)
+            trace::span span("join", id_);
+            alloc_profile::scope tag("join");
+            participant->id = freeSeat();
+            span.seat(participant->id);
+            participant->token = resume_tokens.issue(shared_from_this());
+            dirty_ = true;
+
+            if(inplay)
             {
                 //tell them to wait
+                waiting_.insert(participant);
                 strcpy(handshake.ca.g, "Please wait for the game to finish\n");
+                handshake.ca.id = participant->id;
+                handshake.ca.given_id = participant->id;
+                handshake.ca.client_credits = participant->credits;
+                handshake.ca.token = participant->token;
+                handshake.ca.profile_key = participant->key;
                 handshake.ca.turn = 0;
+                commitment(handshake.ca);
                 handshake.encode_header();
                 participant->deliver(handshake);
             }
             else
             {
-                participants_.insert(participant);
+                seat(participant);
+                if (present() == 1)
+                    startClock();
                 handshake.ca.id = participant->id;
+                handshake.ca.given_id = participant->id;
+                handshake.ca.client_credits = participant->credits;
+                handshake.ca.token = participant->token;
+                handshake.ca.profile_key = participant->key;
                 handshake.ca.turn = 0;
+                commitment(handshake.ca);
                 //strcpy(handshake.ca.g, "");
                 handshake.encode_header();
                 participant->deliver(handshake);
@@ -226,14 +490,77 @@ class chat_room
 
         }
 
+        // the player's connection is gone, their seat waits hold_seconds for them to come back
+        void drop(chat_participant_ptr participant)
+        {
+            std::set<chat_participant_ptr>* group = participants_.count(participant) ? &participants_
+                : waiting_.count(participant) ? &waiting_ : nullptr;
+            if (!group)
+                return;
+            if (config_.hold_seconds <= 0 || draining_)
+            {
+                leave(participant);
+                return;
+            }
+            group->erase(participant);
+            group->insert(hold(*participant));
+            dirty_ = true;
+            holdSeats();
+        }
+
+        // a player back on a new connection takes their held seat
+        // one snapshot of the table brings them up to date, false if the seat is gone
+        bool reclaim(chat_participant_ptr participant, std::uint64_t token)
+        {
+            if (!claim(participant, [token](const chat_participant& held) { return held.token == token; }))
+                return false;
+            chat_message msg = snapshot(participant->id);
+            msg.ca.given_id = participant->id;
+            msg.ca.client_credits = participant->credits;
+            msg.ca.token = token;
+            msg.encode_header();
+            participant->deliver(msg);
+            return true;
+        }
+
         void leave(chat_participant_ptr participant)
         {
-            participants_.erase(participant);
+            alloc_profile::scope tag("leave");
+            if (waiting_.erase(participant) == 0 && participants_.erase(participant) == 0)
+                return;
+            dirty_ = true;
+            resume_tokens.revoke(participant->token);
+            countSeats();
+            if (game_.seats().count(participant->id))
+            {
+                record(participant->id, hand_action_kind::leave);
+                game_.leave(participant->id);
+            }
+
+            // don't let the round hang on someone who is gone
+            if (inplay && participants_.empty())
+            {
+                endRound();
+            }
+            else if (inplay && turn == participant->id)
+            {
+                changeActivePlayer(nextTurn(turn));
+                if (turn == -1)
+                {
+                    dealerPlay();
+                    deliver(snapshot(0));
+                    endRound();
+                }
+            }
+            lobby_.release(id_);
         }
 
         void deliver(const chat_message& msg)
         {
+            trace::span span("broadcast", id_, msg.ca.id);
+            alloc_profile::scope tag("broadcast");
             recent_msgs_.push_back(msg);
+            recent_msgs_.back().timing.reset(); // the history would keep the action from ever being timed
             while (recent_msgs_.size() > max_recent_msgs)
                 recent_msgs_.pop_front();
 
@@ -256,429 +583,2353 @@ class chat_room
         }
 
 
+        // one message holding the whole table, for clients that fell behind
+        chat_message snapshot(int id)
+        {
+            alloc_profile::scope tag("snapshot");
+            chat_message msg;
+            std::string gui = stringOfCards();
+            gui.copy(msg.ca.g, sizeof(msg.ca.g) - 1);
+            msg.ca.g[std::min(gui.size(), sizeof(msg.ca.g) - 1)] = '\0';
+            msg.ca.id = id;
+            msg.ca.turn = turn;
+            msg.ca.split_button = canBeSplit(id);
+            commitment(msg.ca);
+            msg.encode_header();
+            return msg;
+        }
+
+        // sum of every seated session's outgoing queue
+        queue_stats queue_report()
+        {
+            queue_stats total;
+            for (auto participant: participants_)
+                total += participant->queue_info();
+            return total;
+        }
+
         int sizeOfParticipants()
         {
             int size = participants_.size();
             return size;
         }
 
-        void giveCard(int pid) // for initial dealing
+        std::string stringOfCards() //string of every player's cards
         {
-            if(pid == -1)
-            {
-                for(auto participant: participants_)
-                {	
-                    Card temp;
-                    temp = d.getCard();
-                    participant->pHand(temp);
-                }
-                Card temp;
-                temp = d.getCard();
-                dealer->pHand(temp);
-                return;
-            }
-            if(pid == 0)
-            {
-                Card temp;
-                temp = d.getCard();
-                dealer->pHand(temp);
-                return;
-            }
-            else
-            {
-                for(auto participant: participants_)
-                {
-                    if(participant->id == pid)
-                    {
-                        Card temp;
-                        temp = d.getCard();
-                        participant->pHand(temp);
-                    }
-                }
-            }
+            alloc_profile::scope tag("table text");
+            std::string result = game_.printTable(participants_,
+                    [](const chat_participant_ptr& participant) { return participant->id; });
+            LOG_DEBUG("table {} cards {}", id_, result);
+            return result;
         }
 
-        bool check_points(int id)
+        void changeActivePlayer(int pturn)
         {
-            std::cout << "Called" << std::endl;
+            chat_message handshake;
+            handshake.ca.turn = pturn;
+            commitment(handshake.ca);
+            turn = pturn;
+            LOG_TRACE("table {} turn passes to {}", id_, pturn);
+            handshake.encode_header();
             for (auto participant : participants_)
             {
-                if(participant->id == id)
-                {
-                    if(participant->checkBust())
-                    {
-                        return true;
-                    }
-                }
+                participant->deliver(handshake);
             }
-            return false;
         }
 
-        std::string stringOfCards() //string of every player's cards
+	bool canBeSplit(int id)
+	{
+	    return game_.canSplit(id);
+	}
+
+        // a lonely player between rounds moves to a busier table of the same stake
+        // players only move to lower table ids, so the table they leave empties and is retired
+        void breakUp()
         {
-            std::string result = "";
-            for(auto participant: participants_)
-            {
-                //TODO need to add dealer's cards as well
-                result += participant->printHand();
-            }
-            result += dealer->printHand();
-            std::cout << result << std::endl;
-            return result;
+            if (inplay || draining_ || held_ > 0 || participants_.size() != 1 || !waiting_.empty())
+                return;
+            auto target = lobby_.place_elsewhere(stake_, id_);
+            if (target)
+                (*participants_.begin())->move_table(target);
         }
 
-        bool checkAllPlay(int id)
+        // no new rounds from here on, the one being played finishes
+        // bets taken for a round that hasn't been dealt yet go back
+        void drain()
         {
-            for (auto participant : participants_)
+            draining_ = true;
+            timer_.cancel();
+            lobby_.set_open(id_, false);
+            if (!inplay)
+                refundStakes();
+        }
+
+        // drains the table and sends everyone away, held seats are given up
+        // a round in play is called off and its stakes returned before anyone goes
+        void close()
+        {
+            drain();
+            refundStakes();
+            std::vector<chat_participant_ptr> everyone;
+            for (auto group : { &participants_, &waiting_ })
+                everyone.insert(everyone.end(), group->begin(), group->end());
+            for (auto participant : everyone)
             {
-                if(participant->id == id)
-                {
-                    participant->play = true;
-                }
-                if(!participant->play)
+                if (participant->present())
+                    participant->disconnect();
+                else
                 {
-                    return false;
+                    held_--;
+                    leave(participant);
                 }
             }
+        }
+
+        bool idle() const
+        {
+            if (inplay)
+                return false;
+            for (auto participant : participants_)
+                if (participant->staked > 0)
+                    return false;
             return true;
         }
 
-        void changeActivePlayer(int pturn)
+        // calls off the round, whatever is staked on it is paid back and nothing is logged
+        void refundStakes()
         {
-            chat_message handshake;
-            handshake.ca.turn = pturn;
-            turn = pturn;
-            std::cout << "Got here" << std::endl;
-            handshake.encode_header();
-            std::cout << "Got far" << std::endl;
+            std::vector<ledger_tx> refunds;
             for (auto participant : participants_)
             {
-                participant->deliver(handshake);
+                participant->bet = 0;
+                if (participant->staked == 0)
+                    continue;
+                ledger_tx tx;
+                tx.kind = ledger_kind::payout;
+                tx.player = participant->player;
+                tx.amount = participant->staked;
+                tx.ref = roundRef(rounds_ + 1);
+                refunds.push_back(tx);
+                participant->credits += participant->staked;
+                participant->staked = 0;
+                if (participant->present())
+                    reject(participant, "The table is closing, your bet is returned\n");
             }
+            if (config_.credits && config_.credits->apply(refunds) > 0)
+                for (auto participant : participants_)
+                    participant->credits = config_.credits->balance(participant->player);
+            if (!refunds.empty())
+                LOG_INFO("table {}: {} bets returned", id_, refunds.size());
+            game_.clear();
+            round_ = hand_record();
+            turn = 0;
+            inplay = false;
+            dirty_ = true;
         }
 
-        bool setNextHand(int id)
+        // for the admin console, one line or with every seat
+        std::string describe(bool seats)
         {
-            for(auto participant : participants_)
+            std::ostringstream out;
+            queue_stats queued = queue_report();
+            out << "table " << id_ << " stake " << stake_ << " "
+                << (draining_ ? (inplay ? "draining, in a round" : "drained") : inplay ? "in a round" : "between rounds")
+                << " turn " << turn << " seats " << participants_.size() << " (" << held_ << " held, "
+                << waiting_.size() << " waiting) rounds " << rounds_ << " shoe " << game_.dealt() << "/"
+                << table_game::shoe_cards << " (" << game_.dealt() * 100 / table_game::shoe_cards << "%)"
+                << " queued " << queued.depth << " msgs " << queued.bytes << " bytes\n";
+            if (!seats)
+                return out.str();
+            auto now = std::chrono::steady_clock::now();
+            for (auto group : { &participants_, &waiting_ })
             {
-                if(participant->id == id)
+                for (auto participant : *group)
                 {
-                    return participant->setNextHand();
+                    queue_stats q = participant->queue_info();
+                    out << "  seat " << participant->id << " player " << participant->player;
+                    if (!participant->name.empty())
+                        out << " (" << participant->name << ")";
+                    out << " credits " << participant->credits << " bet " << participant->bet;
+                    if (!participant->present())
+                        out << " held for another " << std::chrono::duration_cast<std::chrono::seconds>(
+                                std::static_pointer_cast<held_seat>(participant)->expires - now).count() << " s";
+                    else
+                        out << (group == &waiting_ ? " waiting" : participant->id == turn ? " to act" : " seated")
+                            << " queue " << q.depth << " msgs " << q.bytes << " bytes, high water " << q.high_water
+                            << ", " << q.dropped << " dropped";
+                    out << "\n";
                 }
             }
-            return false;
+            out << stringOfCards();
+            return out.str();
         }
 
-        void splitHand(int id)
+        // everything needed to pick the table up again, in a round or between rounds
+        table_snapshot state()
         {
-            for (auto participant : participants_)
+            table_snapshot s;
+            s.id = id_;
+            s.stake = stake_;
+            s.seed = game_.seed();
+            if (committed_)
+                s.salt.assign((const char*)shoe_.salt, sizeof(shoe_.salt));
+            s.dealt = game_.dealt();
+            s.rounds = rounds_;
+            s.inplay = inplay;
+            s.turn = turn;
+            if (inplay)
+                s.round = round_.encode();
+            for (auto& group : { &participants_, &waiting_ })
             {
-                if(participant->id == id)
+                for (auto participant : *group)
                 {
-                    participant->split();
+                    seat_snapshot seat;
+                    seat.seat = participant->id;
+                    seat.credits = participant->credits;
+                    seat.player = participant->player;
+                    seat.bet = participant->bet;
+                    seat.token = participant->token;
+                    seat.name = participant->name;
+                    seat.waiting = group == &waiting_;
+                    s.seats.push_back(seat);
                 }
             }
+            return s;
         }
 
-	bool canBeSplit(int id)
-	{
-            for (auto participant : participants_)
+        // the state for a crash snapshot, null when nothing changed since the last one
+        table_store::state_ptr changes()
+        {
+            if (!dirty_)
+                return table_store::state_ptr();
+            dirty_ = false;
+            return std::make_shared<const std::string>(state().encode());
+        }
+
+        // picks up a table another server process left behind, from a handoff or a crash
+        // a round in play is dealt again from its seed and actions, every seat is held for its
+        // player for hold_seconds, the lobby must already count the seats
+        void restore(const table_snapshot& s)
+        {
+            rounds_ = s.rounds;
+            shoe_secret saved;
+            saved.seed = s.seed;
+            bool salted = s.salt.size() == sizeof(saved.salt);
+            if (salted)
             {
-                if(participant->id == id)
-                {
-                    return participant->checkSplit();
-                }
+                std::memcpy(saved.salt, s.salt.data(), s.salt.size());
+                shoe_secret::commit(saved.seed, saved.salt, saved.commitment);
             }
-	    return false;
-	}
+            // the old process may have finished the shoe and revealed it after the snapshot was
+            // taken, so it is only kept for a round in play, and given up once that round is over.
+            // between rounds the table goes on with the new shoe it was made with
+            hand_record round;
+            if (s.inplay && round.decode(s.round.data(), s.round.size()) && round.started_us != 0)
+            {
+                revealShoe(shoe_, game_.dealt(), nullptr); // the new one, not a card dealt from it
+                shoe_ = saved;
+                committed_ = salted;
+                round_replay::deal(game_, round);
+                round_ = round;
+                reshuffle_ = true;
+            }
+            else if (salted)
+                revealShoe(saved, s.dealt, nullptr);
+            inplay = s.inplay;
+            turn = s.turn;
+            for (auto& seat : s.seats)
+            {
+                held_seat p;
+                p.id = seat.seat;
+                p.credits = seat.credits;
+                p.player = seat.player;
+                p.bet = seat.bet;
+                p.token = seat.token;
+                p.name = seat.name;
+                // the round dealt again holds every hand the seat staked
+                auto cards = game_.seats().find(seat.seat);
+                if (cards != game_.seats().end())
+                    p.staked = seat.bet * cards->second.hands().size();
+                if (seat.token)
+                    resume_tokens.adopt(seat.token, shared_from_this());
+                if (seat.waiting && inplay)
+                    waiting_.insert(hold(p));
+                else
+                    participants_.insert(hold(p));
+            }
+            countSeats();
+            lobby_.set_open(id_, !inplay && !draining_);
+            dirty_ = true;
+            if (held_ > 0)
+                holdSeats();
+        }
 
-        Dealer* dealer;
+        // a player back from the previous server process takes their held seat and says nothing
+        void restoreSeat(chat_participant_ptr participant)
+        {
+            int id = participant->id;
+            if (claim(participant, [id](const chat_participant& held) { return held.id == id; }))
+                return;
+            dirty_ = true;
+            seat(participant);
+            if (!inplay && present() == 1)
+                startClock();
+        }
 
     private:
-        std::set<chat_participant_ptr> participants_;
-        enum { max_recent_msgs = 100 };
-        chat_message_queue recent_msgs_;
-        chat_message handshake;
-};
+        void seat(chat_participant_ptr participant)
+        {
+            participants_.insert(participant);
+            countSeats();
+        }
 
-//----------------------------------------------------------------------
+        // numPlayers() is read from other threads, the seats gauge moves by the difference
+        void countSeats()
+        {
+            int seated = participants_.size();
+            metrics::add(metrics::seats, seated - seated_.load(std::memory_order_relaxed));
+            seated_.store(seated, std::memory_order_relaxed);
+        }
 
-class chat_session
-: public chat_participant,
-    public std::enable_shared_from_this<chat_session>
-{
-    public:
-        chat_session(tcp::socket socket, chat_room& room)
-            : socket_(std::move(socket)),
-            room_(room)
-    {
-    }
+        // seated players that are actually here
+        std::size_t present() const
+        {
+            std::size_t n = 0;
+            for (auto participant : participants_)
+                if (participant->present())
+                    n++;
+            return n;
+        }
 
-        void start() // client joins the chat room
+        // a stand-in for a player who isn't here
+        chat_participant_ptr hold(const chat_participant& p)
         {
-            //initializes a dealer only one time
-            if(!dealer_initialized)
-            {
-                dealer_initialized = true;
-                room_.dealer = new Dealer();
-                room_.dealer->id = 0;
-            }
-            room_.join(shared_from_this());
-            do_read_header();
+            auto held = std::make_shared<held_seat>();
+            held->id = p.id;
+            held->credits = p.credits;
+            held->bet = p.bet;
+            held->staked = p.staked;
+            held->player = p.player;
+            held->token = p.token;
+            held->name = p.name;
+            held->expires = std::chrono::steady_clock::now() + std::chrono::seconds(config_.hold_seconds);
+            held_++;
+            return held;
         }
 
-        void deliver(const chat_message& msg) // send saved past msg log
+        // participant takes the first held seat that matches, with its credits, bet and player
+        template <typename Match>
+        bool claim(chat_participant_ptr participant, Match match)
         {
-            bool write_in_progress = !write_msgs_.empty();
-            write_msgs_.push_back(msg);
-            if (!write_in_progress)
+            for (auto group : { &participants_, &waiting_ })
             {
-                do_write();
+                for (auto held : *group)
+                {
+                    if (held->present() || !match(*held))
+                        continue;
+                    participant->id = held->id;
+                    participant->credits = held->credits;
+                    participant->bet = held->bet;
+                    participant->staked = held->staked;
+                    participant->player = held->player;
+                    participant->token = held->token;
+                    participant->name = held->name;
+                    group->erase(held);
+                    group->insert(participant);
+                    held_--;
+                    dirty_ = true;
+                    if (group == &participants_ && !inplay && present() == 1)
+                        startClock();
+                    return true;
+                }
             }
+            return false;
         }
 
-
-    private:
-        // calls data() and waits for an async_write from client's do_write then calls decode
-        void do_read_header() 
+        // seats nobody came back for in time are given up as if their player left
+        void holdSeats()
         {
-            auto self(shared_from_this());
-            asio::async_read(socket_,
-                    asio::buffer(read_msg_.data(), chat_message::header_length),
-                    [this, self](std::error_code ec, std::size_t /*length*/)
+            auto next = std::chrono::steady_clock::time_point::max();
+            for (auto group : { &participants_, &waiting_ })
+                for (auto participant : *group)
+                    if (!participant->present())
+                        next = std::min(next, std::static_pointer_cast<held_seat>(participant)->expires);
+            if (held_ == 0)
+                return;
+            hold_timer_.expires_at(next);
+            hold_timer_.async_wait(asio::bind_executor(strand_,
+                        [this](std::error_code ec)
+                        {
+                        if (ec || held_ == 0)
+                            return;
+                        auto self = shared_from_this(); // the last leave may retire the table
+                        auto now = std::chrono::steady_clock::now();
+                        std::vector<chat_participant_ptr> gone;
+                        for (auto group : { &participants_, &waiting_ })
+                            for (auto participant : *group)
+                                if (!participant->present()
+                                        && std::static_pointer_cast<held_seat>(participant)->expires <= now)
+                                    gone.push_back(participant);
+                        held_ -= gone.size();
+                        for (auto participant : gone)
+                            leave(participant);
+                        holdSeats();
+                        if (!inplay && present() > 0)
+                            startClock();
+                        }));
+        }
+
+        // the round starts wait_seconds_ after the first player sits down
+        void startClock()
+        {
+            clock_ = true;
+            timer_.expires_after(std::chrono::seconds(config_.wait_seconds));
+            timer_.async_wait(asio::bind_executor(strand_,
+                        [this](std::error_code ec)
+                        {
+                        if (!ec)
+                        {
+                        clock_ = false;
+                        LOG_DEBUG("table {} clock ran out, dealing", id_);
+                        start_play();
+                        }
+                        }));
+        }
+
+        int freeSeat()
+        {
+            std::set<int> taken; // held seats are in here too
+            for (auto participant : participants_)
+                taken.insert(participant->id);
+            for (auto participant : waiting_)
+                taken.insert(participant->id);
+            int seat = 1;
+            while (taken.count(seat))
+                seat++;
+            return seat;
+        }
+
+        // next seat after this one that bet on the round, -1 for the dealer
+        int nextTurn(int after)
+        {
+            int next = -1;
+            for (auto participant : participants_)
+            {
+                if (participant->id > after && (next == -1 || participant->id < next)
+                        && game_.seats().count(participant->id))
+                    next = participant->id;
+            }
+            return next;
+        }
+
+        // everyone's cards go back, players who waited sit down, the table opens up again
+        void endRound()
+        {
+            dirty_ = true;
+            settle();
+            game_.clear();
+            turn = 0;
+            inplay = false;
+            if (game_.deck().cardsLeft() < table_game::shoe_cards / 4 || game_.deck().refilled() || reshuffle_) // cut card
+            {
+                // the finished shoe's seed and salt, with the next shoe's commitment
+                // straight to the players, a reveal replayed to someone who joins later would only confuse them
+                metrics::add(metrics::reshuffles, 1);
+                chat_message reveal;
+                reveal.ca.turn = -1;
+                if (committed_)
+                    revealShoe(shoe_, game_.dealt(), &reveal.ca);
+                newShoe();
+                commitment(reveal.ca);
+                reveal.encode_header();
+                for (auto group : { &participants_, &waiting_ })
+                    for (auto participant : *group)
+                        participant->deliver(reveal);
+            }
+            for (auto participant : waiting_)
+                seat(participant);
+            waiting_.clear();
+            if (!draining_)
+                lobby_.set_open(id_, true);
+            if (present() > 0)
+                startClock();
+        }
+
+        // a shoe from the maker, its commitment logged before the first card comes out of it
+        void newShoe()
+        {
+            trace::span span("shuffle", id_);
+            alloc_profile::scope tag("shuffle");
+            if (config_.shoes)
+                shoe_ = config_.shoes->take();
+            else
+            {
+                std::random_device random;
+                shoe_ = shoe_secret::make(random);
+            }
+            committed_ = true;
+            reshuffle_ = false;
+            game_.shuffle(shoe_.seed);
+            if (config_.shoe_log)
+            {
+                shoe_record r;
+                r.table = id_;
+                r.at_us = hand_record::now_us();
+                r.shoe = shoe_;
+                std::memset(r.shoe.salt, 0, sizeof(r.shoe.salt)); // not even the log gets it early
+                r.shoe.seed = 0;
+                config_.shoe_log->append(r.encode());
+            }
+        }
+
+        // a shoe is done, its seed and salt go into the log and, with ca, to the players
+        void revealShoe(const shoe_secret& shoe, int dealt, client_action* ca)
+        {
+            if (ca)
+            {
+                ca->revealed = true;
+                ca->shoe_seed = shoe.seed;
+                std::memcpy(ca->shoe_salt, shoe.salt, sizeof(ca->shoe_salt));
+            }
+            if (config_.shoe_log)
+            {
+                shoe_record r;
+                r.kind = shoe_record::kind_t::reveal;
+                r.table = id_;
+                r.at_us = hand_record::now_us();
+                r.shoe = shoe;
+                r.dealt = dealt;
+                config_.shoe_log->append(r.encode());
+            }
+        }
+
+        void commitment(client_action& ca) const
+        {
+            if (committed_)
+                std::memcpy(ca.commitment, shoe_.commitment, sizeof(ca.commitment));
+            else
+                std::memset(ca.commitment, 0, sizeof(ca.commitment));
+        }
+
+        // an action goes into the round being recorded, the first one opens it
+        void record(int seat, hand_action_kind kind)
+        {
+            if (round_.started_us == 0)
+            {
+                round_.started_us = hand_record::now_us();
+                round_.seed = game_.seed();
+                round_.shoe_offset = game_.dealt();
+            }
+            hand_action a;
+            a.seat = seat;
+            a.kind = kind;
+            a.at_ms = (hand_record::now_us() - round_.started_us) / 1000;
+            round_.actions.push_back(a);
+        }
+
+        // pays out every hand still at the table and hands the round to the log writer
+        void settle()
+        {
+            if (round_.started_us == 0)
+                return;
+            trace::span span("settle", id_);
+            alloc_profile::scope tag("settle");
+            round_.round = ++rounds_;
+            metrics::add(metrics::rounds, 1);
+            round_.table = id_;
+            round_.stake = stake_;
+            round_.finished_us = hand_record::now_us();
+            round_.dealer = game_.dealer.hand().inHand;
+            std::vector<ledger_tx> payouts;
+            for (auto participant : participants_)
+            {
+                auto cards = game_.seats().find(participant->id);
+                int bet = participant->bet;
+                participant->bet = 0; // every round is bet on afresh
+                if (cards == game_.seats().end())
+                    continue;
+                if (participant->staked == 0)
+                {
+                    // cards without a stake behind them win nothing
+                    LOG_ERROR("table {} round {} seat {}: cards but nothing staked, not paid", id_, round_.round,
+                            participant->id);
+                    continue;
+                }
+                const std::vector<Hand>& hands = cards->second.hands();
+                hand_seat seat;
+                seat.player = participant->player;
+                seat.seat = participant->id;
+                seat.bet = bet;
+                for (auto& hand : hands)
+                    seat.hands.push_back(hand.inHand);
+                seat.payout = game_.settle(participant->id, bet);
+                // the stakes were taken when the cards were dealt and split, they come back with the
+                // winnings. every hand has to have been staked, or the round nets out wrong
+                std::int64_t staked = seat.bet * (std::int64_t)hands.size();
+                if (participant->staked != staked)
+                    LOG_ERROR("table {} round {} seat {}: {} staked for {} hands of {}", id_, round_.round,
+                            seat.seat, participant->staked, hands.size(), seat.bet);
+                ledger_tx tx;
+                tx.kind = ledger_kind::payout;
+                tx.player = participant->player;
+                tx.amount = participant->staked + seat.payout;
+                participant->staked = 0;
+                tx.ref = roundRef(round_.round);
+                payouts.push_back(tx); // a loss pays 0, it still closes the bet
+                participant->credits += tx.amount;
+                if (player_profiles && !participant->name.empty())
+                {
+                    int credits = participant->credits;
+                    std::int64_t net = seat.payout;
+                    std::size_t played = hands.size();
+                    player_profiles->update(participant->name, [=](player_profile& p)
+                            {
+                            p.credits = credits;
+                            p.hands += played;
+                            p.wins += net > 0;
+                            p.net += net;
+                            });
+                }
+                round_.seats.push_back(seat);
+            }
+            // a refused payout didn't happen, the seats take their balances from the ledger
+            if (config_.credits && config_.credits->apply(payouts) > 0)
+                for (auto participant : participants_)
+                    participant->credits = config_.credits->balance(participant->player);
+            if (config_.hands)
+                config_.hands->append(round_.encode());
+            round_ = hand_record();
+        }
+
+        std::uint64_t roundRef(std::uint32_t round) const
+        {
+            return (std::uint64_t)id_ << 32 | round;
+        }
+
+        // everyone is done, the dealer plays out the hand
+        void dealerPlay()
+        {
+            trace::span span("dealer play", id_, 0);
+            alloc_profile::scope tag("dealer play");
+            record(0, hand_action_kind::dealer);
+            game_.dealerPlay();
+        }
+
+        std::shared_ptr<table_usage> usage_ = std::make_shared<table_usage>(); // before the strand, which charges it
+        table_strand strand_;
+        asio::steady_timer timer_;
+        asio::steady_timer hold_timer_;
+        lobby<chat_room>& lobby_;
+        table_config config_;
+        hand_record round_;
+        std::uint32_t rounds_ = 0;
+        int id_;
+        int stake_;
+        table_game game_;
+        shoe_secret shoe_;
+        bool committed_ = false; // false for a shoe from a snapshot that had no salt
+        bool reshuffle_ = false; // the shoe came from a snapshot, a new one after this round
+        int turn = 0;
+        bool inplay = false;
+        bool draining_ = false;
+        bool clock_ = false; // counting down to the deal
+        int held_ = 0;      // seats waiting for their player to come back
+        bool dirty_ = true; // changed since the last crash snapshot
+        std::atomic<int> seated_{0};
+        std::set<chat_participant_ptr> participants_;
+        std::set<chat_participant_ptr> waiting_;
+        enum { max_recent_msgs = 100 };
+        chat_message_queue recent_msgs_;
+        chat_message handshake;
+};
+
+//----------------------------------------------------------------------
+
+class chat_session;
+
+// which sessions live on which io thread, for the rebalancer
+class session_registry
+{
+    public:
+        explicit session_registry(std::size_t threads)
+            : homes_(threads)
+        {
+        }
+
+        void add(std::size_t home, std::shared_ptr<chat_session> session)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            homes_[home][session.get()] = session;
+        }
+
+        void remove(std::size_t home, chat_session* session)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            homes_[home].erase(session);
+        }
+
+        std::vector<std::size_t> load()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<std::size_t> result;
+            for (auto& home : homes_)
+                result.push_back(home.size());
+            return result;
+        }
+
+        std::vector<std::shared_ptr<chat_session>> all()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<std::shared_ptr<chat_session>> result;
+            for (auto& home : homes_)
+                for (auto& entry : home)
+                    if (auto session = entry.second.lock())
+                        result.push_back(session);
+            return result;
+        }
+
+        // up to count live sessions on one thread
+        std::vector<std::shared_ptr<chat_session>> pick(std::size_t home, std::size_t count)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<std::shared_ptr<chat_session>> result;
+            for (auto& entry : homes_[home])
+            {
+                if (result.size() == count)
+                    break;
+                if (auto session = entry.second.lock())
+                    result.push_back(session);
+            }
+            return result;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<std::map<chat_session*, std::weak_ptr<chat_session>>> homes_;
+};
+
+//----------------------------------------------------------------------
+
+// a player's connection
+// everything except deliver() runs on the session's home io thread
+// the session can move to another table and to another io thread without touching the TCP connection
+class chat_session
+: public chat_participant,
+    public std::enable_shared_from_this<chat_session>
+{
+    public:
+        // what the next server process needs to carry on with this connection
+        struct handoff_record
+        {
+            int fd = -1;
+            int table = 0;
+            int seat = 0;
+            std::uint32_t player = 0;
+            bool read_body = false;
+            std::string partial; // bytes of the message being read when we stopped
+        };
+
+        chat_session(tcp::socket socket, const queue_limits& limits,
+                io_context_pool& pool, session_registry& registry)
+            : socket_(std::move(socket)),
+            write_msgs_(limits),
+            pool_(pool),
+            registry_(registry),
+            home_(&static_cast<asio::io_context&>(socket_.get_executor().context()))
+    {
+        player = player_numbers++;
+        metrics::add(metrics::sessions, 1);
+    }
+
+        ~chat_session()
+        {
+            metrics::add(metrics::sessions, -1);
+            registry_.remove(pool_.index_of(*home_.load()), this);
+        }
+
+        // a new connection says hello first, with a resume token if it had a seat before
+        // clients that don't greet are seated after hello_ms like they always were
+        void start(lobby<chat_room>& tables, int stake)
+        {
+            tables_ = &tables;
+            stake_ = stake;
+            auto self(shared_from_this());
+            hello_timer_.reset(new asio::steady_timer(*home_.load()));
+            hello_timer_->expires_after(std::chrono::milliseconds(hello_ms));
+            hello_timer_->async_wait([this, self](std::error_code ec)
                     {
-                    if (!ec && read_msg_.decode_header()) 
+                    if (!ec && !room_)
+                        join(tables_->place(stake_));
+                    });
+            do_read_header();
+        }
+
+        void join(std::shared_ptr<chat_room> room) // client joins the chat room the lobby picked
+        {
+            room_ = room;
+            auto self(shared_from_this());
+            registry_.add(pool_.index_of(*home_.load()), self);
+            asio::post(room_->strand(), [this, self]() { room_->join(self); });
+        }
+
+        // a connection handed over by the previous server process
+        // sits back down quietly and picks the read up where the old process stopped
+        void resume(std::shared_ptr<chat_room> room, const handoff_record& r)
+        {
+            room_ = room;
+            id = r.seat;
+            player = r.player;
+            auto self(shared_from_this());
+            registry_.add(pool_.index_of(*home_.load()), self);
+            asio::post(room_->strand(), [this, self]() { room_->restoreSeat(self); });
+
+            std::memcpy(read_msg_.data(), r.partial.data(), r.partial.size());
+            if (r.read_body)
+            {
+                read_msg_.decode_header();
+                read_done_ = r.partial.size() - chat_message::header_length;
+                post_home([this]() { do_read_body(); });
+            }
+            else
+            {
+                read_done_ = r.partial.size();
+                post_home([this]() { do_read_header(); });
+            }
+        }
+
+        // called on the room's strand, the queue belongs to this session's thread
+        // messages are numbered as the tables hand them over, a thread move can't reorder them
+        void deliver(const chat_message& msg) // send saved past msg log
+        {
+            std::uint64_t seq = delivered_.fetch_add(1, std::memory_order_relaxed);
+            post_home([this, msg, seq]() { queue_in_order(msg, seq); });
+        }
+
+        queue_stats queue_info() const
+        {
+            return write_msgs_.stats();
+        }
+
+        void disconnect()
+        {
+            post_home([this]() { socket_.close(); });
+        }
+
+        // called on the old table's strand
+        // leaves it, then joins target where the lobby reserved the seat
+        // credits and queued messages stay with the session
+        void move_table(std::shared_ptr<chat_room> target)
+        {
+            post_home([this, target]()
                     {
+                    auto self(shared_from_this());
+                    auto old = room_;
+                    room_ = target;
+                    asio::post(old->strand(), [self, old, target]()
+                            {
+                            old->leave(self);
+                            asio::post(target->strand(), [self, target]() { target->join(self); });
+                            });
+                    });
+        }
 
-                      if(read_msg_.ca.play == true)
-                      {
-
-                          if(!deal) //deal cards to dealer first time only
-                          {
-                            room_.giveCard(0);
-                            room_.giveCard(0);
-                            deal = true;
-                          }
-                          room_.giveCard(read_msg_.ca.id);
-                          room_.giveCard(read_msg_.ca.id);
-                          std::string gui = room_.stringOfCards();
-                          char g[gui.size() +1 ];
-                          std::copy(gui.begin(), gui.end(), g);
-                          g[gui.size()] = '\0';
-                          strcpy(read_msg_.ca.g, g);
-			  read_msg_.ca.split_button = room_.canBeSplit(read_msg_.ca.id);
-                      }
-
-                      if(read_msg_.ca.hit == true)
-                      {
-                          room_.giveCard(read_msg_.ca.id); 
-                          std::string gui = room_.stringOfCards();
-                          bool busted = room_.check_points(read_msg_.ca.id);
-
-                          char g[gui.size() +1 ];
-                          std::copy(gui.begin(), gui.end(), g);
-                          g[gui.size()] = '\0';
-                          strcpy(read_msg_.ca.g, g);
-                          if(busted)
-                            read_msg_.ca.stand = true;
-                      }
-                      else if(read_msg_.ca.split == true)
-                      {
-                          room_.splitHand(read_msg_.ca.id);
-			  read_msg_.ca.split_button = room_.canBeSplit(read_msg_.ca.id);
-                          std::string gui = room_.stringOfCards();
-                          bool busted = room_.check_points(read_msg_.ca.id);
-
-                          char g[gui.size() +1 ];
-                          std::copy(gui.begin(), gui.end(), g);
-                          g[gui.size()] = '\0';
-                          strcpy(read_msg_.ca.g, g);
-                          if(busted)
-                            read_msg_.ca.stand = true;
-                      }
-
-                      if(read_msg_.ca.stand == true)
-                      {
-                          //if setNextHand true, it sets player hand to next hand
-                          if(!room_.setNextHand(read_msg_.ca.id))
-                          {
-                            if(turn < room_.sizeOfParticipants())
+        // hands the socket to another io thread at a message boundary
+        // the write in flight finishes first, a half read message carries on where it stopped
+        void move_thread(asio::io_context& target)
+        {
+            post_home([this, &target]()
+                    {
+                    if (&target == home_.load() || paused_ || !socket_.is_open())
+                        return;
+                    pause([this, &target]() { switch_thread(target); }, false);
+                    });
+        }
+
+        // stops all io once the queue is written out and gives up the socket, for a server handoff
+        void detach(std::function<void(const handoff_record&)> done)
+        {
+            post_home([this, done]()
+                    {
+                    if (paused_) // a thread move is still going, try again once it's done
+                    {
+                        detach(done);
+                        return;
+                    }
+                    if (!socket_.is_open())
+                    {
+                        done(handoff_record());
+                        return;
+                    }
+                    pause([this, done]()
                             {
-                              turn++;
-                            }
-                            else
+                            handoff_record r;
+                            r.table = room_->id();
+                            r.seat = id;
+                            r.player = player;
+                            r.read_body = read_body_;
+                            r.partial.assign(read_msg_.data(),
+                                    (read_body_ ? chat_message::header_length : 0) + read_done_);
+                            asio::error_code ec;
+                            r.fd = socket_.release(ec);
+                            if (ec)
+                                r.fd = -1;
+                            done(r);
+                            }, true);
+                    });
+        }
+
+    private:
+        enum { hello_ms = 200 };
+
+        // the first message of a connection, it only decides where the player sits
+        void greet(const chat_message& msg)
+        {
+            alloc_profile::scope tag("hello");
+            hello_timer_->cancel();
+            // a named player plays on their profile's number and credits, wherever they sit
+            // a name registered to someone else, without its key, plays as a guest
+            std::string who(msg.ca.name, strnlen(msg.ca.name, sizeof(msg.ca.name)));
+            if (player_profiles && !who.empty())
+            {
+                player_profile p;
+                if (player_profiles->open(who, msg.ca.profile_key, msg.ca.client_credits,
+                            []() { return player_numbers++; }, p))
+                {
+                    player = p.player;
+                    credits = p.credits;
+                    name = p.name;
+                    key = p.key;
+                    player_profiles->update(name, [](player_profile& p) { p.seen_us = hand_record::now_us(); });
+                }
+                else
+                    LOG_INFO("Hello as {} without its profile key, playing as a guest", who);
+            }
+            auto room = msg.ca.resume ? resume_tokens.find(msg.ca.token) : std::shared_ptr<chat_room>();
+            if (!room)
+            {
+                join(tables_->place(stake_));
+                return;
+            }
+            room_ = room;
+            auto self(shared_from_this());
+            registry_.add(pool_.index_of(*home_.load()), self);
+            std::uint64_t token = msg.ca.token;
+            asio::post(room->strand(), [this, self, room, token]()
+                    {
+                    if (room->reclaim(self, token))
+                        return;
+                    // the seat was given up in the meantime, sit down like anyone new
+                    post_home([this]() { join(tables_->place(stake_)); });
+                    });
+        }
+
+        // runs f on the home thread, following the session if it moved in the meantime
+        template <typename Handler>
+        void post_home(Handler f)
+        {
+            auto self(shared_from_this());
+            asio::post(*home_.load(), [this, self, f]()
+                    {
+                    if (!home_.load()->get_executor().running_in_this_thread())
+                        post_home(f);
+                    else
+                        f();
+                    });
+        }
+
+        // stops reading at the next message boundary (or mid message, remembering how far it got)
+        // and runs then once no read or write is outstanding
+        // with flush the whole queue is written first
+        void pause(std::function<void()> then, bool flush)
+        {
+            paused_ = then;
+            flush_ = flush;
+            if (!writing_ && flush_ && !write_msgs_.empty())
+                do_write();
+            if (!writing_ && reading_)
+                socket_.cancel();
+            try_pause();
+        }
+
+        void try_pause()
+        {
+            if (!paused_ || writing_ || reading_)
+                return;
+            std::function<void()> then;
+            then.swap(paused_);
+            then();
+        }
+
+        void switch_thread(asio::io_context& to)
+        {
+            asio::io_context& from = *home_.load();
+            tcp::socket moved(to);
+            asio::error_code ec;
+            auto protocol = socket_.local_endpoint(ec).protocol();
+            auto fd = socket_.release(ec);
+            if (!ec)
+                moved.assign(protocol, fd, ec);
+            if (ec)
+            {
+                leave();
+                return;
+            }
+            socket_ = std::move(moved);
+            registry_.remove(pool_.index_of(from), this);
+            registry_.add(pool_.index_of(to), shared_from_this());
+            home_.store(&to);
+            metrics::add(metrics::thread_moves, 1);
+
+            // pick up the read and the queued writes on the new thread
+            post_home([this]()
+                    {
+                    if (read_body_)
+                        do_read_body();
+                    else
+                        do_read_header();
+                    if (!write_msgs_.empty())
+                        do_write();
+                    });
+        }
+
+        // a read that was cancelled for a pause, true if the caller should stop
+        bool stopped(std::error_code ec, std::size_t length)
+        {
+            if (ec != asio::error::operation_aborted || !paused_)
+                return false;
+            read_done_ += length;
+            try_pause();
+            return true;
+        }
+
+        // a message posted to the old thread before a move gets here after the ones posted to the
+        // new thread straight away, those wait for it
+        void queue_in_order(const chat_message& msg, std::uint64_t seq)
+        {
+            if (seq != queued_)
+            {
+                early_.emplace(seq, msg);
+                return;
+            }
+            queue_msg(msg);
+            queued_++;
+            for (auto it = early_.begin(); it != early_.end() && it->first == queued_; it = early_.erase(it))
+            {
+                queue_msg(it->second);
+                queued_++;
+            }
+        }
+
+        void queue_msg(const chat_message& msg)
+        {
+            alloc_profile::scope tag("queue");
+            switch (write_msgs_.push(msg))
+            {
+                case send_queue::queued:
+                    break;
+                case send_queue::need_resync:
+                {
+                    // the snapshot has to be taken on the room's strand
+                    auto room = room_;
+                    auto self(shared_from_this());
+                    asio::post(room->strand(), [this, self, room]()
                             {
-                              turn = -1; //everyone is finished so dealer's turn
-                              reveal = true;
-                              room_.dealer->deal();
-                              std::string gui = room_.stringOfCards();
-
-                              char g[gui.size() +1 ];
-                              std::copy(gui.begin(), gui.end(), g);
-                              g[gui.size()] = '\0';
-                              strcpy(read_msg_.ca.g, g);
-                            }
-                          }
-                      }
+                            chat_message snap = room->snapshot(id);
+                            post_home([this, snap]()
+                                    {
+                                    write_msgs_.push_snapshot(snap);
+                                    if (!writing_ && (!paused_ || flush_))
+                                        do_write();
+                                    });
+                            });
+                    break;
+                }
+                case send_queue::need_disconnect:
+                    // read/write handlers see the error and leave the room
+                    LOG_WARN("Player {} too slow, disconnecting", id);
+                    socket_.close();
+                    return;
+            }
+            if (!writing_ && (!paused_ || flush_) && !write_msgs_.empty())
+            {
+                do_write();
+            }
+        }
+
+        // the connection is gone, the table holds the seat for a while
+        void leave()
+        {
+            if (hello_timer_)
+                hello_timer_->cancel();
+            if (!room_)
+                return;
+            auto self(shared_from_this());
+            auto room = room_;
+            asio::post(room->strand(), [self, room]() { room->drop(self); });
+        }
 
+        // calls data() and waits for an async_write from client's do_write then calls decode
+        void do_read_header() 
+        {
+            read_body_ = false;
+            if (paused_) // the read finished before the cancel got to it
+            {
+                try_pause();
+                return;
+            }
+            auto self(shared_from_this());
+            reading_ = true;
+            asio::async_read(socket_,
+                    asio::buffer(read_msg_.data() + read_done_, chat_message::header_length - read_done_),
+                    [this, self](std::error_code ec, std::size_t length)
+                    {
+                    reading_ = false;
+                    if (stopped(ec, length))
+                        return;
+                    read_done_ = 0;
+                    read_ns_ = latency::now_ns();
+                    if (!ec && read_msg_.decode_header()) 
+                    {
                       do_read_body(); 
                     }
                     else
                     {
-                        room_.leave(shared_from_this());
+                        leave();
+                    }
+                    });
+        }
+
+        void do_read_body()
+        {
+            read_body_ = true;
+            if (paused_)
+            {
+                try_pause();
+                return;
+            }
+            auto self(shared_from_this());
+            reading_ = true;
+            asio::async_read(socket_,
+                    asio::buffer(read_msg_.body() + read_done_, read_msg_.body_length() - read_done_),
+                    [this, self](std::error_code ec, std::size_t length)
+                    {
+                    reading_ = false;
+                    if (stopped(ec, length))
+                        return;
+                    read_done_ = 0;
+                    alloc_profile::scope tag("read");
+                    if (!ec)
+                    {
+                        metrics::add(metrics::messages_in, 1);
+                        metrics::add(metrics::bytes_in, read_msg_.length());
+                    }
+                    if (!ec && !room_ && tables_)
+                    {
+                    greet(read_msg_);
+                    do_read_header();
+                    }
+                    else if (!ec)
+                    {
+                    // the game itself runs on the room's strand
+                    chat_message msg = read_msg_;
+                    auto room = room_;
+                    std::int64_t read_ns = read_ns_;
+                    asio::post(room->strand(), [self, room, msg, read_ns]() { room->on_action(self, msg, read_ns); });
+
+                    //room_.deliver(read_msg_, id); // can send to specific client
+
+                    do_read_header();
+                    }
+                    else
+                    {
+                    leave();
+                    }
+                    });
+        }
+
+        void do_write()
+        {
+            auto self(shared_from_this());
+            writing_ = true;
+            // from handing the message to the socket until it is all written
+            std::int64_t start_ns = trace::enabled() ? latency::now_ns() : 0;
+            asio::async_write(socket_,
+                    asio::buffer(write_msgs_.front().data(),
+                        write_msgs_.front().length()),
+                    [this, self, start_ns](std::error_code ec, std::size_t /*length*/)
+                    {
+                    writing_ = false;
+                    trace::complete("write", start_ns, room_ ? room_->id() : -1, id);
+                    alloc_profile::scope tag("write");
+                    if (!ec)
+                    {
+                    metrics::add(metrics::messages_out, 1);
+                    metrics::add(metrics::bytes_out, write_msgs_.front().length());
+                    write_msgs_.pop_front();
+                    if (!write_msgs_.empty() && (!paused_ || flush_))
+                    {
+                    do_write();
+                    }
+                    else if (paused_)
+                    {
+                    // the write was what held the pause up, now stop the read
+                    if (reading_)
+                        socket_.cancel();
+                    try_pause();
+                    }
+                    }
+                    else
+                    {
+                    leave();
+                    }
+                    });
+        }
+
+        tcp::socket socket_;
+        std::shared_ptr<chat_room> room_;
+        chat_message read_msg_;
+        send_queue write_msgs_;
+        std::atomic<std::uint64_t> delivered_{0}; // numbers handed out by deliver()
+        std::uint64_t queued_ = 0;                // the next number queue_in_order() takes
+        std::map<std::uint64_t, chat_message> early_; // overtook one still on its way from the old thread
+        io_context_pool& pool_;
+        session_registry& registry_;
+        std::atomic<asio::io_context*> home_;
+        std::function<void()> paused_; // set while io is being stopped
+        bool flush_ = false;
+        bool reading_ = false;
+        bool writing_ = false;
+        bool read_body_ = false;
+        std::size_t read_done_ = 0; // bytes of the current header/body already read
+        std::int64_t read_ns_ = 0;  // when the current message's header was in
+        lobby<chat_room>* tables_ = nullptr; // where a new connection gets seated
+        int stake_ = 0;
+        std::unique_ptr<asio::steady_timer> hello_timer_;
+};
+
+//----------------------------------------------------------------------
+
+// evens out the number of sessions per io thread and folds lonely players into busier tables
+class rebalancer
+{
+    public:
+        rebalancer(io_context_pool& pool, session_registry& sessions,
+                lobby<chat_room>& tables, int seconds)
+            : pool_(pool),
+            sessions_(sessions),
+            tables_(tables),
+            timer_(pool.get(0)),
+            seconds_(seconds)
+        {
+            schedule();
+        }
+
+        void run()
+        {
+            std::vector<std::size_t> load = sessions_.load();
+            std::size_t busiest = 0, idlest = 0;
+            for (std::size_t i = 0; i < load.size(); ++i)
+            {
+                if (load[i] > load[busiest])
+                    busiest = i;
+                if (load[i] < load[idlest])
+                    idlest = i;
+            }
+            std::size_t excess = (load[busiest] - load[idlest]) / 2;
+            if (excess > 0)
+            {
+                for (auto& session : sessions_.pick(busiest, excess))
+                    session->move_thread(pool_.get(idlest));
+            }
+
+            for (auto& table : tables_.tables())
+                asio::post(table->strand(), [table]() { table->breakUp(); });
+        }
+
+    private:
+        void schedule()
+        {
+            timer_.expires_after(std::chrono::seconds(seconds_));
+            timer_.async_wait([this](std::error_code ec)
+                    {
+                    if (!ec)
+                    {
+                    run();
+                    schedule();
+                    }
+                    });
+        }
+
+        io_context_pool& pool_;
+        session_registry& sessions_;
+        lobby<chat_room>& tables_;
+        asio::steady_timer timer_;
+        int seconds_;
+};
+
+// hands every table that changed to the crash snapshot store, a table encodes itself on its own strand
+class snapshotter
+{
+    public:
+        snapshotter(asio::io_context& io_context, lobby<chat_room>& tables, table_store& store, int interval_ms)
+            : tables_(tables),
+            store_(store),
+            timer_(io_context),
+            interval_ms_(interval_ms)
+        {
+            schedule();
+        }
+
+        void run()
+        {
+            std::set<int> ids;
+            for (auto& table : tables_.tables())
+            {
+                ids.insert(table->id());
+                table_store* store = &store_;
+                asio::post(table->strand(), [table, store]()
+                        {
+                        if (auto state = table->changes())
+                            store->put(table->id(), state);
+                        });
+            }
+            store_.retain(ids);
+        }
+
+    private:
+        void schedule()
+        {
+            timer_.expires_after(std::chrono::milliseconds(interval_ms_));
+            timer_.async_wait([this](std::error_code ec)
+                    {
+                    if (!ec)
+                    {
+                    run();
+                    schedule();
+                    }
+                    });
+        }
+
+        lobby<chat_room>& tables_;
+        table_store& store_;
+        asio::steady_timer timer_;
+        int interval_ms_;
+};
+
+// logs the action latencies every so many seconds, all of them since the start
+class latency_reporter
+{
+    public:
+        latency_reporter(asio::io_context& io_context, int seconds)
+            : timer_(io_context),
+            seconds_(seconds)
+        {
+            schedule();
+        }
+
+        void run()
+        {
+            std::vector<latency::histogram> all = latency::recorder::instance().scrape();
+            for (std::size_t k = 0; k < all.size(); ++k)
+            {
+                const latency::histogram& h = all[k];
+                if (h.count() == 0)
+                    continue;
+                LOG_INFO("{}: {} actions, mean {} us, p50 {} us, p90 {} us, p99 {} us, p99.9 {} us, max {} us",
+                        latency::name(static_cast<latency::action>(k)), h.count(), h.mean() / 1000,
+                        h.percentile(0.5) / 1000.0, h.percentile(0.9) / 1000.0, h.percentile(0.99) / 1000.0,
+                        h.percentile(0.999) / 1000.0, h.max() / 1000.0);
+            }
+        }
+
+    private:
+        void schedule()
+        {
+            timer_.expires_after(std::chrono::seconds(seconds_));
+            timer_.async_wait([this](std::error_code ec)
+                    {
+                    if (!ec)
+                    {
+                    run();
+                    schedule();
                     }
                     });
         }
 
-        void do_read_body()
+        asio::steady_timer timer_;
+        int seconds_;
+};
+
+//----------------------------------------------------------------------
+
+// turns tracing on and writes the spans to a file on every SIGUSR1
+// the file is replaced whole, it always holds the last events_per_thread spans of every thread
+class trace_dumper
+{
+    public:
+        trace_dumper(asio::io_context& io_context, const std::string& file)
+            : signals_(io_context, SIGUSR1),
+            file_(file)
         {
-            auto self(shared_from_this());
-            asio::async_read(socket_,
-                    asio::buffer(read_msg_.body(), read_msg_.body_length()),
-                    [this, self](std::error_code ec, std::size_t /*length*/)
+            trace::recorder::instance().enable();
+            schedule();
+        }
+
+        void run()
+        {
+            std::string json = trace::recorder::instance().dump();
+            std::string tmp = file_ + ".tmp";
+            std::FILE* out = std::fopen(tmp.c_str(), "w");
+            bool ok = out && std::fwrite(json.data(), 1, json.size(), out) == json.size();
+            if (out && std::fclose(out) != 0)
+                ok = false;
+            if (ok && std::rename(tmp.c_str(), file_.c_str()) == 0)
+                LOG_INFO("Trace of {} bytes written to {}", json.size(), file_);
+            else
+                LOG_ERROR("Can't write the trace to {}", file_);
+        }
+
+    private:
+        void schedule()
+        {
+            signals_.async_wait([this](std::error_code ec, int /*signo*/)
                     {
                     if (!ec)
                     {
+                    run();
+                    schedule();
+                    }
+                    });
+        }
 
-                    read_msg_.ca.turn = turn;
-                    read_msg_.encode_header(); // save info in msg to be sent to client
-                    std::cout << "Here\n" << read_msg_.ca.turn << std::endl;
-                    room_.deliver(read_msg_); // deliver msg to all clients
+        asio::signal_set signals_;
+        std::string file_;
+};
 
+//----------------------------------------------------------------------
 
-                    //room_.deliver(read_msg_, id); // can send to specific client
+// the most expensive tables so far, for the metrics endpoint's /tables page
+//   /tables?by=cpu|handlers|allocs|bytes&n=<tables>    cpu and 20 unless given
+// a table's counts go with it when it is retired
+std::string top_tables(lobby<chat_room>& tables, const std::string& query)
+{
+    std::string by = "cpu";
+    std::size_t n = 20;
+    std::istringstream params(query);
+    std::string param;
+    while (std::getline(params, param, '&'))
+    {
+        if (param.compare(0, 3, "by=") == 0)
+            by = param.substr(3);
+        else if (param.compare(0, 2, "n=") == 0)
+            n = std::strtoul(param.c_str() + 2, nullptr, 10);
+    }
+    const std::atomic<std::int64_t> table_usage::* key = by == "handlers" ? &table_usage::handlers
+        : by == "allocs" ? &table_usage::allocations : by == "bytes" ? &table_usage::allocated_bytes
+        : &table_usage::cpu_ns;
 
-                    do_read_header();
-                    }
-                    else
-                    {
-                    room_.leave(shared_from_this());
-                    }
-                    });
+    struct row
+    {
+        int id, stake, seats;
+        std::int64_t cpu_ns, handlers, allocations, allocated_bytes, key;
+    };
+    std::vector<row> rows;
+    for (auto& table : tables.tables())
+    {
+        const table_usage& u = table->usage();
+        row r;
+        r.id = table->id();
+        r.stake = table->stake();
+        r.seats = table->numPlayers();
+        r.cpu_ns = u.cpu_ns.load(std::memory_order_relaxed);
+        r.handlers = u.handlers.load(std::memory_order_relaxed);
+        r.allocations = u.allocations.load(std::memory_order_relaxed);
+        r.allocated_bytes = u.allocated_bytes.load(std::memory_order_relaxed);
+        r.key = (u.*key).load(std::memory_order_relaxed);
+        rows.push_back(r);
+    }
+    n = std::min(n, rows.size());
+    std::partial_sort(rows.begin(), rows.begin() + n, rows.end(),
+            [](const row& a, const row& b) { return a.key > b.key; });
+
+    std::ostringstream out;
+    out << rows.size() << " tables, top " << n << " by " << by << "\n"
+        << std::setw(8) << "table" << std::setw(7) << "stake" << std::setw(7) << "seats"
+        << std::setw(12) << "cpu ms" << std::setw(11) << "handlers" << std::setw(12) << "us/handler"
+        << std::setw(12) << "allocs" << std::setw(12) << "KB" << std::setw(14) << "bytes/handler" << "\n"
+        << std::fixed;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const row& r = rows[i];
+        double handlers = std::max<std::int64_t>(1, r.handlers);
+        out << std::setw(8) << r.id << std::setw(7) << r.stake << std::setw(7) << r.seats
+            << std::setprecision(1) << std::setw(12) << r.cpu_ns / 1e6 << std::setw(11) << r.handlers
+            << std::setw(12) << r.cpu_ns / 1e3 / handlers << std::setw(12) << r.allocations
+            << std::setw(12) << r.allocated_bytes / 1024.0 << std::setprecision(0)
+            << std::setw(14) << r.allocated_bytes / handlers << "\n";
+    }
+    return out.str();
+}
+
+//----------------------------------------------------------------------
+
+// an operator console on a unix socket, one command per line, every reply ends with an empty line
+//
+//   tables           every table on one line
+//   table <id>       one table with its seats, queues and cards
+//   drain <id>       no new rounds or players, the round in play finishes
+//   close <id>       drain and send everyone away, held seats are given up
+//   help, quit
+//
+// commands run on the tables' strands, the console's own thread never waits for one.
+// a table that doesn't answer within answer_ms is reported as stuck instead.
+//   socat - UNIX-CONNECT:/tmp/bj-admin.sock
+class admin_console
+{
+    public:
+        typedef asio::local::stream_protocol protocol;
+
+        admin_console(asio::io_context& io_context, lobby<chat_room>& tables, const std::string& path)
+            : acceptor_(io_context),
+            tables_(tables),
+            path_(path)
+        {
+            ::unlink(path.c_str());
+            acceptor_.open();
+            acceptor_.bind(protocol::endpoint(path));
+            ::chmod(path.c_str(), 0600); // the console can close tables, only the server's user gets in
+            acceptor_.listen();
+            LOG_INFO("Admin console on {}", path);
+            do_accept();
         }
 
-        void do_write()
+        ~admin_console()
         {
-            auto self(shared_from_this());
-            asio::async_write(socket_,
-                    asio::buffer(write_msgs_.front().data(),
-                        write_msgs_.front().length()),
-                    [this, self](std::error_code ec, std::size_t /*length*/)
-                    {
-                    if (!ec)
-                    {
-                    write_msgs_.pop_front();
-                    if (!write_msgs_.empty())
+            ::unlink(path_.c_str());
+        }
+
+    private:
+        enum { answer_ms = 1000, max_line = 1024 };
+
+        class connection : public std::enable_shared_from_this<connection>
+        {
+            public:
+                connection(protocol::socket socket, lobby<chat_room>& tables)
+                    : socket_(std::move(socket)),
+                    tables_(tables),
+                    in_(max_line)
+                {
+                }
+
+                void do_read()
+                {
+                    auto self(shared_from_this());
+                    asio::async_read_until(socket_, in_, '\n',
+                            [this, self](std::error_code ec, std::size_t)
+                            {
+                            if (ec)
+                                return;
+                            std::istream lines(&in_);
+                            std::string line;
+                            std::getline(lines, line);
+                            run(line);
+                            });
+                }
+
+            private:
+                void run(const std::string& line)
+                {
+                    std::istringstream words(line);
+                    std::string command;
+                    int id = 0;
+                    words >> command >> id;
+                    if (command.empty())
+                        do_read();
+                    else if (command == "quit")
+                        socket_.close();
+                    else if (command == "help")
+                        reply("tables | table <id> | drain <id> | close <id> | quit\n");
+                    else if (command == "tables")
                     {
-                    do_write();
-                    }
+                        std::vector<std::shared_ptr<chat_room>> all = tables_.tables();
+                        std::sort(all.begin(), all.end(),
+                                [](const std::shared_ptr<chat_room>& a, const std::shared_ptr<chat_room>& b)
+                                { return a->id() < b->id(); });
+                        ask(all, [](chat_room& table) { return table.describe(false); });
                     }
+                    else if (command != "table" && command != "drain" && command != "close")
+                        reply("unknown command " + command + ", try help\n");
+                    else if (!tables_.find(id))
+                        reply("no table " + std::to_string(id) + "\n");
+                    else if (command == "table")
+                        ask({ tables_.find(id) }, [](chat_room& table) { return table.describe(true); });
+                    else if (command == "drain")
+                        ask({ tables_.find(id) }, [](chat_room& table)
+                                { table.drain(); return "table " + std::to_string(table.id()) + " draining\n"; });
                     else
+                        ask({ tables_.find(id) }, [](chat_room& table)
+                                { table.close(); return "table " + std::to_string(table.id()) + " closing\n"; });
+                }
+
+                // f runs on every table's strand, the answers come back here in order
+                void ask(const std::vector<std::shared_ptr<chat_room>>& tables, std::function<std::string(chat_room&)> f)
+                {
+                    struct answers
+                    {
+                        std::mutex mutex;
+                        std::vector<std::string> text;
+                        std::size_t left;
+                        bool sent = false;
+                    };
+                    auto self(shared_from_this());
+                    auto a = std::make_shared<answers>();
+                    a->text.resize(tables.size());
+                    a->left = tables.size();
+                    // whichever comes first, the last answer or the deadline, sends the reply
+                    auto send = [this, self, a, tables]()
                     {
-                    room_.leave(shared_from_this());
+                        std::string out;
+                        {
+                            std::lock_guard<std::mutex> lock(a->mutex);
+                            if (a->sent)
+                                return;
+                            a->sent = true;
+                            for (std::size_t i = 0; i < tables.size(); ++i)
+                                out += a->text[i].empty() ? "table " + std::to_string(tables[i]->id())
+                                    + " didn't answer in " + std::to_string(answer_ms) + " ms, stuck or very busy\n"
+                                    : a->text[i];
+                        }
+                        timer_->cancel();
+                        reply(out.empty() ? "no tables\n" : out);
+                    };
+                    timer_.reset(new asio::steady_timer(static_cast<asio::io_context&>(socket_.get_executor().context())));
+                    timer_->expires_after(std::chrono::milliseconds(answer_ms));
+                    timer_->async_wait([send](std::error_code ec) { if (!ec) send(); });
+                    asio::io_context* home = &static_cast<asio::io_context&>(socket_.get_executor().context());
+                    if (tables.empty())
+                        asio::post(*home, send);
+                    for (std::size_t i = 0; i < tables.size(); ++i)
+                    {
+                        auto table = tables[i];
+                        asio::post(table->strand(), [a, i, table, f, send, home]()
+                                {
+                                std::string text = f(*table);
+                                std::lock_guard<std::mutex> lock(a->mutex);
+                                a->text[i] = text;
+                                if (--a->left == 0)
+                                    asio::post(*home, send);
+                                });
                     }
+                }
+
+                void reply(const std::string& text)
+                {
+                    out_ = text + "\n";
+                    auto self(shared_from_this());
+                    asio::async_write(socket_, asio::buffer(out_),
+                            [this, self](std::error_code ec, std::size_t)
+                            {
+                            if (!ec)
+                                do_read();
+                            });
+                }
+
+                protocol::socket socket_;
+                lobby<chat_room>& tables_;
+                asio::streambuf in_;
+                std::string out_;
+                std::unique_ptr<asio::steady_timer> timer_;
+        };
+
+        void do_accept()
+        {
+            acceptor_.async_accept([this](std::error_code ec, protocol::socket socket)
+                    {
+                    if (!ec)
+                        std::make_shared<connection>(std::move(socket), tables_)->do_read();
+                    do_accept();
                     });
         }
 
-        tcp::socket socket_;
-        chat_room& room_;
-        chat_message read_msg_;
-        chat_message_queue write_msgs_;
-
+        protocol::acceptor acceptor_;
+        lobby<chat_room>& tables_;
+        std::string path_;
 };
 
 //----------------------------------------------------------------------
 
+// runs f on an executor and waits for the result, only from threads outside the pool
+// asio takes a packaged_task as a completion token, so it is wrapped to keep our future
+template <typename Executor, typename F>
+auto run_on(const Executor& ex, F f) -> decltype(f())
+{
+    auto task = std::make_shared<std::packaged_task<decltype(f())()>>(f);
+    auto result = task->get_future();
+    asio::post(ex, [task]() { (*task)(); });
+    return result.get();
+}
+
 class chat_server
 {
     public:
-        chat_server(asio::io_context& io_context,
-                const tcp::endpoint& endpoint)
-            : acceptor_(io_context, endpoint)
+        // with reuse, every pool thread gets its own acceptor on the same port
+        // otherwise one acceptor hands sessions out round robin
+        // every port seats its players at tables of one stake
+        chat_server(io_context_pool& pool,
+                lobby<chat_room>& tables,
+                session_registry& sessions,
+                const tcp::endpoint& endpoint,
+                int stake,
+                const queue_limits& limits,
+                bool reuse)
+            : pool_(pool),
+            lobby_(tables),
+            sessions_(sessions),
+            port_(endpoint.port()),
+            stake_(stake),
+            limits_(limits),
+            reuse_(reuse)
+        {
+            std::size_t count = reuse ? pool.size() : 1;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::unique_ptr<tcp::acceptor> acceptor(new tcp::acceptor(pool.get(i)));
+                acceptor->open(endpoint.protocol());
+                acceptor->set_option(tcp::acceptor::reuse_address(true));
+                if (reuse)
+                {
+#if defined(SO_REUSEPORT)
+                    acceptor->set_option(reuse_port(true));
+#else
+                    throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+                }
+                acceptor->bind(endpoint);
+                acceptor->listen();
+                acceptors_.push_back(std::move(acceptor));
+            }
+            for (auto& acceptor : acceptors_)
+                do_accept(*acceptor); 
+        }
+
+        // listening sockets inherited from the previous server process
+        // connections waiting in their backlog are picked up like any other
+        chat_server(io_context_pool& pool,
+                lobby<chat_room>& tables,
+                session_registry& sessions,
+                unsigned short port,
+                const std::vector<int>& fds,
+                int stake,
+                const queue_limits& limits,
+                bool reuse)
+            : pool_(pool),
+            lobby_(tables),
+            sessions_(sessions),
+            port_(port),
+            stake_(stake),
+            limits_(limits),
+            reuse_(reuse)
         {
-            do_accept(); 
+            for (std::size_t i = 0; i < fds.size(); ++i)
+            {
+                std::unique_ptr<tcp::acceptor> acceptor(new tcp::acceptor(pool.get(i)));
+                acceptor->assign(tcp::v4(), fds[i]);
+                acceptors_.push_back(std::move(acceptor));
+            }
+            for (auto& acceptor : acceptors_)
+                do_accept(*acceptor); 
         }
 
-        void start_play()
+        unsigned short port() const
+        {
+            return port_;
+        }
+
+        int stake() const
+        {
+            return stake_;
+        }
+
+        // the listening sockets stay open, the kernel keeps queueing connections for the next process
+        // blocks until no accept handler is left to run, call from outside the pool
+        void stop_accepting()
         {
-            room_.changeActivePlayer(1);
+            accepting_ = false;
+            for (auto& acceptor : acceptors_)
+            {
+                tcp::acceptor* a = acceptor.get();
+                run_on(a->get_executor(), [a]() { a->cancel(); });
+            }
         }
 
-        int numPlayers()
+        std::vector<int> listen_fds()
         {
-            return room_.sizeOfParticipants();
+            std::vector<int> fds;
+            for (auto& acceptor : acceptors_)
+                fds.push_back(acceptor->native_handle());
+            return fds;
         }
 
     private:
-        void do_accept() // accepts client's do_connect() call
+        void do_accept(tcp::acceptor& acceptor) // accepts client's do_connect() call
         {
-            acceptor_.async_accept( 
-                    [this](std::error_code ec, tcp::socket socket)
+            // a reuse acceptor keeps the session on its own thread
+            asio::io_context& target = reuse_
+                ? static_cast<asio::io_context&>(acceptor.get_executor().context())
+                : pool_.next();
+            acceptor.async_accept(target,
+                    [this, &acceptor](std::error_code ec, tcp::socket socket)
                     {
                     if (!ec)
                     {
+                    trace::span span("accept");
+                    alloc_profile::scope tag("accept");
+                    // replies are small and go out one after another, Nagle would hold each back
+                    // until the client's delayed ack for the one before it
+                    // a socket handed off keeps the option, it is the same socket
+                    asio::error_code nodelay;
+                    socket.set_option(tcp::no_delay(true), nodelay);
                     // start the chat_session and calls start()
-                    std::make_shared<chat_session>(std::move(socket), room_)->start(); 
+                    std::make_shared<chat_session>(std::move(socket), limits_, pool_, sessions_)->start(lobby_, stake_); 
                     }
                     // waiting for more clients
-                    do_accept(); 
+                    if (accepting_)
+                        do_accept(acceptor); 
+                    });
+        }
+
+        io_context_pool& pool_;
+        std::vector<std::unique_ptr<tcp::acceptor>> acceptors_;
+        lobby<chat_room>& lobby_;
+        session_registry& sessions_;
+        unsigned short port_;
+        int stake_;
+        queue_limits limits_;
+        bool reuse_;
+        std::atomic<bool> accepting_{true};
+};
+
+//----------------------------------------------------------------------
+
+// zero downtime restart
+// the old process drains its tables and passes listening sockets, tables and live
+// connections over a unix socket to the new one, which carries on without a reconnect
+//
+//   new: chat_server -i /tmp/bj.sock <ports>    waits for the handoff before serving
+//   old: chat_server -u /tmp/bj.sock <ports>    hands off on SIGUSR2, then exits
+//
+// frames: L listener (port, stake, fd), T table snapshot, S session (fd), E end
+class handoff
+{
+    public:
+        handoff(io_context_pool& pool, lobby<chat_room>& tables,
+                session_registry& sessions, std::list<chat_server>& servers,
+                const std::string& path)
+            : pool_(pool),
+            tables_(tables),
+            sessions_(sessions),
+            servers_(servers),
+            path_(path),
+            signals_(pool.get(0), SIGUSR2)
+        {
+            wait();
+        }
+
+        ~handoff()
+        {
+            if (worker_.joinable())
+                worker_.join();
+        }
+
+        // new process side, blocks until the old process is done sending
+        // returns the ports that came over so the caller doesn't bind them again
+        static std::set<int> receive(const std::string& path, io_context_pool& pool,
+                lobby<chat_room>& tables, session_registry& sessions,
+                std::list<chat_server>& servers, const queue_limits& limits, bool reuse)
+        {
+            std::set<int> ports;
+            int listener = fd_passing::listen_unix(path);
+            if (listener < 0)
+                throw std::runtime_error("can't listen on " + path);
+            LOG_INFO("Waiting for handoff on {}", path);
+            int sock = ::accept(listener, nullptr, nullptr);
+            ::close(listener);
+            ::unlink(path.c_str());
+            if (sock < 0)
+                throw std::runtime_error("handoff accept failed");
+
+            struct listen_fds { int stake; std::vector<int> fds; };
+            std::map<int, listen_fds> listeners;
+            std::map<int, table_snapshot> snapshots;
+            std::vector<std::pair<chat_session::handoff_record, int>> records; // record, fd
+            char type;
+            std::string payload;
+            int fd;
+            while (fd_passing::recv_frame(sock, type, payload, fd) && type != 'E')
+            {
+                snapshot_reader r(payload);
+                if (type == 'L')
+                {
+                    int port = r.get<std::uint16_t>();
+                    listeners[port].stake = r.get<std::int32_t>();
+                    listeners[port].fds.push_back(fd);
+                }
+                else if (type == 'T')
+                {
+                    table_snapshot s;
+                    if (s.decode(payload))
+                        snapshots[s.id] = s;
+                }
+                else if (type == 'S')
+                {
+                    chat_session::handoff_record rec;
+                    rec.table = r.get<std::int32_t>();
+                    rec.seat = r.get<std::int8_t>();
+                    rec.player = r.get<std::uint32_t>();
+                    rec.read_body = r.get<std::uint8_t>();
+                    rec.partial = r.get_bytes();
+                    if (r.ok() && fd >= 0 && valid(rec))
+                        records.push_back(std::make_pair(rec, fd));
+                    else if (fd >= 0)
+                        ::close(fd);
+                }
+            }
+            if (type != 'E')
+                throw std::runtime_error("handoff cut short");
+
+            for (auto& l : listeners)
+            {
+                servers.emplace_back(pool, tables, sessions, l.first, l.second.fds, l.second.stake, limits, reuse);
+                ports.insert(l.first);
+            }
+
+            // a table only comes back if one of its players did
+            std::map<int, int> seated;
+            for (auto& rec : records)
+            {
+                if (snapshots.count(rec.first.table))
+                    seated[rec.first.table]++;
+                if (rec.first.player >= player_numbers)
+                    player_numbers = rec.first.player + 1;
+            }
+            std::map<int, std::shared_ptr<chat_room>> rooms;
+            for (auto& t : seated)
+            {
+                const table_snapshot& s = snapshots[t.first];
+                rooms[t.first] = tables.adopt(s.id, s.stake, s.seats.size());
+                rooms[t.first]->restore(s);
+            }
+            for (auto& rec : records)
+            {
+                auto room = rooms.find(rec.first.table);
+                asio::io_context& home = pool.next();
+                tcp::socket socket(home);
+                asio::error_code ec;
+                socket.assign(tcp::v4(), rec.second, ec);
+                if (ec || room == rooms.end())
+                {
+                    ::close(rec.second);
+                    continue;
+                }
+                std::make_shared<chat_session>(std::move(socket), limits, pool, sessions)
+                    ->resume(room->second, rec.first);
+            }
+
+            char ack = 1;
+            ::write(sock, &ack, 1);
+            ::close(sock);
+            LOG_INFO("Handoff received: {} ports, {} tables, {} players", ports.size(), rooms.size(), records.size());
+            return ports;
+        }
+
+    private:
+        enum { drain_poll_ms = 100, detach_timeout_ms = 5000 };
+
+        static bool valid(const chat_session::handoff_record& r)
+        {
+            std::size_t max = chat_message::header_length + chat_message::max_body_length;
+            if (r.partial.size() > max)
+                return false;
+            return !r.read_body || r.partial.size() >= (std::size_t)chat_message::header_length;
+        }
+
+        void wait()
+        {
+            signals_.async_wait([this](std::error_code ec, int /*signo*/)
+                    {
+                    if (ec)
+                        return;
+                    // the handoff blocks, so it gets its own thread
+                    if (worker_.joinable())
+                        worker_.join();
+                    worker_ = std::thread([this]() { run(); });
                     });
         }
 
-        tcp::acceptor acceptor_;
-        chat_room room_;
+        void run()
+        {
+            // nothing is stopped until the new process is known to be there
+            int sock = fd_passing::connect_unix(path_);
+            if (sock < 0)
+            {
+                LOG_WARN("Handoff: nobody listening on {}", path_);
+                asio::post(pool_.get(0), [this]() { wait(); });
+                return;
+            }
+            LOG_INFO("Handoff: draining");
+
+            for (auto& server : servers_)
+                server.stop_accepting();
+
+            // rounds in play are played out, tables picked up by late accepts get drained too
+            for (;;)
+            {
+                bool idle = true;
+                for (auto& table : tables_.tables())
+                {
+                    idle = run_on(table->strand(), [table]()
+                            {
+                            table->drain();
+                            return table->idle();
+                            }) && idle;
+                }
+                if (idle)
+                    break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(drain_poll_ms));
+            }
+
+            bool ok = true;
+            for (auto& server : servers_)
+            {
+                std::string payload;
+                snapshot_writer w(payload);
+                w.put<std::uint16_t>(server.port());
+                w.put<std::int32_t>(server.stake());
+                for (int fd : server.listen_fds())
+                    ok = fd_passing::send_frame(sock, 'L', payload, fd) && ok;
+            }
+
+            for (auto& table : tables_.tables())
+            {
+                table_snapshot s = run_on(table->strand(), [table]() { return table->state(); });
+                ok = fd_passing::send_frame(sock, 'T', s.encode()) && ok;
+            }
+
+            // each session writes out what it has queued, then gives up its socket
+            std::vector<std::future<chat_session::handoff_record>> pending;
+            for (auto& session : sessions_.all())
+            {
+                auto promise = std::make_shared<std::promise<chat_session::handoff_record>>();
+                pending.push_back(promise->get_future());
+                session->detach([promise](const chat_session::handoff_record& r) { promise->set_value(r); });
+            }
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(detach_timeout_ms);
+            int moved = 0, lost = 0;
+            for (auto& f : pending)
+            {
+                if (f.wait_until(deadline) != std::future_status::ready)
+                {
+                    lost++;
+                    continue;
+                }
+                chat_session::handoff_record r = f.get();
+                if (r.fd < 0)
+                    continue;
+                std::string payload;
+                snapshot_writer w(payload);
+                w.put<std::int32_t>(r.table);
+                w.put<std::int8_t>(r.seat);
+                w.put<std::uint32_t>(r.player);
+                w.put<std::uint8_t>(r.read_body);
+                w.put_bytes(r.partial);
+                ok = fd_passing::send_frame(sock, 'S', payload, r.fd) && ok;
+                ::close(r.fd); // the new process holds its own copy now
+                moved++;
+            }
+            ok = fd_passing::send_frame(sock, 'E', std::string()) && ok;
+
+            char ack = 0;
+            ok = fd_passing::read_all(sock, &ack, 1) && ack == 1 && ok;
+            ::close(sock);
+            LOG_INFO("Handoff {}: {} players moved, {} stuck", ok ? "done" : "failed", moved, lost);
+            // past the drain there is no going back, the sockets are already in the new process
+            pool_.stop();
+        }
+
+        io_context_pool& pool_;
+        lobby<chat_room>& tables_;
+        session_registry& sessions_;
+        std::list<chat_server>& servers_;
+        std::string path_;
+        asio::signal_set signals_;
+        std::thread worker_;
 };
 
 //----------------------------------------------------------------------
 
+enum { snapshot_ms = 1000 };
+
 int main(int argc, char* argv[])
 { 
     try
     {
-        if (argc < 2)
+        queue_limits limits;
+        std::size_t threads = 1;
+        bool reuse = false;
+        table_config config;
+        std::string ledger_dir;
+        int rebalance_seconds = 0;
+        int latency_seconds = 0;
+        int metrics_port = 0;
+        std::string trace_file;
+        bool profile_allocations = false;
+        std::string admin_socket;
+        std::string handoff_to, handoff_from;
+        std::string hand_dir;
+        std::string snapshot_dir;
+        std::string profile_file;
+        std::size_t profile_cache = 100000;
+        std::vector<std::pair<int, int>> ports; // port, stake
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-q" && i + 1 < argc) // per-session queue limit in bytes
+            {
+                limits.max_bytes = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "-p" && i + 1 < argc) // what to do with slow clients
+            {
+                std::string policy = argv[++i];
+                if (policy == "resync")
+                    limits.policy = overflow_policy::resync;
+                else if (policy == "coalesce")
+                    limits.policy = overflow_policy::coalesce;
+                else if (policy == "disconnect")
+                    limits.policy = overflow_policy::disconnect;
+                else
+                {
+                    std::cerr << "Unknown policy " << policy << "\n";
+                    return 1;
+                }
+            }
+            else if (arg == "-t" && i + 1 < argc) // io threads
+            {
+                threads = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "-r") // one SO_REUSEPORT acceptor per io thread
+            {
+                reuse = true;
+            }
+            else if (arg == "-w" && i + 1 < argc) // seconds from first player to the deal
+            {
+                config.wait_seconds = std::atoi(argv[++i]);
+            }
+            else if (arg == "-g" && i + 1 < argc) // seconds a dropped player's seat is held for them
+            {
+                config.hold_seconds = std::atoi(argv[++i]);
+            }
+            else if (arg == "-b" && i + 1 < argc) // rebalance every so many seconds
+            {
+                rebalance_seconds = std::atoi(argv[++i]);
+            }
+            else if (arg == "-R" && i + 1 < argc) // log action latencies every so many seconds
+            {
+                latency_seconds = std::atoi(argv[++i]);
+            }
+            else if (arg == "-M" && i + 1 < argc) // metrics over HTTP on this port, localhost only
+            {
+                metrics_port = std::atoi(argv[++i]);
+            }
+            else if (arg == "-a" && i + 1 < argc) // operator console on this unix socket
+            {
+                admin_socket = argv[++i];
+            }
+            else if (arg == "-A") // allocations by scope, on the metrics port's /allocs
+            {
+                profile_allocations = true;
+            }
+            else if (arg == "-T" && i + 1 < argc) // trace the rounds, SIGUSR1 writes the spans here
+            {
+                trace_file = argv[++i];
+            }
+            else if (arg == "-l" && i + 1 < argc) // hand-history log directory
+            {
+                hand_dir = argv[++i];
+            }
+            else if (arg == "-L" && i + 1 < argc) // credits ledger directory
+            {
+                ledger_dir = argv[++i];
+            }
+            else if (arg == "-S" && i + 1 < argc) // crash snapshots of every table, restored on start
+            {
+                snapshot_dir = argv[++i];
+            }
+            else if (arg == "-P" && i + 1 < argc) // player profile file, players who send a name keep their credits in it
+            {
+                profile_file = argv[++i];
+            }
+            else if (arg == "-C" && i + 1 < argc) // profiles kept in memory
+            {
+                profile_cache = std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (arg == "-u" && i + 1 < argc) // on SIGUSR2 hand everything to the process waiting here
+            {
+                handoff_to = argv[++i];
+            }
+            else if (arg == "-i" && i + 1 < argc) // take over from the process that hands off here
+            {
+                handoff_from = argv[++i];
+            }
+            else // <port>[:<stake>]
+            {
+                std::size_t colon = arg.find(':');
+                int stake = colon == std::string::npos ? 1 : std::atoi(arg.c_str() + colon + 1);
+                ports.push_back(std::make_pair(std::atoi(arg.c_str()), stake));
+            }
+        }
+        if (ports.empty() && handoff_from.empty())
         {
-            std::cerr << "Usage: chat_server <port> [<port> ...]\n";
+            std::cerr << "Usage: chat_server [-t <threads>] [-r] [-w <seconds>] [-g <seconds>] [-b <seconds>] [-R <seconds>] [-M <metrics port>] [-T <trace file>] [-A] [-a <admin socket>] [-q <queue bytes>] "
+                "[-p resync|coalesce|disconnect] [-l <hand log dir>] [-L <ledger dir>] [-S <snapshot dir>] [-P <profile file>] [-C <cached profiles>] [-u <handoff socket>] [-i <handoff socket>] "
+                "<port>[:<stake>] [<port>[:<stake>] ...]\n";
             return 1;
         }
-        asio::io_context io_context;
+        io_context_pool pool(threads);
+        session_registry sessions(pool.size());
+
+        // every table's rounds go through one writer thread
+        std::unique_ptr<log_writer> hands;
+        // shoe commitments and reveals are logged next to the rounds dealt from them
+        std::unique_ptr<log_writer> shoe_log;
+        if (!hand_dir.empty())
+        {
+            hands.reset(new log_writer(hand_dir, "hands"));
+            shoe_log.reset(new log_writer(hand_dir, "shoes"));
+        }
+        config.hands = hands.get();
+        config.shoe_log = shoe_log.get();
+        shoe_maker shoes;
+        config.shoes = &shoes;
+
+        // player numbers are never reused, the ledger knows them all
+        std::unique_ptr<ledger> credits;
+        if (!ledger_dir.empty())
+        {
+            credits.reset(new ledger(ledger_dir));
+            player_numbers = credits->max_player() + 1;
+        }
+        config.credits = credits.get();
+
+        // a profile's number came from the same counter, it can't be handed out again either
+        std::unique_ptr<player_store> profiles;
+        if (!profile_file.empty())
+        {
+            profiles.reset(new player_store(profile_file, profile_cache));
+            if (profiles->max_player() >= player_numbers)
+                player_numbers = profiles->max_player() + 1;
+            LOG_INFO("{} player profiles in {}", profiles->players(), profile_file);
+        }
+        player_profiles = profiles.get();
 
-        //making deck and shuffling
-        d.build();
-        d.shuffle();
+        // new tables are spread over the io threads
+        lobby<chat_room>* tables = nullptr;
+        lobby<chat_room> lobby_(
+                [&pool, &tables, config](int id, int stake)
+                {
+                return std::make_shared<chat_room>(pool.next(), *tables, id, stake, config);
+                },
+                max_seats);
+        tables = &lobby_;
 
         std::list<chat_server> servers; 
 
-        // starting a server calls the do_accept() function
-        for (int i = 1; i < argc; ++i) 
-        { 
-            tcp::endpoint endpoint(tcp::v4(), std::atoi(argv[i]));
-            servers.emplace_back(io_context, endpoint);
-        }
-        std::thread t([&io_context](){ io_context.run(); });
-        double seconds_passed;
-        double seconds_expire = 10;
-        while(true)
+        // ports that came over with a handoff are already listening
+        std::set<int> inherited;
+        if (!handoff_from.empty())
+            inherited = handoff::receive(handoff_from, pool, lobby_, sessions, servers, limits, reuse);
+
+        // after a crash the tables come back from the last snapshot, their seats held for the players
+        // a round that started after that snapshot is lost, bets the ledger took for it stay taken
+        std::unique_ptr<table_store> store;
+        std::unique_ptr<snapshotter> snapshots;
+        if (!snapshot_dir.empty())
         {
-            if(servers.front().numPlayers() >= 1)
+            store.reset(new table_store(snapshot_dir, snapshot_ms));
+            if (handoff_from.empty())
             {
-                //start the clock when one player joins
-                clock_t start = clock();
-                while(true) 
+                auto start = std::chrono::steady_clock::now();
+                std::vector<table_snapshot> saved = store->load();
+                std::atomic<std::size_t> restored{0}, rounds{0};
+                std::uint32_t players = player_numbers;
+                for (auto& s : saved)
+                    for (auto& seat : s.seats)
+                        players = std::max(players, seat.player + 1);
+                player_numbers = players;
+                // dealing rounds again is most of the work, tables don't share anything so it is split up
+                std::vector<std::thread> workers;
+                std::size_t n = std::max(1u, std::thread::hardware_concurrency());
+                for (std::size_t w = 0; w < n; ++w)
                 {
-                    seconds_passed = (clock() - start)/CLOCKS_PER_SEC;
-                    if(seconds_passed > seconds_expire)
-                    {
-                        std::cout << "Expired" << std::endl;
-                        inplay = true;
-                        servers.front().start_play();
-                        break;
-                    }
+                    workers.emplace_back([&, w]()
+                            {
+                            for (std::size_t i = w; i < saved.size(); i += n)
+                            {
+                                table_snapshot& s = saved[i];
+                                if (s.seats.empty())
+                                    continue;
+                                lobby_.adopt(s.id, s.stake, s.seats.size())->restore(s);
+                                restored++;
+                                rounds += s.inplay;
+                            }
+                            });
                 }
-                break;
+                for (auto& worker : workers)
+                    worker.join();
+                LOG_INFO("Restored {} tables, {} in a round, in {} ms", restored.load(), rounds.load(),
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
             }
+            snapshots.reset(new snapshotter(pool.get(0), lobby_, *store, snapshot_ms));
+        }
+
+        // starting a server calls the do_accept() function
+        for (auto port : ports) 
+        { 
+            if (inherited.count(port.first))
+                continue;
+            tcp::endpoint endpoint(tcp::v4(), port.first);
+            servers.emplace_back(pool, lobby_, sessions, endpoint, port.second, limits, reuse);
+        }
+        std::unique_ptr<rebalancer> balance;
+        if (rebalance_seconds > 0)
+            balance.reset(new rebalancer(pool, sessions, lobby_, rebalance_seconds));
+        std::unique_ptr<latency_reporter> latencies;
+        if (latency_seconds > 0)
+            latencies.reset(new latency_reporter(pool.get(0), latency_seconds));
+        std::unique_ptr<metrics_endpoint> exposition;
+        if (metrics_port > 0)
+        {
+            exposition.reset(new metrics_endpoint(pool.get(0),
+                        tcp::endpoint(asio::ip::address_v4::loopback(), metrics_port)));
+            exposition->page("/tables", [&lobby_](const std::string& query) { return top_tables(lobby_, query); });
+            exposition->page("/allocs", [](const std::string&) { return alloc_profile::profiler::instance().report(); });
+        }
+        if (profile_allocations)
+        {
+            if (!exposition)
+                LOG_WARN("Allocations are profiled but nothing serves the report, -M gives it a port");
+            alloc_profile::enable();
         }
-        //io_context.run();
-        t.join();
+        std::unique_ptr<admin_console> console;
+        if (!admin_socket.empty())
+            console.reset(new admin_console(pool.get(0), lobby_, admin_socket));
+        std::unique_ptr<trace_dumper> tracing;
+        if (!trace_file.empty())
+            tracing.reset(new trace_dumper(pool.get(0), trace_file));
+        std::unique_ptr<handoff> restart;
+        if (!handoff_to.empty())
+            restart.reset(new handoff(pool, lobby_, sessions, servers, handoff_to));
+        pool.run();
+        pool.join();
     }
     catch (std::exception& e)
     {
@@ -0,0 +1,188 @@
+//
+// handcols.cpp
+// ~~~~~~~~~~~~
+//
+// column files from the hand-history log, and aggregates over them
+//
+//   handcols export <hand log dir> <column dir> [-s <since>] [-u <until>]
+//   handcols ev <column dir> [-by <column>] [-s <since>] [-u <until>]
+//   handcols info <column dir>
+//
+// ev groups every hand by one column (upcard unless -by says otherwise) and prints what a
+// unit bet returns. it reads the key, bet and outcome columns, plus time with -s or -u.
+// times are unix seconds.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include "../include/hand_columns.hpp"
+
+static const char* const action_names[] = { "none", "play", "hit", "stand", "split", "leave", "dealer" };
+
+static double ms_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int usage()
+{
+    std::cerr << "Usage: handcols export <hand log dir> <column dir> [-s <since>] [-u <until>]\n"
+        "       handcols ev <column dir> [-by <column>] [-s <since>] [-u <until>]\n"
+        "       handcols info <column dir>\n";
+    return 1;
+}
+
+struct group
+{
+    std::uint64_t hands = 0;
+    std::int64_t staked = 0;
+    std::int64_t net = 0;
+    std::uint64_t wins = 0;
+    std::uint64_t pushes = 0;
+};
+
+static int ev(const std::string& dir, int key, std::int64_t from_us, std::int64_t to_us)
+{
+    auto start = std::chrono::steady_clock::now();
+    column_reader keys(dir + "/" + hand_columns::names[key] + ".col");
+    column_reader bets(dir + "/bet.col");
+    column_reader outcomes(dir + "/outcome.col");
+    std::unique_ptr<column_reader> times;
+    bool filtered = from_us > 0 || to_us > 0;
+    if (filtered)
+        times.reset(new column_reader(dir + "/time.col"));
+    if (keys.chunks() != bets.chunks() || keys.chunks() != outcomes.chunks())
+        throw std::runtime_error("columns in " + dir + " don't line up, export again");
+
+    std::map<std::int64_t, group> groups;
+    std::vector<std::int64_t> k, b, o, t;
+    std::size_t scanned = 0, skipped = 0, bytes = keys.bytes() + bets.bytes() + outcomes.bytes();
+    for (std::size_t c = 0; c < keys.chunks(); ++c)
+    {
+        // a chunk completely outside the time range is never decoded
+        if (filtered && ((from_us > 0 && times->max(c) < from_us) || (to_us > 0 && times->min(c) > to_us)))
+        {
+            skipped++;
+            continue;
+        }
+        keys.read(c, k);
+        bets.read(c, b);
+        outcomes.read(c, o);
+        if (filtered)
+            times->read(c, t);
+        for (std::size_t i = 0; i < k.size(); ++i)
+        {
+            if (filtered && ((from_us > 0 && t[i] < from_us) || (to_us > 0 && t[i] > to_us)))
+                continue;
+            group& g = groups[k[i]];
+            g.hands++;
+            g.staked += b[i];
+            g.net += o[i];
+            g.wins += o[i] > 0;
+            g.pushes += o[i] == 0;
+        }
+        scanned++;
+    }
+    if (filtered)
+        bytes += times->bytes();
+
+    std::cout << std::setw(8) << hand_columns::names[key] << std::setw(10) << "hands"
+        << std::setw(10) << "ev" << std::setw(8) << "win%" << std::setw(8) << "push%" << "\n";
+    for (auto& g : groups)
+    {
+        std::string name = std::to_string(g.first);
+        if (key == hand_columns::action && g.first >= 0 && g.first < 7)
+            name = action_names[g.first];
+        std::cout << std::setw(8) << name << std::setw(10) << g.second.hands
+            << std::setw(10) << std::fixed << std::setprecision(4)
+            << (g.second.staked ? (double)g.second.net / g.second.staked : 0.0)
+            << std::setw(8) << std::setprecision(1) << 100.0 * g.second.wins / g.second.hands
+            << std::setw(8) << 100.0 * g.second.pushes / g.second.hands << "\n";
+    }
+    std::cerr << scanned << " chunks scanned, " << skipped << " skipped, " << (filtered ? 4 : 3)
+        << " of " << hand_columns::count << " columns (" << bytes / 1024 << " KB), "
+        << ms_since(start) << " ms\n";
+    return 0;
+}
+
+static int info(const std::string& dir)
+{
+    static const char* const encodings[] = { "bits", "delta", "dict" };
+    std::size_t total = 0;
+    for (int i = 0; i < hand_columns::count; ++i)
+    {
+        column_reader col(dir + "/" + hand_columns::names[i] + ".col");
+        std::map<int, int> used;
+        for (std::size_t c = 0; c < col.chunks(); ++c)
+            used[(int)col.how(c)]++;
+        std::cout << std::setw(8) << col.name() << std::setw(12) << col.rows() << " rows"
+            << std::setw(10) << col.bytes() << " bytes " << std::fixed << std::setprecision(2)
+            << std::setw(6) << (col.rows() ? 8.0 * col.bytes() / col.rows() : 0.0) << " bits/row ";
+        for (auto& u : used)
+            std::cout << " " << encodings[u.first % 3] << " x" << u.second;
+        std::cout << "\n";
+        total += col.bytes();
+    }
+    std::cout << total / 1024 << " KB in all\n";
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+        return usage();
+    try
+    {
+        std::string command = argv[1];
+        std::vector<std::string> dirs;
+        std::int64_t from_us = 0, to_us = 0;
+        int key = hand_columns::upcard;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-s" && i + 1 < argc)
+                from_us = std::atoll(argv[++i]) * 1000000;
+            else if (arg == "-u" && i + 1 < argc)
+                to_us = std::atoll(argv[++i]) * 1000000;
+            else if (arg == "-by" && i + 1 < argc)
+            {
+                key = hand_columns::column(argv[++i]);
+                if (key < 0)
+                {
+                    std::cerr << "No column " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            else
+                dirs.push_back(arg);
+        }
+
+        if (command == "export" && dirs.size() == 2)
+        {
+            auto start = std::chrono::steady_clock::now();
+            hand_log_reader log(dirs[0]);
+            hand_query q;
+            q.from_us = from_us;
+            if (to_us > 0)
+                q.to_us = to_us;
+            std::uint64_t rows = hand_columns::export_log(log, q, dirs[1]);
+            std::cerr << rows << " hands from " << log.records() << " rounds ("
+                << log.bytes() / 1024 << " KB of log) in " << ms_since(start) << " ms\n";
+            return 0;
+        }
+        if (command == "ev" && dirs.size() == 1)
+            return ev(dirs[0], key, from_us, to_us);
+        if (command == "info" && dirs.size() == 1)
+            return info(dirs[0]);
+        return usage();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,130 @@
+//
+// handlog.cpp
+// ~~~~~~~~~~~
+//
+// ad-hoc lookups over the server's hand-history log
+//
+//   handlog <dir> [-p <player>] [-t <table>] [-s <since>] [-u <until>] [-n <limit>] [-v] [-c]
+//
+// times are unix seconds, or relative like 7d, 12h, 30m (that long ago)
+//
+
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include "../include/hand_log_reader.hpp"
+
+static std::int64_t parse_time(const std::string& arg)
+{
+    char unit = arg.empty() ? 0 : arg.back();
+    std::int64_t n = std::atoll(arg.c_str());
+    std::int64_t scale = unit == 'd' ? 86400 : unit == 'h' ? 3600 : unit == 'm' ? 60 : 0;
+    if (scale == 0)
+        return n * 1000000;
+    return hand_record::now_us() - n * scale * 1000000;
+}
+
+static std::string card_text(const Card& c)
+{
+    return std::string(1, c.rank_) + c.suit_;
+}
+
+static void print(const hand_view& v, bool verbose)
+{
+    hand_record r;
+    if (!v.decode(r))
+    {
+        std::cout << "#" << v.seq() << " damaged record" << std::endl;
+        return;
+    }
+    std::time_t t = r.finished_us / 1000000;
+    char when[32];
+    std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+    std::cout << "#" << v.seq() << " " << when << " table " << r.table << " round " << r.round
+        << " stake " << r.stake << " dealer";
+    for (auto& c : r.dealer)
+        std::cout << " " << card_text(c);
+    std::cout << "\n";
+    for (auto& s : r.seats)
+    {
+        std::cout << "    seat " << (int)s.seat << " player " << s.player << " bet " << s.bet
+            << " payout " << s.payout;
+        for (auto& h : s.hands)
+        {
+            std::cout << " |";
+            for (auto& c : h)
+                std::cout << " " << card_text(c);
+        }
+        std::cout << "\n";
+    }
+    if (verbose)
+    {
+        static const char* kinds[] = { "play", "hit", "stand", "split", "leave", "dealer" };
+        std::cout << "    seed " << r.seed << " shoe offset " << r.shoe_offset << " actions";
+        for (auto& a : r.actions)
+            std::cout << " " << (int)a.seat << ":" << kinds[(int)a.kind % 6] << "@" << a.at_ms << "ms";
+        std::cout << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: handlog <dir> [-p <player>] [-t <table>] [-s <since>] [-u <until>] "
+            "[-n <limit>] [-v] [-c]\n";
+        return 1;
+    }
+    try
+    {
+        hand_query q;
+        bool verbose = false, count_only = false;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-p" && i + 1 < argc)
+                q.player = std::strtoul(argv[++i], nullptr, 10);
+            else if (arg == "-t" && i + 1 < argc)
+                q.table = std::atoi(argv[++i]);
+            else if (arg == "-s" && i + 1 < argc)
+                q.from_us = parse_time(argv[++i]);
+            else if (arg == "-u" && i + 1 < argc)
+                q.to_us = parse_time(argv[++i]);
+            else if (arg == "-n" && i + 1 < argc)
+                q.limit = std::strtoul(argv[++i], nullptr, 10);
+            else if (arg == "-v")
+                verbose = true;
+            else if (arg == "-c")
+                count_only = true;
+            else
+            {
+                std::cerr << "Unknown option " << arg << "\n";
+                return 1;
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        hand_log_reader reader(argv[1]);
+        auto opened = std::chrono::steady_clock::now();
+        std::size_t found = reader.each(q, [&](const hand_view& v)
+                {
+                if (!count_only)
+                    print(v, verbose);
+                return true;
+                });
+        auto done = std::chrono::steady_clock::now();
+        std::cerr << found << " of " << reader.records() << " hands in " << reader.segments()
+            << " segments (" << reader.bytes() / 1024 << " KB), open "
+            << std::chrono::duration_cast<std::chrono::microseconds>(opened - start).count() / 1000.0
+            << " ms, query "
+            << std::chrono::duration_cast<std::chrono::microseconds>(done - opened).count() / 1000.0
+            << " ms\n";
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,500 @@
+//
+// loadgen.cpp
+// ~~~~~~~~~~~
+//
+// thousands of headless players from one process, speaking the same chat_message protocol as the client
+//
+//   loadgen <host> <port> [-c <connections>] [-t <threads>] [-d <seconds>] [-r <ramp seconds>]
+//           [-k <think ms>] [-s stand|dealer|basic] [-b <bet>] [-n <name prefix>] [-i <report seconds>] [-j]
+//
+// every connection says hello, bets, and plays its turns with the strategy: stand always stands,
+// dealer hits below 17, basic hits below 12 and below 17 against a dealer 7 or better.
+// before every action it thinks for -k ms, give or take half. connections open evenly over
+// -r seconds. latency is from writing an action to reading the table's broadcast of it,
+// an action that ends the round counts as the dealer's. with -n every player has a name and
+// the server keeps a profile for each. keys aren't kept, names an earlier run registered play
+// as guests, a new prefix gets new profiles. -j prints the summary as JSON, the progress goes to stderr.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "asio.hpp"
+#include "../include/chat_message.hpp"
+#include "../include/flat_json.hpp"
+#include "../include/io_context_pool.hpp"
+#include "../include/latency.hpp"
+#include "../include/strategy.hpp"
+
+using asio::ip::tcp;
+
+struct settings
+{
+    int connections = 1000;
+    int seconds = 30;
+    int ramp_seconds = 5;
+    int think_ms = 500;
+    strategy play = strategy::basic;
+    int bet = 1;
+    int credits = 100;
+    std::string name_prefix;
+};
+
+// one io thread's numbers, only that thread writes them
+struct alignas(64) thread_stats
+{
+    std::atomic<std::uint64_t> connected{0};
+    std::atomic<std::uint64_t> failed{0};   // couldn't connect, or lost the connection
+    std::atomic<std::uint64_t> messages{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<std::uint64_t> actions{0};
+    std::atomic<std::uint64_t> hands{0};
+
+    static void bump(std::atomic<std::uint64_t>& c, std::uint64_t n = 1)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// the cards one seat holds in a table's card text, see table_game::printTable
+static std::vector<Card> cards_of(const std::string& text, int seat)
+{
+    std::vector<Card> cards;
+    std::string head = "<-- Player " + std::to_string(seat) + " hand:\n";
+    std::size_t at = text.find(head);
+    if (at == std::string::npos)
+        return cards;
+    std::size_t line = at + head.size();
+    while (line < text.size())
+    {
+        std::size_t end = text.find('\n', line);
+        if (end == std::string::npos)
+            end = text.size();
+        // every card is "R of S", anything else ends the hand
+        if (end - line < 6 || text.compare(line + 1, 4, " of ") != 0)
+            break;
+        char rank = text[line];
+        Card c;
+        c.setInfo(rank == 'A' ? 11 : std::strchr("TJQK", rank) ? 10 : rank - '0', rank, text[line + 5]);
+        cards.push_back(c);
+        line = end + 1;
+    }
+    return cards;
+}
+
+class player : public std::enable_shared_from_this<player>
+{
+    public:
+        player(asio::io_context& io_context, const settings& s, int number, thread_stats& stats)
+            : socket_(io_context),
+            timer_(io_context),
+            settings_(s),
+            number_(number),
+            stats_(stats),
+            random_(number + 1)
+        {
+        }
+
+        void start(const tcp::resolver::results_type& endpoints, std::chrono::milliseconds delay)
+        {
+            auto self(shared_from_this());
+            timer_.expires_after(delay);
+            timer_.async_wait([this, self, endpoints](std::error_code ec)
+                    {
+                    if (ec)
+                        return;
+                    asio::async_connect(socket_, endpoints,
+                            [this, self](std::error_code ec, tcp::endpoint)
+                            {
+                            if (ec)
+                            {
+                                thread_stats::bump(stats_.failed);
+                                return;
+                            }
+                            socket_.set_option(tcp::no_delay(true));
+                            thread_stats::bump(stats_.connected);
+                            hello();
+                            do_read_header();
+                            });
+                    });
+        }
+
+    private:
+        void hello()
+        {
+            chat_message msg;
+            msg.ca.client_credits = settings_.credits;
+            if (!settings_.name_prefix.empty())
+                std::strncpy(msg.ca.name, (settings_.name_prefix + std::to_string(number_)).c_str(),
+                        sizeof(msg.ca.name) - 1);
+            msg.encode_header();
+            send(msg);
+        }
+
+        void on_message(const chat_message& msg)
+        {
+            thread_stats::bump(stats_.messages);
+            thread_stats::bump(stats_.bytes, msg.length());
+            const client_action& ca = msg.ca;
+            std::string text(ca.g, strnlen(ca.g, sizeof(ca.g)));
+
+            if (id_ == 0)
+            {
+                // the first message seats us, maybe with a wait for the round to finish
+                id_ = ca.id;
+                waiting_ = text.compare(0, 11, "Please wait") == 0;
+                need_bet_ = !waiting_;
+                next();
+                return;
+            }
+            if (ca.given_id && ca.given_id != id_)
+            {
+                // moved to another seat or table, whatever we sent went to the old one
+                id_ = ca.given_id;
+                pending_ = false;
+                busy_ = false;
+                timer_.cancel();
+                need_bet_ = true;
+            }
+
+            bool echo = pending_ && ca.id == id_;
+            if (echo)
+            {
+                latency::action a = ca.turn == -1 ? latency::action::dealer : pending_action_;
+                latency::recorder::instance().record(a, latency::now_ns() - sent_ns_);
+                thread_stats::bump(stats_.actions);
+                pending_ = false;
+                busy_ = false;
+            }
+            else if (ca.id == id_)
+                return; // the table's history, replayed to us when we sat down
+
+            if (text.find("<-- Player") != std::string::npos)
+                cards_ = text;
+            if (waiting_ && !ca.revealed)
+            {
+                // the round we waited for is over and the next one is on
+                waiting_ = false;
+                need_bet_ = true;
+            }
+            if (ca.turn == -1 && !ca.revealed)
+            {
+                if (in_round_)
+                    thread_stats::bump(stats_.hands);
+                in_round_ = false;
+                need_bet_ = true;
+                my_turn_ = false;
+            }
+            else if (!ca.revealed)
+                my_turn_ = ca.turn == id_;
+            next();
+        }
+
+        // one thing at a time: the bet first, then the turn
+        void next()
+        {
+            if (busy_ || (!need_bet_ && !my_turn_))
+                return;
+            busy_ = true;
+            auto self(shared_from_this());
+            int think = settings_.think_ms;
+            int ms = think > 0 ? std::uniform_int_distribution<int>(think / 2, think + think / 2)(random_) : 0;
+            timer_.expires_after(std::chrono::milliseconds(ms));
+            timer_.async_wait([this, self](std::error_code ec)
+                    {
+                    if (!ec)
+                        act();
+                    });
+        }
+
+        void act()
+        {
+            chat_message msg;
+            msg.ca.id = id_;
+            msg.ca.client_credits = settings_.credits;
+            if (need_bet_)
+            {
+                msg.ca.play = true;
+                msg.ca.bet = settings_.bet;
+                pending_action_ = latency::action::play;
+                need_bet_ = false;
+                in_round_ = true;
+            }
+            else if (hit())
+            {
+                msg.ca.hit = true;
+                pending_action_ = latency::action::hit;
+            }
+            else
+            {
+                msg.ca.stand = true;
+                pending_action_ = latency::action::stand;
+            }
+            msg.encode_header();
+            pending_ = true;
+            sent_ns_ = latency::now_ns();
+            send(msg);
+        }
+
+        bool hit()
+        {
+            std::vector<Card> dealer = cards_of(cards_, 0);
+            return should_hit(settings_.play, cards_of(cards_, id_), dealer.empty() ? 10 : dealer[0].value);
+        }
+
+        void send(const chat_message& msg)
+        {
+            write_msgs_.push_back(msg);
+            if (write_msgs_.size() == 1)
+                do_write();
+        }
+
+        void do_write()
+        {
+            auto self(shared_from_this());
+            asio::async_write(socket_,
+                    asio::buffer(write_msgs_.front().data(), write_msgs_.front().length()),
+                    [this, self](std::error_code ec, std::size_t)
+                    {
+                    if (ec)
+                    {
+                        lost();
+                        return;
+                    }
+                    write_msgs_.pop_front();
+                    if (!write_msgs_.empty())
+                        do_write();
+                    });
+        }
+
+        void do_read_header()
+        {
+            auto self(shared_from_this());
+            asio::async_read(socket_, asio::buffer(read_msg_.data(), chat_message::header_length),
+                    [this, self](std::error_code ec, std::size_t)
+                    {
+                    if (ec || !read_msg_.decode_header())
+                    {
+                        lost();
+                        return;
+                    }
+                    asio::async_read(socket_, asio::buffer(read_msg_.body(), read_msg_.body_length()),
+                            [this, self](std::error_code ec, std::size_t)
+                            {
+                            if (ec)
+                            {
+                                lost();
+                                return;
+                            }
+                            on_message(read_msg_);
+                            do_read_header();
+                            });
+                    });
+        }
+
+        void lost()
+        {
+            if (!socket_.is_open())
+                return;
+            thread_stats::bump(stats_.failed);
+            std::error_code ec;
+            socket_.close(ec);
+            timer_.cancel();
+        }
+
+        tcp::socket socket_;
+        asio::steady_timer timer_;
+        const settings& settings_;
+        int number_;
+        thread_stats& stats_;
+        std::minstd_rand random_;
+        chat_message read_msg_;
+        std::deque<chat_message> write_msgs_;
+        std::string cards_; // the last card text the table sent
+        int id_ = 0;
+        bool waiting_ = false;
+        bool need_bet_ = false;
+        bool my_turn_ = false;
+        bool in_round_ = false;
+        bool busy_ = false;     // an action is being thought about or waits for its broadcast
+        bool pending_ = false;  // an action was sent and its broadcast hasn't come back
+        latency::action pending_action_ = latency::action::play;
+        std::int64_t sent_ns_ = 0;
+};
+
+struct totals
+{
+    std::uint64_t connected = 0, failed = 0, messages = 0, bytes = 0, actions = 0, hands = 0;
+};
+
+static totals add_up(const std::vector<thread_stats>& stats)
+{
+    totals t;
+    for (auto& s : stats)
+    {
+        t.connected += s.connected.load(std::memory_order_relaxed);
+        t.failed += s.failed.load(std::memory_order_relaxed);
+        t.messages += s.messages.load(std::memory_order_relaxed);
+        t.bytes += s.bytes.load(std::memory_order_relaxed);
+        t.actions += s.actions.load(std::memory_order_relaxed);
+        t.hands += s.hands.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: loadgen <host> <port> [-c <connections>] [-t <threads>] [-d <seconds>] [-r <ramp seconds>] "
+            "[-k <think ms>] [-s stand|dealer|basic] [-b <bet>] [-n <name prefix>] [-i <report seconds>] [-j]\n";
+        return 1;
+    }
+    try
+    {
+        settings s;
+        std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        int report_seconds = 1;
+        bool json = false;
+        for (int i = 3; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-j")
+            {
+                json = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << arg << "\n";
+                return 1;
+            }
+            std::string value = argv[++i];
+            if (arg == "-c")
+                s.connections = std::atoi(value.c_str());
+            else if (arg == "-t")
+                threads = std::max(1, std::atoi(value.c_str()));
+            else if (arg == "-d")
+                s.seconds = std::atoi(value.c_str());
+            else if (arg == "-r")
+                s.ramp_seconds = std::atoi(value.c_str());
+            else if (arg == "-k")
+                s.think_ms = std::atoi(value.c_str());
+            else if (arg == "-b")
+                s.bet = std::atoi(value.c_str());
+            else if (arg == "-n")
+                s.name_prefix = value;
+            else if (arg == "-i")
+                report_seconds = std::max(1, std::atoi(value.c_str()));
+            else if (arg == "-s" && parse_strategy(value, s.play))
+                continue;
+            else
+            {
+                std::cerr << "Unknown option " << arg << " " << value << "\n";
+                return 1;
+            }
+        }
+
+        io_context_pool pool(threads);
+        std::vector<thread_stats> stats(pool.size());
+        tcp::resolver resolver(pool.get(0));
+        auto endpoints = resolver.resolve(argv[1], argv[2]);
+        for (int i = 0; i < s.connections; ++i)
+        {
+            std::size_t home = i % pool.size();
+            auto delay = std::chrono::milliseconds(std::int64_t(s.ramp_seconds) * 1000 * i / std::max(1, s.connections));
+            std::make_shared<player>(pool.get(home), s, i, stats[home])->start(endpoints, delay);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto end = start + std::chrono::seconds(s.seconds);
+        pool.run();
+        totals last;
+        auto last_at = start;
+        while (std::chrono::steady_clock::now() < end)
+        {
+            std::this_thread::sleep_until(std::min(end, last_at + std::chrono::seconds(report_seconds)));
+            auto now = std::chrono::steady_clock::now();
+            double dt = std::chrono::duration<double>(now - last_at).count();
+            totals t = add_up(stats);
+            (json ? std::cerr : std::cout) << std::fixed << std::setprecision(0)
+                << std::chrono::duration<double>(now - start).count() << "s "
+                << t.connected - t.failed << " connected, "
+                << (t.actions - last.actions) / dt << " actions/s, "
+                << (t.hands - last.hands) / dt << " hands/s, "
+                << (t.messages - last.messages) / dt << " msgs/s, "
+                << std::setprecision(1) << (t.bytes - last.bytes) / dt / 1e6 << " MB/s in" << std::endl;
+            last = t;
+            last_at = now;
+        }
+        pool.stop();
+        pool.join();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        totals t = add_up(stats);
+        std::vector<latency::histogram> all = latency::recorder::instance().scrape();
+        if (json)
+        {
+            flat_json out;
+            out.add("players", s.connections);
+            out.add("connected", t.connected);
+            out.add("failed", t.failed);
+            out.add("seconds", seconds);
+            out.add("actions_per_s", t.actions / seconds);
+            out.add("hands_per_s", t.hands / seconds);
+            out.add("msgs_per_s", t.messages / seconds);
+            out.add("mb_per_s_in", t.bytes / seconds / 1e6);
+            for (std::size_t k = 0; k < all.size(); ++k)
+            {
+                const latency::histogram& h = all[k];
+                std::string name = latency::name(static_cast<latency::action>(k));
+                out.add(name + "_count", h.count());
+                if (h.count() == 0)
+                    continue;
+                out.add(name + "_mean_ms", h.mean() / 1e6);
+                out.add(name + "_p50_ms", h.percentile(0.5) / 1e6);
+                out.add(name + "_p90_ms", h.percentile(0.9) / 1e6);
+                out.add(name + "_p99_ms", h.percentile(0.99) / 1e6);
+                out.add(name + "_max_ms", h.max() / 1e6);
+            }
+            std::cout << out.str();
+            return 0;
+        }
+        std::cout << "\n" << s.connections << " players, " << t.connected << " connected, " << t.failed
+            << " failed or dropped, " << std::setprecision(1) << seconds << " s\n"
+            << std::setprecision(0) << t.actions / seconds << " actions/s, " << t.hands / seconds
+            << " hands/s, " << t.messages / seconds << " msgs/s, "
+            << std::setprecision(1) << t.bytes / seconds / 1e6 << " MB/s in\n\n";
+        std::cout << std::left << std::setw(8) << "action" << std::right << std::setw(10) << "count"
+            << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << "  (ms)\n";
+        std::cout << std::setprecision(2);
+        for (std::size_t k = 0; k < all.size(); ++k)
+        {
+            const latency::histogram& h = all[k];
+            if (h.count() == 0)
+                continue;
+            std::cout << std::left << std::setw(8) << latency::name(static_cast<latency::action>(k)) << std::right
+                << std::setw(10) << h.count() << std::setw(10) << h.mean() / 1e6
+                << std::setw(10) << h.percentile(0.5) / 1e6 << std::setw(10) << h.percentile(0.9) / 1e6
+                << std::setw(10) << h.percentile(0.99) / 1e6 << std::setw(10) << h.percentile(0.999) / 1e6
+                << std::setw(10) << h.max() / 1e6 << "\n";
+        }
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
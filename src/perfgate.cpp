@@ -0,0 +1,339 @@
+//
+// perfgate.cpp
+// ~~~~~~~~~~~~
+//
+// runs the benchmarks, a fixed seed simulation and a fixed load scenario and checks them against a baseline
+//
+//   perfgate [-b <baseline file>] [-s] [-o <results file>] [-p <port>] [-d <seconds>] [-x <binary dir>]
+//
+// bench, sim, server and loadgen have to be built already (make gate does it all). the sim runs
+// three times and its fastest run counts. every metric comes out as <tool>.<name>, and the
+// results go to stdout as JSON, the table to stderr.
+// the baseline (perf_baseline.txt unless -b says otherwise) has a line per checked metric:
+//
+//   <metric> <value> max|min|eq <tolerance>
+//
+// max metrics may not grow past the tolerance, min metrics may not drop below it, eq metrics
+// must stay within it either way. a tolerance ending in % is relative, otherwise absolute.
+// a checked metric that got worse or went missing is a regression, and perfgate exits with 2.
+// -s writes the baseline again from this run, keeping every metric's rule and tolerance.
+//
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "asio.hpp"
+#include "../include/flat_json.hpp"
+
+struct rule
+{
+    double value = 0;
+    std::string kind;       // max, min or eq
+    double tolerance = 0;
+    bool relative = false;
+
+    double slack() const
+    {
+        return relative ? std::fabs(value) * tolerance / 100 : tolerance;
+    }
+
+    // the worst value that still passes
+    double limit() const
+    {
+        return kind == "min" ? value - slack() : value + slack();
+    }
+
+    bool passes(double v) const
+    {
+        if (kind == "min")
+            return v >= limit();
+        if (kind == "eq")
+            return std::fabs(v - value) <= slack();
+        return v <= limit();
+    }
+
+    std::string tolerance_text() const
+    {
+        std::ostringstream out;
+        out << tolerance << (relative ? "%" : "");
+        return out.str();
+    }
+};
+
+// how a metric seen for the first time is checked, by its name
+// timings are meant to catch a change that costs real time, not the noise of a shared host:
+// benchmark timings move by a third or more between runs of the same tree, and latencies get
+// an allowance in milliseconds since a relative one on a sub millisecond p50 is all noise
+static bool default_rule(const std::string& name, rule& r)
+{
+    auto ends = [&name](const std::string& tail)
+    {
+        return name.size() >= tail.size() && name.compare(name.size() - tail.size(), tail.size(), tail) == 0;
+    };
+    if (name.compare(0, 6, "bench.") == 0 && ends(".ns"))
+        r.kind = "max", r.tolerance = 75, r.relative = true;
+    else if (name.compare(0, 6, "bench.") == 0 && ends(".allocs"))
+        r.kind = "max", r.tolerance = 0.05, r.relative = false;
+    else if (name == "sim.ns_per_round")
+        r.kind = "max", r.tolerance = 50, r.relative = true;
+    else if (name == "sim.net" || name == "sim.hands" || name == "sim.shuffles" || name == "sim.text_bytes")
+        r.kind = "eq", r.tolerance = 0, r.relative = false;
+    else if (name == "loadgen.failed")
+        r.kind = "max", r.tolerance = 0, r.relative = false;
+    else if (name == "loadgen.actions_per_s")
+        r.kind = "min", r.tolerance = 40, r.relative = true;
+    else if (name.compare(0, 8, "loadgen.") == 0 && ends("_p50_ms"))
+        r.kind = "max", r.tolerance = 10, r.relative = false;
+    else if (name.compare(0, 8, "loadgen.") == 0 && ends("_p99_ms"))
+        r.kind = "max", r.tolerance = 50, r.relative = false;
+    else
+        return false;
+    return true;
+}
+
+static std::map<std::string, rule> load_baseline(const std::string& path)
+{
+    std::map<std::string, rule> out;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name, tolerance;
+        rule r;
+        if (!(fields >> name >> r.value >> r.kind >> tolerance))
+            continue;
+        r.relative = !tolerance.empty() && tolerance.back() == '%';
+        r.tolerance = std::atof(tolerance.c_str());
+        out[name] = r;
+    }
+    return out;
+}
+
+// a tool's JSON, its metrics prefixed with its name
+static void run_tool(const std::string& name, const std::string& command, std::map<std::string, double>& metrics)
+{
+    std::cerr << "running " << command << std::endl;
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe)
+        throw std::runtime_error("can't run " + command);
+    std::string text;
+    char buffer[4096];
+    std::size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        text.append(buffer, n);
+    int status = pclose(pipe);
+    if (status != 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 2))
+        throw std::runtime_error(command + " failed");
+    for (auto& m : flat_json::parse(text))
+        metrics[name + "." + m.first] = m.second;
+}
+
+// a server of our own for the load scenario, on a port nothing else should be using
+class scenario_server
+{
+    public:
+        scenario_server(const std::string& binary, int port)
+        {
+            pid_ = fork();
+            if (pid_ < 0)
+                throw std::runtime_error("can't fork the server");
+            if (pid_ == 0)
+            {
+                std::string p = std::to_string(port);
+                execl(binary.c_str(), binary.c_str(), "-t", "2", "-w", "0", "-g", "0", p.c_str(), (char*)nullptr);
+                _exit(127);
+            }
+            // up once it takes a connection
+            asio::io_context io;
+            for (int tries = 0; tries < 100; ++tries)
+            {
+                asio::ip::tcp::socket socket(io);
+                std::error_code ec;
+                socket.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port), ec);
+                if (!ec)
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            stop();
+            throw std::runtime_error("the server didn't come up");
+        }
+
+        ~scenario_server()
+        {
+            stop();
+        }
+
+    private:
+        void stop()
+        {
+            if (pid_ <= 0)
+                return;
+            kill(pid_, SIGTERM);
+            waitpid(pid_, nullptr, 0);
+            pid_ = 0;
+        }
+
+        pid_t pid_ = 0;
+};
+
+static std::string quoted(const std::string& s)
+{
+    return "\"" + s + "\"";
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        std::string baseline_file = "perf_baseline.txt";
+        std::string results_file;
+        std::string dir = ".";
+        bool save = false;
+        int port = 9450;
+        int seconds = 10;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-b" && i + 1 < argc)
+                baseline_file = argv[++i];
+            else if (arg == "-s")
+                save = true;
+            else if (arg == "-o" && i + 1 < argc)
+                results_file = argv[++i];
+            else if (arg == "-p" && i + 1 < argc)
+                port = std::atoi(argv[++i]);
+            else if (arg == "-d" && i + 1 < argc)
+                seconds = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "-x" && i + 1 < argc)
+                dir = argv[++i];
+            else
+            {
+                std::cerr << "Usage: perfgate [-b <baseline file>] [-s] [-o <results file>] [-p <port>] "
+                    "[-d <seconds>] [-x <binary dir>]\n";
+                return 1;
+            }
+        }
+
+        std::map<std::string, double> metrics;
+        run_tool("bench", dir + "/bench -r 9 -j", metrics);
+        {
+            // one run's time is noisy, the fastest of three isn't much
+            std::map<std::string, double> best;
+            for (int run = 0; run < 3; ++run)
+            {
+                std::map<std::string, double> sim;
+                run_tool("sim", dir + "/sim -n 50000 -r 42 -p 5 -s basic -t -j", sim);
+                if (best.empty() || sim["sim.ns_per_round"] < best["sim.ns_per_round"])
+                    best = sim;
+            }
+            metrics.insert(best.begin(), best.end());
+        }
+        {
+            scenario_server server(dir + "/server", port);
+            run_tool("loadgen", dir + "/loadgen 127.0.0.1 " + std::to_string(port) + " -c 200 -t 2 -r 1 -k 20 -s basic -d "
+                    + std::to_string(seconds) + " -j", metrics);
+        }
+
+        std::map<std::string, rule> baseline = load_baseline(baseline_file);
+        std::ostringstream json;
+        json.precision(12);
+        json << "{\n  \"metrics\": [";
+        int regressions = 0;
+        bool first = true;
+        std::cerr << std::left << std::setw(40) << "metric" << std::right << std::setw(14) << "value"
+            << std::setw(14) << "baseline" << std::setw(14) << "limit" << "  status\n";
+
+        // everything measured, then whatever the baseline checks that wasn't
+        std::map<std::string, bool> names;
+        for (auto& m : metrics)
+            names[m.first] = true;
+        for (auto& b : baseline)
+            names[b.first] = true;
+        for (auto& entry : names)
+        {
+            const std::string& name = entry.first;
+            auto m = metrics.find(name);
+            auto b = baseline.find(name);
+            std::string status;
+            if (m == metrics.end())
+                status = "missing";
+            else if (b == baseline.end())
+                status = "unchecked";
+            else
+                status = b->second.passes(m->second) ? "ok" : "regressed";
+            if (status == "missing" || status == "regressed")
+                regressions++;
+
+            json << (first ? "\n" : ",\n") << "    {\"name\": " << quoted(name);
+            first = false;
+            if (m != metrics.end())
+                json << ", \"value\": " << m->second;
+            if (b != baseline.end())
+                json << ", \"baseline\": " << b->second.value << ", \"rule\": " << quoted(b->second.kind)
+                    << ", \"tolerance\": " << quoted(b->second.tolerance_text())
+                    << ", \"limit\": " << b->second.limit();
+            json << ", \"status\": " << quoted(status) << "}";
+
+            if (status == "unchecked")
+                continue;
+            std::cerr << std::left << std::setw(40) << name << std::right << std::setprecision(4);
+            if (m != metrics.end())
+                std::cerr << std::setw(14) << m->second;
+            else
+                std::cerr << std::setw(14) << "-";
+            std::cerr << std::setw(14) << b->second.value << std::setw(14) << b->second.limit()
+                << "  " << status << "\n";
+        }
+        json << "\n  ],\n  \"regressions\": " << regressions << "\n}\n";
+        std::cout << json.str();
+        if (!results_file.empty())
+        {
+            std::ofstream out(results_file);
+            out << json.str();
+        }
+
+        if (save)
+        {
+            std::ofstream out(baseline_file);
+            out.precision(12);
+            out << "# <metric> <value> max|min|eq <tolerance>, written by perfgate -s\n";
+            for (auto& m : metrics)
+            {
+                rule r;
+                auto b = baseline.find(m.first);
+                if (b != baseline.end())
+                    r = b->second;
+                else if (!default_rule(m.first, r))
+                    continue;
+                out << m.first << " " << m.second << " " << r.kind << " " << r.tolerance_text() << "\n";
+            }
+            if (!out)
+                throw std::runtime_error("can't write " + baseline_file);
+            std::cerr << "baseline written to " << baseline_file << "\n";
+            return 0;
+        }
+        std::cerr << regressions << " regression" << (regressions == 1 ? "" : "s") << " against " << baseline_file << "\n";
+        return regressions ? 2 : 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,105 @@
+//
+// replay.cpp
+// ~~~~~~~~~~
+//
+// plays logged rounds again with this build's game logic and checks they come out the same
+//
+//   replay <hand log dir> [-p <player>] [-t <table>] [-s <since>] [-u <until>] [-n <limit>] [-v]
+//
+// a disputed round: narrow it down with -t and -s/-u and add -v to see it dealt again
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "../include/hand_log_reader.hpp"
+#include "../include/replay.hpp"
+
+static std::string cards_text(const std::vector<Card>& cards)
+{
+    std::string text;
+    for (auto& c : cards)
+        text += std::string(" ") + c.rank_ + c.suit_;
+    return text;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: replay <dir> [-p <player>] [-t <table>] [-s <since>] [-u <until>] [-n <limit>] [-v]\n";
+        return 1;
+    }
+    try
+    {
+        hand_query q;
+        bool verbose = false;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-p" && i + 1 < argc)
+                q.player = std::strtoul(argv[++i], nullptr, 10);
+            else if (arg == "-t" && i + 1 < argc)
+                q.table = std::atoi(argv[++i]);
+            else if (arg == "-s" && i + 1 < argc)
+                q.from_us = std::atoll(argv[++i]) * 1000000;
+            else if (arg == "-u" && i + 1 < argc)
+                q.to_us = std::atoll(argv[++i]) * 1000000;
+            else if (arg == "-n" && i + 1 < argc)
+                q.limit = std::strtoul(argv[++i], nullptr, 10);
+            else if (arg == "-v")
+                verbose = true;
+            else
+            {
+                std::cerr << "Unknown option " << arg << "\n";
+                return 1;
+            }
+        }
+
+        hand_log_reader reader(argv[1]);
+        std::size_t rounds = 0, mismatched = 0, damaged = 0;
+        auto start = std::chrono::steady_clock::now();
+        reader.each(q, [&](const hand_view& v)
+                {
+                hand_record logged;
+                if (!v.decode(logged))
+                {
+                    damaged++;
+                    return true;
+                }
+                hand_record replayed = round_replay::run(logged);
+                std::string diff = round_replay::diff(logged, replayed);
+                rounds++;
+                if (!diff.empty())
+                {
+                    mismatched++;
+                    std::cout << "#" << v.seq() << " table " << logged.table << " round " << logged.round
+                        << ": " << diff << "\n";
+                }
+                if (verbose)
+                {
+                    std::cout << "#" << v.seq() << " table " << logged.table << " round " << logged.round
+                        << " seed " << logged.seed << " offset " << logged.shoe_offset
+                        << "\n    dealer" << cards_text(replayed.dealer) << "\n";
+                    for (auto& s : replayed.seats)
+                    {
+                        std::cout << "    seat " << (int)s.seat << " player " << s.player << " payout " << s.payout;
+                        for (auto& h : s.hands)
+                            std::cout << " |" << cards_text(h);
+                        std::cout << "\n";
+                    }
+                }
+                return true;
+                });
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << rounds << " rounds replayed, " << mismatched << " differ, " << damaged << " damaged, "
+            << (seconds > 0 ? rounds / seconds : 0) << " rounds/s\n";
+        return mismatched || damaged ? 2 : 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,381 @@
+//
+// servercheck.cpp
+// ~~~~~~~~~~~~~~~
+//
+// plays scripted scenarios against a server of its own and checks what the players and the ledger end up with
+//
+//   servercheck [-p <port>] [-x <binary dir>]
+//
+// the server has to be built already (make check does both). every scenario starts a fresh
+// server with a ledger in a directory of its own, and says ok or what went wrong on stderr.
+// servercheck exits with 2 when a scenario failed.
+//
+
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "asio.hpp"
+#include "../include/chat_message.hpp"
+#include "../include/ledger.hpp"
+
+using asio::ip::tcp;
+
+static std::string binary_dir = ".";
+static int port = 9460;
+
+// the server's metrics port, next to its game port
+static int metrics_port()
+{
+    return port + 1000;
+}
+
+// a server with a ledger and an operator console, both in a directory that goes with it
+class check_server
+{
+    public:
+        explicit check_server(const std::vector<std::string>& options)
+        {
+            char dir[] = "/tmp/servercheck-XXXXXX";
+            if (!mkdtemp(dir))
+                throw std::runtime_error("can't make a directory for the server");
+            dir_ = dir;
+            console_ = dir_ + "/admin.sock";
+            pid_ = fork();
+            if (pid_ < 0)
+                throw std::runtime_error("can't fork the server");
+            if (pid_ == 0)
+            {
+                std::vector<std::string> args = { binary_dir + "/server", "-g", "0", "-L", dir_ + "/ledger",
+                    "-a", console_, "-M", std::to_string(metrics_port()) };
+                args.insert(args.end(), options.begin(), options.end());
+                args.push_back(std::to_string(port));
+                std::vector<char*> argv;
+                for (auto& arg : args)
+                    argv.push_back(&arg[0]);
+                argv.push_back(nullptr);
+                execv(argv[0], argv.data());
+                _exit(127);
+            }
+            // up once the console and the game port both answer
+            for (int tries = 0; tries < 100; ++tries)
+            {
+                asio::local::stream_protocol::socket console(io_);
+                tcp::socket game(io_);
+                std::error_code ec;
+                console.connect(asio::local::stream_protocol::endpoint(console_), ec);
+                if (!ec)
+                    game.connect(tcp::endpoint(asio::ip::address_v4::loopback(), port), ec);
+                if (!ec)
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            stop();
+            throw std::runtime_error("the server didn't come up");
+        }
+
+        ~check_server()
+        {
+            stop();
+            std::system(("rm -rf " + dir_).c_str());
+        }
+
+        // one console command, its reply up to the empty line that ends it
+        std::string console(const std::string& command)
+        {
+            asio::local::stream_protocol::socket socket(io_);
+            socket.connect(asio::local::stream_protocol::endpoint(console_));
+            asio::write(socket, asio::buffer(command + "\n"));
+            asio::streambuf buffer;
+            std::string reply;
+            for (;;)
+            {
+                asio::read_until(socket, buffer, '\n');
+                std::istream in(&buffer);
+                std::string line;
+                std::getline(in, line);
+                if (line.empty())
+                    return reply;
+                reply += line + "\n";
+            }
+        }
+
+        // a counter or gauge off the metrics page, -1 when it isn't there
+        std::int64_t metric(const std::string& name)
+        {
+            tcp::socket socket(io_);
+            socket.connect(tcp::endpoint(asio::ip::address_v4::loopback(), metrics_port()));
+            asio::write(socket, asio::buffer(std::string("GET /metrics HTTP/1.0\r\n\r\n")));
+            asio::streambuf buffer;
+            std::error_code ec;
+            asio::read(socket, buffer, ec);
+            std::istream in(&buffer);
+            std::string line;
+            while (std::getline(in, line))
+                if (line.compare(0, name.size() + 1, name + " ") == 0)
+                    return std::atoll(line.c_str() + name.size() + 1);
+            return -1;
+        }
+
+        // the balance the ledger holds for the last player numbered, read once the server is gone
+        // SIGTERM kills it outright, the WAL writer gets a moment to write out what it has first
+        std::int64_t balance()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            stop();
+            ledger credits(dir_ + "/ledger");
+            return credits.balance(credits.max_player());
+        }
+
+    private:
+        void stop()
+        {
+            if (pid_ <= 0)
+                return;
+            kill(pid_, SIGTERM);
+            waitpid(pid_, nullptr, 0);
+            pid_ = 0;
+        }
+
+        asio::io_context io_;
+        std::string dir_;
+        std::string console_;
+        pid_t pid_ = 0;
+};
+
+// a player speaking the protocol by hand, every read gives up after a few seconds
+class check_player
+{
+    public:
+        check_player()
+            : socket_(io_)
+        {
+            socket_.connect(tcp::endpoint(asio::ip::address_v4::loopback(), port));
+            chat_message hello;
+            hello.ca.client_credits = 100;
+            send(hello);
+            chat_message msg;
+            while (read(msg) && msg.ca.given_id == 0)
+                ;
+            id = msg.ca.given_id;
+        }
+
+        void send(chat_message& msg)
+        {
+            msg.encode_header();
+            asio::write(socket_, asio::buffer(msg.data(), msg.length()));
+        }
+
+        // false once the server hangs up or goes quiet, credits follow every message meant for us
+        bool read(chat_message& msg)
+        {
+            pollfd quiet = { socket_.native_handle(), POLLIN, 0 };
+            if (poll(&quiet, 1, 5000) != 1)
+                return false;
+            std::error_code ec;
+            asio::read(socket_, asio::buffer(msg.data(), chat_message::header_length), ec);
+            if (ec || !msg.decode_header())
+                return false;
+            asio::read(socket_, asio::buffer(msg.body(), msg.body_length()), ec);
+            if (ec)
+                return false;
+            if (msg.ca.id == id && id != 0)
+                credits = msg.ca.client_credits;
+            return true;
+        }
+
+        // reads until a message passes the test
+        bool wait_for(const std::function<bool(const chat_message&)>& test)
+        {
+            chat_message msg;
+            while (read(msg))
+                if (test(msg))
+                    return true;
+            return false;
+        }
+
+        // plain text goes to everyone at the table as it is
+        void say(const std::string& text)
+        {
+            chat_message msg;
+            text.copy(msg.ca.g, sizeof(msg.ca.g) - 1);
+            msg.ca.g[std::min(text.size(), sizeof(msg.ca.g) - 1)] = '\0';
+            send(msg);
+        }
+
+        void bet(int amount)
+        {
+            chat_message msg;
+            msg.ca.play = true;
+            msg.ca.bet = amount;
+            msg.ca.client_credits = 100;
+            send(msg);
+        }
+
+        int id = 0;
+        int credits = 0;
+
+    private:
+        asio::io_context io_;
+        tcp::socket socket_;
+};
+
+static bool expect(bool ok, const std::string& what)
+{
+    if (!ok)
+        std::cerr << "  " << what << "\n";
+    return ok;
+}
+
+// a console close takes the table from the players, their stakes have to come back first
+static bool close_returns_stakes(bool in_round)
+{
+    check_server server({ "-w", in_round ? "0" : "30" });
+    check_player player;
+    player.bet(10);
+    bool ok = expect(player.wait_for([&](const chat_message& msg) { return in_round ? msg.ca.turn == player.id
+                    : msg.ca.id == player.id; }), "the bet was never dealt");
+    server.console("close 1");
+    player.wait_for([](const chat_message&) { return false; }); // everything up to the hang up
+    ok = expect(player.credits == 100, "the player was told " + std::to_string(player.credits) + " credits, not 100") && ok;
+    std::int64_t balance = server.balance();
+    return expect(balance == 100, "the ledger holds " + std::to_string(balance) + " credits, not 100") && ok;
+}
+
+static bool text(const chat_message& msg)
+{
+    const client_action& ca = msg.ca;
+    return !ca.play && !ca.hit && !ca.split && !ca.stand && !ca.notice && !ca.revealed && ca.given_id == 0;
+}
+
+// one player talks while the rebalancer moves sessions between io threads, everyone at the
+// table must hear every line they get in the order it was said
+static bool order_survives_thread_moves()
+{
+    check_server server({ "-t", "2", "-b", "1", "-w", "60" });
+    // connections go to the two threads in turn, one of each pair is closed again right away, so
+    // the table starts out on one thread and the rebalancer moves half of it to the other
+    auto paired = []()
+    {
+        std::unique_ptr<check_player> kept(new check_player);
+        check_player gone;
+        return kept;
+    };
+    // the talker hears itself like everyone else, a client that stops reading can't be moved
+    std::vector<std::unique_ptr<check_player>> listeners;
+    for (int i = 0; i < 6; ++i)
+        listeners.push_back(paired());
+    check_player* talker = listeners.back().get();
+    std::vector<int> heard(listeners.size()), overtaken(listeners.size());
+    std::vector<std::thread> readers;
+    for (std::size_t i = 0; i < listeners.size(); ++i)
+        readers.emplace_back([&, i]()
+                {
+                int last = -1;
+                listeners[i]->wait_for([&](const chat_message& msg)
+                        {
+                        if (msg.ca.id != talker->id || !text(msg))
+                            return false;
+                        if (std::string(msg.ca.g) == "end")
+                            return true;
+                        int n = std::atoi(msg.ca.g);
+                        overtaken[i] += n < last;
+                        last = n;
+                        heard[i]++;
+                        return false;
+                        });
+                });
+
+    // more of the same keeps the threads out of balance, the players sit at other tables
+    std::vector<std::unique_ptr<check_player>> load;
+    auto unbalance = [&]()
+    {
+        for (int i = 0; i < 8; ++i)
+            load.push_back(paired());
+    };
+
+    // the readers give up once the server goes quiet, they are waited for whatever happens here
+    std::exception_ptr failure;
+    try
+    {
+        auto start = std::chrono::steady_clock::now();
+        int said = 0;
+        while (std::chrono::steady_clock::now() - start < std::chrono::seconds(6))
+        {
+            talker->say(std::to_string(said++));
+            if (said % 2000 == 0)
+                unbalance();
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+        talker->say("end");
+    }
+    catch (...)
+    {
+        failure = std::current_exception();
+    }
+    for (auto& reader : readers)
+        reader.join();
+    if (failure)
+        std::rethrow_exception(failure);
+
+    bool ok = true;
+    for (std::size_t i = 0; i < listeners.size(); ++i)
+        ok = expect(overtaken[i] == 0, "listener " + std::to_string(i) + " heard " + std::to_string(overtaken[i])
+                + " of " + std::to_string(heard[i]) + " lines out of order") && ok;
+    std::int64_t moves = server.metric("blackjack_thread_moves_total");
+    return expect(moves > 0, "nobody was moved to another thread") && ok;
+}
+
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-p" && i + 1 < argc)
+            port = std::atoi(argv[++i]);
+        else if (arg == "-x" && i + 1 < argc)
+            binary_dir = argv[++i];
+        else
+        {
+            std::cerr << "Usage: servercheck [-p <port>] [-x <binary dir>]\n";
+            return 1;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::function<bool()>>> scenarios = {
+        { "close between rounds returns the stakes", []() { return close_returns_stakes(false); } },
+        { "close in a round returns the stakes", []() { return close_returns_stakes(true); } },
+        { "messages keep their order across thread moves", order_survives_thread_moves },
+    };
+    int failed = 0;
+    for (auto& scenario : scenarios)
+    {
+        std::cerr << scenario.first << "\n";
+        bool ok = false;
+        try
+        {
+            ok = scenario.second();
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "  Exception: " << e.what() << "\n";
+        }
+        std::cerr << "  " << (ok ? "ok" : "FAILED") << "\n";
+        failed += !ok;
+        port++; // the last server's port may still be in TIME_WAIT
+    }
+    std::cerr << failed << " of " << scenarios.size() << " scenarios failed\n";
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,163 @@
+//
+// shoecheck.cpp
+// ~~~~~~~~~~~~~
+//
+// checks the shoe log the server writes next to its hand log
+//
+//   shoecheck <hand log dir> [-j <threads>] [-v]
+//
+// every revealed shoe must hash to the commitment logged before it, at the same table.
+// every logged round must come from a shoe that was committed before the round started;
+// rounds from shoes that aren't revealed yet are counted but can't be checked.
+// -v lists every shoe. exits with 2 when anything doesn't check out.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/hand_log_reader.hpp"
+#include "../include/shoe_commit.hpp"
+
+struct logged_shoe
+{
+    shoe_record record;
+    std::uint64_t seq = 0;
+};
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: shoecheck <hand log dir> [-j <threads>] [-v]\n";
+        return 1;
+    }
+    try
+    {
+        std::string dir = argv[1];
+        std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        bool verbose = false;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-j" && i + 1 < argc)
+                threads = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+            else if (arg == "-v")
+                verbose = true;
+            else
+            {
+                std::cerr << "Unknown option " << arg << "\n";
+                return 1;
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::map<std::string, logged_shoe> commits; // by commitment
+        std::vector<logged_shoe> reveals;
+        std::size_t damaged = 0;
+        log_format::replay(dir, "shoes", 0, [&](const char* payload, std::uint32_t length, std::uint64_t seq)
+                {
+                logged_shoe s;
+                s.seq = seq;
+                if (!s.record.decode(payload, length))
+                {
+                    damaged++;
+                    return;
+                }
+                std::string key((const char*)s.record.shoe.commitment, sizeof(s.record.shoe.commitment));
+                if (s.record.kind == shoe_record::kind_t::commit)
+                    commits.insert(std::make_pair(key, s));
+                else
+                    reveals.push_back(s);
+                });
+
+        // the hashing is most of the work and every shoe stands alone
+        auto hash_start = std::chrono::steady_clock::now();
+        std::vector<char> good(reveals.size());
+        std::vector<std::thread> workers;
+        for (std::size_t w = 0; w < threads; ++w)
+        {
+            workers.emplace_back([&, w]()
+                    {
+                    for (std::size_t i = w; i < reveals.size(); i += threads)
+                        good[i] = reveals[i].record.shoe.verify();
+                    });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        double hashed = std::chrono::duration<double>(std::chrono::steady_clock::now() - hash_start).count();
+
+        // a restarted server may reveal a shoe the old process already revealed, that is fine
+        std::set<std::string> revealed;
+        std::size_t bad = 0, uncommitted = 0;
+        std::multimap<std::pair<int, std::uint32_t>, std::int64_t> dealt_from; // table, seed -> committed at
+        for (std::size_t i = 0; i < reveals.size(); ++i)
+        {
+            const shoe_record& r = reveals[i].record;
+            std::string key((const char*)r.shoe.commitment, sizeof(r.shoe.commitment));
+            auto c = commits.find(key);
+            bool committed = c != commits.end() && c->second.seq < reveals[i].seq && c->second.record.table == r.table;
+            if (!good[i])
+                bad++;
+            else if (!committed)
+                uncommitted++;
+            else
+                dealt_from.insert(std::make_pair(std::make_pair(r.table, r.shoe.seed), c->second.record.at_us));
+            if (verbose || !good[i] || !committed)
+                std::cout << "table " << r.table << " shoe " << sha256::hex(r.shoe.commitment).substr(0, 16)
+                    << " seed " << r.shoe.seed << " " << r.dealt << " cards: "
+                    << (!good[i] ? "DOES NOT MATCH ITS COMMITMENT" : !committed ? "NO COMMITMENT BEFORE IT" : "ok")
+                    << "\n";
+            revealed.insert(key);
+        }
+
+        std::size_t open = 0;
+        for (auto& c : commits)
+            open += revealed.count(c.first) == 0;
+
+        std::size_t rounds = 0, unrevealed = 0, early = 0;
+        hand_log_reader hands(dir);
+        hands.each(hand_query(), [&](const hand_view& v)
+                {
+                hand_record round;
+                if (!v.decode(round))
+                {
+                    damaged++;
+                    return true;
+                }
+                rounds++;
+                auto range = dealt_from.equal_range(std::make_pair(round.table, round.seed));
+                if (range.first == range.second)
+                {
+                    unrevealed++;
+                    return true;
+                }
+                for (auto it = range.first; it != range.second; ++it)
+                    if (it->second <= round.started_us)
+                        return true;
+                early++;
+                std::cout << "#" << v.seq() << " table " << round.table << " round " << round.round
+                    << ": dealt before its shoe was committed\n";
+                return true;
+                });
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << reveals.size() << " shoes revealed, " << bad << " don't match, " << uncommitted
+            << " weren't committed first, " << open << " still open, " << damaged << " damaged\n"
+            << rounds << " rounds, " << rounds - unrevealed - early << " from checked shoes, "
+            << unrevealed << " from open shoes, " << early << " dealt before the commitment\n"
+            << (hashed > 0 ? reveals.size() / hashed : 0) << " shoes/s on " << threads << " threads, "
+            << seconds * 1000 << " ms in all\n";
+        return bad || uncommitted || early || damaged ? 2 : 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,276 @@
+//
+// sim.cpp
+// ~~~~~~~
+//
+// deals rounds on the table's game logic as fast as it goes, no sockets
+//
+//   sim [-n <rounds>] [-p <players>] [-s stand|dealer|basic] [-r <seed>] [-b <bet>] [-t] [-j]
+//       [-e <edge precision %>] [-c <confidence %>] [-P <rounds>]
+//
+// every round all -p seats (5 unless given) bet -b, play their hands with the strategy (basic
+// unless given) and settle against the dealer, the shoe is shuffled again at the cut card like
+// at a table. the same seed deals the same rounds, so with the same code the result is exactly
+// the same, a change that moves it changed the game. -t builds the table text after every
+// action like the server does. -j prints the results as JSON.
+//
+// the house edge comes with a confidence interval (-c, 95% unless given). the seats of a round
+// share the dealer's hand, so the interval is taken over rounds, not hands. with -e the run
+// stops as soon as the interval is no wider than +-precision, -n is then only the limit.
+// -P prints a snapshot every so many rounds to stderr, a line of JSON each with -j.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../include/flat_json.hpp"
+#include "../include/strategy.hpp"
+#include "../include/table_game.hpp"
+
+// mean and variance in one pass, without the cancellation of summing squares (Welford)
+class running_stats
+{
+    public:
+        void add(double x)
+        {
+            n_++;
+            double d = x - mean_;
+            mean_ += d / n_;
+            m2_ += d * (x - mean_);
+        }
+
+        std::uint64_t count() const
+        {
+            return n_;
+        }
+
+        double mean() const
+        {
+            return mean_;
+        }
+
+        double variance() const
+        {
+            return n_ > 1 ? m2_ / (n_ - 1) : 0;
+        }
+
+        double stddev() const
+        {
+            return std::sqrt(variance());
+        }
+
+        // of the mean
+        double standard_error() const
+        {
+            return n_ > 1 ? std::sqrt(variance() / n_) : INFINITY;
+        }
+
+    private:
+        std::uint64_t n_ = 0;
+        double mean_ = 0;
+        double m2_ = 0;
+};
+
+// how many standard errors either side hold confidence of a normal distribution
+static double z_score(double confidence)
+{
+    double low = 0, high = 10;
+    for (int i = 0; i < 100; ++i)
+    {
+        double mid = (low + high) / 2;
+        if (std::erf(mid / std::sqrt(2.0)) < confidence)
+            low = mid;
+        else
+            high = mid;
+    }
+    return (low + high) / 2;
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        std::uint64_t rounds = 1000000;
+        int players = 5;
+        strategy play = strategy::basic;
+        std::uint32_t seed = 1;
+        int bet = 2;
+        bool text = false, json = false;
+        double precision = 0;   // of the house edge in percent, 0 runs all the rounds
+        double confidence = 95;
+        std::uint64_t progress = 0;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "-n" && i + 1 < argc)
+                rounds = std::strtoull(argv[++i], nullptr, 10);
+            else if (arg == "-p" && i + 1 < argc)
+                players = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "-s" && i + 1 < argc && parse_strategy(argv[i + 1], play))
+                ++i;
+            else if (arg == "-r" && i + 1 < argc)
+                seed = std::strtoul(argv[++i], nullptr, 10);
+            else if (arg == "-b" && i + 1 < argc)
+                bet = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "-t")
+                text = true;
+            else if (arg == "-j")
+                json = true;
+            else if (arg == "-e" && i + 1 < argc)
+                precision = std::atof(argv[++i]);
+            else if (arg == "-c" && i + 1 < argc)
+                confidence = std::min(99.9999, std::max(50.0, std::atof(argv[++i])));
+            else if (arg == "-P" && i + 1 < argc)
+                progress = std::strtoull(argv[++i], nullptr, 10);
+            else
+            {
+                std::cerr << "Usage: sim [-n <rounds>] [-p <players>] [-s stand|dealer|basic] [-r <seed>] [-b <bet>] [-t] [-j]\n"
+                    "           [-e <edge precision %>] [-c <confidence %>] [-P <rounds>]\n";
+                return 1;
+            }
+        }
+
+        std::vector<int> seats;
+        for (int seat = 1; seat <= players; ++seat)
+            seats.push_back(seat);
+        auto seat_of = [](int seat) { return seat; };
+
+        // the shoes' seeds come from the run's seed, one after another
+        std::mt19937 shoes(seed);
+        table_game game;
+        game.shuffle(shoes());
+        std::uint64_t shuffles = 1, hands = 0, wins = 0, pushes = 0, losses = 0;
+        std::int64_t net = 0;
+        std::size_t text_bytes = 0;
+        double z = z_score(confidence / 100);
+        running_stats per_hand, per_round; // returns as a fraction of the bet
+
+        // the house edge in percent and how far either side of it the interval reaches
+        auto edge = [&]() { return -per_round.mean() * 100; };
+        auto margin = [&]() { return z * per_round.standard_error() * 100; };
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+        auto report = [&](flat_json& out)
+        {
+            out.add("rounds", per_round.count());
+            out.add("hands", hands);
+            out.add("shuffles", shuffles);
+            out.add("net", net);
+            out.add("wins", wins);
+            out.add("pushes", pushes);
+            out.add("losses", losses);
+            out.add("house_edge_pct", edge());
+            out.add("ci_low_pct", edge() - margin());
+            out.add("ci_high_pct", edge() + margin());
+            out.add("confidence_pct", confidence);
+            out.add("hand_mean", per_hand.mean());
+            out.add("hand_stddev", per_hand.stddev());
+            out.add("seconds", elapsed());
+            out.add("rounds_per_s", per_round.count() / elapsed());
+        };
+
+        // the interval needs a few thousand rounds before its own width can be trusted
+        const std::uint64_t min_rounds = 10000, check_every = 1000;
+        bool converged = false;
+        std::uint64_t round = 0;
+        for (; round < rounds && !converged; ++round)
+        {
+            if (game.deck().cardsLeft() < table_game::shoe_cards / 4) // cut card
+            {
+                game.shuffle(shoes());
+                shuffles++;
+            }
+            for (int seat : seats)
+            {
+                game.play(seat);
+                if (text)
+                    text_bytes += game.printTable(seats, seat_of).size();
+            }
+            int up = game.dealer.hand().inHand[0].value;
+            for (int seat : seats)
+            {
+                for (;;)
+                {
+                    const std::vector<Card>& cards = game.seats().at(seat).hands().back().inHand;
+                    if (!should_hit(play, cards, up))
+                        break;
+                    bool busted = game.hit(seat);
+                    if (text)
+                        text_bytes += game.printTable(seats, seat_of).size();
+                    if (busted)
+                        break;
+                }
+                game.stand(seat);
+            }
+            game.dealerPlay();
+            if (text)
+                text_bytes += game.printTable(seats, seat_of).size();
+            std::int64_t round_net = 0;
+            for (int seat : seats)
+            {
+                int won = game.settle(seat, bet);
+                net += won;
+                round_net += won;
+                per_hand.add(double(won) / bet);
+                hands++;
+                if (won > 0)
+                    wins++;
+                else if (won == 0)
+                    pushes++;
+                else
+                    losses++;
+            }
+            game.clear();
+            // the house edge is what the players lose per unit bet
+            per_round.add(double(round_net) / (double(seats.size()) * bet));
+
+            std::uint64_t done = round + 1;
+            if (precision > 0 && done >= min_rounds && done % check_every == 0 && margin() <= precision)
+                converged = true;
+            if (progress && done % progress == 0)
+            {
+                if (json)
+                {
+                    flat_json snapshot;
+                    report(snapshot);
+                    std::cerr << snapshot.line();
+                }
+                else
+                    std::cerr << done << " rounds, house edge " << std::fixed << std::setprecision(3) << edge()
+                        << "% +- " << margin() << "%, " << std::setprecision(0) << done / elapsed() << " rounds/s\n";
+            }
+        }
+        double seconds = elapsed();
+
+        if (json)
+        {
+            flat_json out;
+            report(out);
+            out.add("converged", converged);
+            out.add("ns_per_round", seconds * 1e9 / std::max<std::uint64_t>(1, round));
+            out.add("text_bytes", text_bytes);
+            std::cout << out.str();
+            return 0;
+        }
+        std::cout << round << " rounds, " << hands << " hands from " << shuffles << " shoes\n"
+            << wins << " won, " << pushes << " pushed, " << losses << " lost, net " << net << "\n"
+            << std::fixed << std::setprecision(3) << "house edge " << edge() << "% +- " << margin() << "%, "
+            << edge() - margin() << "% to " << edge() + margin() << "% at " << std::setprecision(1) << confidence
+            << "% confidence\n" << std::setprecision(3)
+            << "per hand " << per_hand.mean() << " of the bet, standard deviation " << per_hand.stddev() << "\n";
+        if (precision > 0)
+            std::cout << (converged ? "stopped at the requested precision\n" : "stopped at -n before reaching the precision\n");
+        std::cout << std::setprecision(0) << round / seconds << " rounds/s, " << std::setprecision(1)
+            << seconds * 1e9 / std::max<std::uint64_t>(1, round) << " ns/round\n";
+        return 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+}